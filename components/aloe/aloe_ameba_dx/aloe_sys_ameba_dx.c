@@ -50,6 +50,7 @@ void* aloe_mem_malloc(aloe_mem_id_t id, size_t sz, const char *name) {
 		mm->sig = &aloe_mem_sig;
 		mm->id = id;
 		mm->sz = sz;
+		aloe_mem_acct_add(mm, name);
 		mm++;
 	}
 	return (void*)mm;
@@ -78,6 +79,7 @@ void* aloe_mem_calloc(aloe_mem_id_t id, size_t mb, size_t sz, const char *name)
 		mm->sig = &aloe_mem_sig;
 		mm->id = id;
 		mm->sz = sz;
+		aloe_mem_acct_add(mm, name);
 		mm++;
 	}
 	return (void*)mm;
@@ -90,6 +92,7 @@ int aloe_mem_free(void *_mm) {
 
 	mm = (aloe_mem_t*)_mm - 1;
 	if (mm->sig != &aloe_mem_sig) return -1;
+	aloe_mem_acct_del(mm);
 	switch (mm->id) {
 	case aloe_mem_id_dxmem:
 		dxMemFree(mm);
@@ -106,3 +109,16 @@ int aloe_mem_free(void *_mm) {
 	return -1;
 }
 
+size_t aloe_mem_avail(aloe_mem_id_t id) {
+	switch (id) {
+	case aloe_mem_id_dxmem:
+	case aloe_mem_id_stdc:
+		// total free, fragment not known
+		return xPortGetFreeHeapSize();
+	default:
+		break;
+	}
+	// reserved PSRAM not report free size
+	return 0;
+}
+
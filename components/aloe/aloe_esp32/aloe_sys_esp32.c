@@ -10,9 +10,10 @@
  */
 
 #include <aloe_sys.h>
+#include <esp_netif.h>
+#include <esp_heap_caps.h>
 
-void* aloe_mem_malloc(aloe_mem_id_t id, size_t sz,
-		const char *name __attribute__((unused))) {
+void* aloe_mem_malloc(aloe_mem_id_t id, size_t sz, const char *name) {
 	aloe_mem_t *mm = NULL;
 
 	switch (id) {
@@ -28,13 +29,14 @@ void* aloe_mem_malloc(aloe_mem_id_t id, size_t sz,
 		mm->sig = &aloe_mem_sig;
 		mm->id = id;
 		mm->sz = sz;
+		aloe_mem_acct_add(mm, name);
 		mm++;
 	}
 	return (void*)mm;
 }
 
 void* aloe_mem_calloc(aloe_mem_id_t id, size_t mb, size_t sz,
-		const char *name __attribute__((unused))) {
+		const char *name) {
 	aloe_mem_t *mm = NULL;
 
 	sz *= mb;
@@ -52,6 +54,7 @@ void* aloe_mem_calloc(aloe_mem_id_t id, size_t mb, size_t sz,
 		mm->sig = &aloe_mem_sig;
 		mm->id = id;
 		mm->sz = sz;
+		aloe_mem_acct_add(mm, name);
 		mm++;
 	}
 	return (void*)mm;
@@ -64,8 +67,10 @@ int aloe_mem_free(void *_mm) {
 
 	mm = (aloe_mem_t*)_mm - 1;
 	if (mm->sig != &aloe_mem_sig) return -1;
+	aloe_mem_acct_del(mm);
 	switch (mm->id) {
 	case aloe_mem_id_dxmem:
+	case aloe_mem_id_psram:
 	case aloe_mem_id_stdc:
 		free(mm);
 		return 0;
@@ -75,6 +80,19 @@ int aloe_mem_free(void *_mm) {
 	return -1;
 }
 
+size_t aloe_mem_avail(aloe_mem_id_t id) {
+	switch (id) {
+	case aloe_mem_id_dxmem:
+	case aloe_mem_id_psram:
+	case aloe_mem_id_stdc:
+		// where malloc take from, PSRAM too when SPIRAM_USE_MALLOC
+		return heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT);
+	default:
+		break;
+	}
+	return 0;
+}
+
 ALOE_SYS_TEXT1_SECTION
 __attribute__((unused))
 static int snstrncpy(char *buf, size_t buf_sz, const char *name, size_t len) {
@@ -152,3 +170,57 @@ int aloe_thread_run(aloe_thread_t *aloe_thread, void(*run)(aloe_thread_t*),
 	}
 	return 0;
 }
+
+ALOE_SYS_TEXT1_SECTION
+int aloe_mq_init(aloe_mq_t *aloe_mq, int cnt, size_t item_sz,
+		const char *name __attribute__((unused))) {
+	if (!(aloe_mq->mq = xQueueCreate((UBaseType_t)cnt, (UBaseType_t)item_sz))) {
+		return -1;
+	}
+	return 0;
+}
+
+ALOE_SYS_TEXT1_SECTION
+int aloe_mq_send(aloe_mq_t *aloe_mq, const void *item, void *rt, long dur) {
+	BaseType_t eno;
+
+	if (rt) {
+		eno = xQueueSendFromISR(aloe_mq->mq, item, (BaseType_t*)rt);
+	} else {
+		eno = xQueueSend(aloe_mq->mq, item, aloe_msDur(dur));
+	}
+	return eno == pdTRUE ? 0 : -1;
+}
+
+ALOE_SYS_TEXT1_SECTION
+int aloe_mq_recv(aloe_mq_t *aloe_mq, void *item, void *rt, long dur) {
+	BaseType_t eno;
+
+	if (rt) {
+		eno = xQueueReceiveFromISR(aloe_mq->mq, item, (BaseType_t*)rt);
+	} else {
+		eno = xQueueReceive(aloe_mq->mq, item, aloe_msDur(dur));
+	}
+	return eno == pdTRUE ? 0 : -1;
+}
+
+ALOE_SYS_TEXT1_SECTION
+void aloe_mq_destroy(aloe_mq_t *aloe_mq) {
+	vQueueDelete(aloe_mq->mq);
+}
+
+ALOE_SYS_TEXT1_SECTION
+int aloe_ifaddr_get(const char *ifname, aloe_ifaddr_t *ifaddr) {
+	esp_netif_t *netif;
+	esp_netif_ip_info_t ipinfo;
+
+	if (!(netif = ifname ? esp_netif_get_handle_from_ifkey(ifname) :
+			esp_netif_get_default_netif())) {
+		return -1;
+	}
+	if (esp_netif_get_ip_info(netif, &ipinfo) != ESP_OK) return -1;
+	ifaddr->addr = ipinfo.ip.addr;
+	ifaddr->netmask = ipinfo.netmask.addr;
+	ifaddr->gw = ipinfo.gw.addr;
+	return 0;
+}
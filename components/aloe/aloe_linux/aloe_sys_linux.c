@@ -10,6 +10,10 @@
  */
 
 #include <aloe_sys.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <unistd.h>
 
 #if 1
 
@@ -61,9 +65,136 @@ static int cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex,
 	return pthread_cond_timedwait(cond, mutex, &tv);
 }
 
+/* virtual clock start, keep away from 0 */
+#define sim_ts_start aloe_ms2tick(aloe_10e3)
+
+typedef struct sim_thd_rec {
+	pthread_cond_t cond;
+
+	/* waiting object, NULL for sleep */
+	const void *obj;
+
+	/* virtual time to wake, -1 for infinite */
+	unsigned long due;
+	unsigned timeout: 1;
+
+	TAILQ_ENTRY(sim_thd_rec) qent;
+} sim_thd_t;
+
+typedef TAILQ_HEAD(sim_thd_queue_rec, sim_thd_rec) sim_thd_queue_t;
+
+static struct {
+	unsigned on: 1;
+	pthread_mutex_t lock;
+	unsigned long ts;
+
+	/* the only one thread running */
+	sim_thd_t *cur;
+	sim_thd_queue_t ready_q, wait_q;
+} sim = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread sim_thd_t *sim_self;
+
+/** Hand over to the next thread, wait to be the one running, lock held. */
+static void sim_switch(void) {
+	sim_thd_t *thd, *nx = NULL;
+
+	if (!(nx = TAILQ_FIRST(&sim.ready_q))) {
+		// advance virtual clock, first in the queue win the tie
+		TAILQ_FOREACH(thd, &sim.wait_q, qent) {
+			if (thd->due != (unsigned long)-1 && (!nx || thd->due < nx->due)) {
+				nx = thd;
+			}
+		}
+		if (!nx) {
+			aloe_log_e("simulation deadlock\n");
+			abort();
+		}
+		TAILQ_REMOVE(&sim.wait_q, nx, qent);
+		if (nx->due > sim.ts) sim.ts = nx->due;
+		nx->timeout = 1;
+	} else {
+		TAILQ_REMOVE(&sim.ready_q, nx, qent);
+	}
+	sim.cur = nx;
+	pthread_cond_signal(&nx->cond);
+	if (!sim_self) return;
+	while (sim.cur != sim_self) pthread_cond_wait(&sim_self->cond, &sim.lock);
+}
+
+/** Block on the object until woken or due, return ETIMEDOUT, lock held. */
+static int sim_block(const void *obj, unsigned long dur_us) {
+	sim_thd_t *self = sim_self;
+
+	self->obj = obj;
+	self->due = dur_us == (unsigned long)-1 ? dur_us : sim.ts + dur_us;
+	self->timeout = 0;
+	TAILQ_INSERT_TAIL(&sim.wait_q, self, qent);
+	sim_switch();
+	return self->timeout ? ETIMEDOUT : 0;
+}
+
+/** Ready the first waiting on the object, lock held. */
+static void sim_wake(const void *obj) {
+	sim_thd_t *thd;
+
+	TAILQ_FOREACH(thd, &sim.wait_q, qent) {
+		if (thd->obj == obj) {
+			TAILQ_REMOVE(&sim.wait_q, thd, qent);
+			TAILQ_INSERT_TAIL(&sim.ready_q, thd, qent);
+			return;
+		}
+	}
+}
+
+static unsigned long sim_dur_us(long dur_ms) {
+	return dur_ms < 0 || (unsigned long)dur_ms == aloe_dur_infinite ?
+			(unsigned long)-1 : aloe_ms2tick((unsigned long)dur_ms);
+}
+
+static sim_thd_t* sim_thd_new(void) {
+	sim_thd_t *thd;
+
+	if (!(thd = (sim_thd_t*)calloc(1, sizeof(*thd)))) return NULL;
+	if (pthread_cond_init(&thd->cond, NULL) != 0) {
+		free(thd);
+		return NULL;
+	}
+	return thd;
+}
+
+int aloe_sim_start(void) {
+	if (sim.on) return 0;
+	if (!(sim_self = sim_thd_new())) return ENOMEM;
+	TAILQ_INIT(&sim.ready_q);
+	TAILQ_INIT(&sim.wait_q);
+	sim.ts = sim_ts_start;
+	sim.cur = sim_self;
+	sim.on = 1;
+	return 0;
+}
+
+int aloe_sim_on(void) {
+	return sim.on;
+}
+
+void aloe_thread_usleep(unsigned long us) {
+	if (!sim.on) {
+		usleep(us);
+		return;
+	}
+	pthread_mutex_lock(&sim.lock);
+	sim_block(NULL, us);
+	pthread_mutex_unlock(&sim.lock);
+}
+
 unsigned long aloe_ticks(void) {
 	struct timespec tv;
 
+	if (sim.on) return sim.ts;
+
 	clock_gettime(CLOCK_REALTIME, &tv);
 	return tv.tv_sec * aloe_ms2tick(aloe_10e3) +
 			aloe_ms2tick(tv.tv_nsec / aloe_10e3) / aloe_10e3;
@@ -94,6 +225,13 @@ void aloe_sem_post(aloe_sem_t *ctx, void *rt, const char *name) {
 
 	(void)rt;
 
+	if (sim.on) {
+		pthread_mutex_lock(&sim.lock);
+		if ((ctx->cnt < ctx->max) && ((++(ctx->cnt)) == 1)) sim_wake(ctx);
+		pthread_mutex_unlock(&sim.lock);
+		return;
+	}
+
 	mutex_lock(&ctx->mutex, aloe_dur_infinite);
 	if ((ctx->cnt < ctx->max) && ((++(ctx->cnt)) == 1)) {
 		if (broadcast) pthread_cond_broadcast(&ctx->not_empty);
@@ -102,11 +240,34 @@ void aloe_sem_post(aloe_sem_t *ctx, void *rt, const char *name) {
 	pthread_mutex_unlock(&ctx->mutex);
 }
 
+/** Wait on virtual clock, simulation lock instead of the mutex. */
+static int sim_sem_wait(aloe_sem_t *ctx, long dur_ms) {
+	unsigned long due_us = sim_dur_us(dur_ms);
+	int r = 0;
+
+	pthread_mutex_lock(&sim.lock);
+	if (due_us != (unsigned long)-1) due_us += sim.ts;
+	while (ctx->cnt == 0) {
+		if (due_us != (unsigned long)-1 && sim.ts >= due_us) {
+			r = ETIMEDOUT;
+			goto finally;
+		}
+		sim_block(ctx, due_us == (unsigned long)-1 ? due_us : due_us - sim.ts);
+	}
+	// pass on to the next one waiting
+	if (--ctx->cnt > 0) sim_wake(ctx);
+finally:
+	pthread_mutex_unlock(&sim.lock);
+	return r;
+}
+
 int aloe_sem_wait(aloe_sem_t *ctx, void *rt, long dur_ms, const char *name) {
 	int r;
 
 	(void)rt;
 
+	if (sim.on) return sim_sem_wait(ctx, dur_ms);
+
 	mutex_lock(&ctx->mutex, aloe_dur_infinite);
 	while (ctx->cnt == 0) {
 		if ((r = cond_wait(&ctx->not_empty, &ctx->mutex,
@@ -129,23 +290,191 @@ void aloe_sem_destroy(aloe_sem_t *ctx) {
 static void* thread_run(void *_ctx) {
 	aloe_thread_t *ctx = (aloe_thread_t*)_ctx;
 
+	if (ctx->sim) {
+		// wait for turn
+		sim_self = ctx->sim;
+		pthread_mutex_lock(&sim.lock);
+		while (sim.cur != sim_self) {
+			pthread_cond_wait(&sim_self->cond, &sim.lock);
+		}
+		pthread_mutex_unlock(&sim.lock);
+	}
+
 	(*ctx->run)(ctx);
+
+	if (sim_self) {
+		// hand over without wait
+		pthread_mutex_lock(&sim.lock);
+		pthread_cond_destroy(&sim_self->cond);
+		free(sim_self);
+		sim_self = NULL;
+		sim_switch();
+		pthread_mutex_unlock(&sim.lock);
+	}
 	return NULL;
 }
 
 int aloe_thread_run(aloe_thread_t *ctx, void(*run)(aloe_thread_t*),
 		size_t stack, int prio, const char *name) {
+	int r;
+
 #if defined(aloe_thread_name_size) && aloe_thread_name_size > 0
 	if (name != ctx->name) {
 		snstrcpy(ctx->name, aloe_thread_name_size, name);
 	}
 #endif
 	ctx->run = run;
-	return pthread_create(&ctx->thread, NULL, &thread_run, ctx);
+	ctx->sim = NULL;
+	if (!sim.on) return pthread_create(&ctx->thread, NULL, &thread_run, ctx);
+
+	// ready after the creator
+	if (!(ctx->sim = sim_thd_new())) return ENOMEM;
+	pthread_mutex_lock(&sim.lock);
+	TAILQ_INSERT_TAIL(&sim.ready_q, ctx->sim, qent);
+	pthread_mutex_unlock(&sim.lock);
+	if ((r = pthread_create(&ctx->thread, NULL, &thread_run, ctx)) != 0) {
+		pthread_mutex_lock(&sim.lock);
+		TAILQ_REMOVE(&sim.ready_q, ctx->sim, qent);
+		pthread_mutex_unlock(&sim.lock);
+		pthread_cond_destroy(&ctx->sim->cond);
+		free(ctx->sim);
+		ctx->sim = NULL;
+	}
+	return r;
 }
 
-void* aloe_mem_malloc(aloe_mem_id_t id, size_t sz,
-		const char *name __attribute__((unused))) {
+int aloe_mq_init(aloe_mq_t *ctx, int cnt, size_t item_sz, const char *name) {
+	int r;
+
+	(void)name;
+
+	if (!(ctx->buf = (char*)malloc(cnt * item_sz))) return ENOMEM;
+	if ((r = pthread_mutex_init(&ctx->mutex, NULL)) != 0) {
+		free(ctx->buf);
+		return r;
+	}
+	if ((r = pthread_cond_init(&ctx->not_empty, NULL)) != 0) {
+		pthread_mutex_destroy(&ctx->mutex);
+		free(ctx->buf);
+		return r;
+	}
+	if ((r = pthread_cond_init(&ctx->not_full, NULL)) != 0) {
+		pthread_cond_destroy(&ctx->not_empty);
+		pthread_mutex_destroy(&ctx->mutex);
+		free(ctx->buf);
+		return r;
+	}
+	ctx->item_sz = item_sz;
+	ctx->max = cnt;
+	ctx->cnt = ctx->rd = 0;
+	return 0;
+}
+
+/**
+ * Wait for the condition of the queue, mutex or simulation lock held.
+ *
+ * @param due_us Virtual due in simulation
+ */
+static int mq_wait(aloe_mq_t *ctx, pthread_cond_t *cond, long dur_ms,
+		unsigned long due_us) {
+	if (!sim.on) return cond_wait(cond, &ctx->mutex, aloe_msDur(dur_ms));
+	if (due_us != (unsigned long)-1 && sim.ts >= due_us) return ETIMEDOUT;
+	sim_block(cond, due_us == (unsigned long)-1 ? due_us : due_us - sim.ts);
+	return 0;
+}
+
+#define mq_lock(_ctx) pthread_mutex_lock(sim.on ? &sim.lock : &(_ctx)->mutex)
+#define mq_unlock(_ctx) pthread_mutex_unlock(sim.on ? &sim.lock : &(_ctx)->mutex)
+#define mq_signal(_ctx, _cond) do { \
+	if (sim.on) sim_wake(_cond); else pthread_cond_signal(_cond); \
+} while(0)
+
+int aloe_mq_send(aloe_mq_t *ctx, const void *item, void *rt, long dur_ms) {
+	unsigned long due_us = sim_dur_us(dur_ms);
+	int r;
+
+	(void)rt;
+
+	mq_lock(ctx);
+	if (due_us != (unsigned long)-1) due_us += sim.ts;
+	while (ctx->cnt >= ctx->max) {
+		if ((r = mq_wait(ctx, &ctx->not_full, dur_ms, due_us)) != 0) {
+			goto finally;
+		}
+	}
+	memcpy(ctx->buf + ((ctx->rd + ctx->cnt) % ctx->max) * ctx->item_sz,
+			item, ctx->item_sz);
+	if (ctx->cnt++ == 0) mq_signal(ctx, &ctx->not_empty);
+	r = 0;
+finally:
+	mq_unlock(ctx);
+	return r;
+}
+
+int aloe_mq_recv(aloe_mq_t *ctx, void *item, void *rt, long dur_ms) {
+	unsigned long due_us = sim_dur_us(dur_ms);
+	int r;
+
+	(void)rt;
+
+	mq_lock(ctx);
+	if (due_us != (unsigned long)-1) due_us += sim.ts;
+	while (ctx->cnt == 0) {
+		if ((r = mq_wait(ctx, &ctx->not_empty, dur_ms, due_us)) != 0) {
+			goto finally;
+		}
+	}
+	memcpy(item, ctx->buf + ctx->rd * ctx->item_sz, ctx->item_sz);
+	ctx->rd = (ctx->rd + 1) % ctx->max;
+	if (ctx->cnt-- == ctx->max) mq_signal(ctx, &ctx->not_full);
+	r = 0;
+finally:
+	mq_unlock(ctx);
+	return r;
+}
+
+void aloe_mq_destroy(aloe_mq_t *ctx) {
+	pthread_cond_destroy(&ctx->not_full);
+	pthread_cond_destroy(&ctx->not_empty);
+	pthread_mutex_destroy(&ctx->mutex);
+	free(ctx->buf);
+}
+
+/** Named interface, or the first up one not loopback, otherwise loopback. */
+int aloe_ifaddr_get(const char *ifname, aloe_ifaddr_t *ifaddr) {
+	struct ifaddrs *ifa_list, *ifa, *lo = NULL, *fit = NULL;
+
+	if (getifaddrs(&ifa_list) != 0) return -1;
+	for (ifa = ifa_list; ifa; ifa = ifa->ifa_next) {
+		if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != AF_INET
+				|| !(ifa->ifa_flags & IFF_UP)) {
+			continue;
+		}
+		if (ifname) {
+			if (strcmp(ifa->ifa_name, ifname) == 0) {
+				fit = ifa;
+				break;
+			}
+			continue;
+		}
+		if (!(ifa->ifa_flags & IFF_LOOPBACK)) {
+			fit = ifa;
+			break;
+		}
+		if (!lo) lo = ifa;
+	}
+	if (!fit) fit = lo;
+	if (fit) {
+		ifaddr->addr = ((struct sockaddr_in*)fit->ifa_addr)->sin_addr.s_addr;
+		ifaddr->netmask = fit->ifa_netmask ?
+				((struct sockaddr_in*)fit->ifa_netmask)->sin_addr.s_addr : 0;
+		ifaddr->gw = 0;
+	}
+	freeifaddrs(ifa_list);
+	return fit ? 0 : -1;
+}
+
+void* aloe_mem_malloc(aloe_mem_id_t id, size_t sz, const char *name) {
 	aloe_mem_t *mm = NULL;
 
 	switch (id) {
@@ -161,13 +490,14 @@ void* aloe_mem_malloc(aloe_mem_id_t id, size_t sz,
 		mm->sig = &aloe_mem_sig;
 		mm->id = id;
 		mm->sz = sz;
+		aloe_mem_acct_add(mm, name);
 		mm++;
 	}
 	return (void*)mm;
 }
 
 void* aloe_mem_calloc(aloe_mem_id_t id, size_t mb, size_t sz,
-		const char *name __attribute__((unused))) {
+		const char *name) {
 	aloe_mem_t *mm = NULL;
 
 	sz *= mb;
@@ -185,6 +515,7 @@ void* aloe_mem_calloc(aloe_mem_id_t id, size_t mb, size_t sz,
 		mm->sig = &aloe_mem_sig;
 		mm->id = id;
 		mm->sz = sz;
+		aloe_mem_acct_add(mm, name);
 		mm++;
 	}
 	return (void*)mm;
@@ -197,8 +528,10 @@ int aloe_mem_free(void *_mm) {
 
 	mm = (aloe_mem_t*)_mm - 1;
 	if (mm->sig != &aloe_mem_sig) return -1;
+	aloe_mem_acct_del(mm);
 	switch (mm->id) {
 	case aloe_mem_id_dxmem:
+	case aloe_mem_id_psram:
 	case aloe_mem_id_stdc:
 		free(mm);
 		return 0;
@@ -208,4 +541,22 @@ int aloe_mem_free(void *_mm) {
 	return -1;
 }
 
+size_t aloe_mem_avail(aloe_mem_id_t id) {
+	long pg, pg_sz;
+
+	switch (id) {
+	case aloe_mem_id_dxmem:
+	case aloe_mem_id_psram:
+	case aloe_mem_id_stdc:
+		if ((pg = sysconf(_SC_AVPHYS_PAGES)) <= 0
+				|| (pg_sz = sysconf(_SC_PAGESIZE)) <= 0) {
+			return 0;
+		}
+		return (size_t)pg * (size_t)pg_sz;
+	default:
+		break;
+	}
+	return 0;
+}
+
 #endif
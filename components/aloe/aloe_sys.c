@@ -13,4 +13,106 @@
 
 const aloe_mem_id_t aloe_mem_sig;
 
+#if ALOE_MEM_ACCT
+typedef struct {
+	const char *name;
+	size_t live, peak;
+
+	/* allocation, and at the last dump */
+	unsigned long cnt, cnt_dump;
+} aloe_mem_acct_t;
+
+static struct {
+	aloe_mem_acct_t ent[ALOE_MEM_ACCT_CNT];
+	unsigned long ts_dump;
+} aloe_mem_acct = {};
+
+static const char aloe_mem_acct_anon[] = "(null)";
+
+/** Open addressing by pointer hash, claim empty slot by CAS. */
+static int aloe_mem_acct_slot(const char *name) {
+	unsigned i, h, slot;
+	const char *nm;
+
+	if (!name) name = aloe_mem_acct_anon;
+	h = (unsigned)((unsigned long)name >> 2) * 2654435761u;
+	for (i = 0; i < ALOE_MEM_ACCT_CNT - 1; i++) {
+		slot = (h + i) % (ALOE_MEM_ACCT_CNT - 1);
+		nm = aloe_atomic_load(&aloe_mem_acct.ent[slot].name);
+		if (nm == name) return slot;
+		if (nm) continue;
+
+		// nm stay NULL when claimed, lost the race to the same name still match
+		while (!nm && !aloe_atomic_cas(&aloe_mem_acct.ent[slot].name, &nm,
+				name));
+		if (!nm || nm == name) return slot;
+	}
+	return ALOE_MEM_ACCT_CNT - 1;
+}
+
+void aloe_mem_acct_add(aloe_mem_t *mm, const char *name) {
+	aloe_mem_acct_t *ent;
+	size_t live, peak;
+
+	mm->acct = aloe_mem_acct_slot(name);
+	ent = &aloe_mem_acct.ent[mm->acct];
+	aloe_atomic_add(&ent->cnt, 1);
+	live = aloe_atomic_add(&ent->live, mm->sz);
+	peak = aloe_atomic_load(&ent->peak);
+	while (live > peak && !aloe_atomic_cas(&ent->peak, &peak, live));
+}
+
+void aloe_mem_acct_del(aloe_mem_t *mm) {
+	if (mm->acct < 0 || mm->acct >= ALOE_MEM_ACCT_CNT) return;
+	aloe_atomic_sub(&aloe_mem_acct.ent[mm->acct].live, mm->sz);
+}
+
+int aloe_mem_acct_dump(int reset) {
+	aloe_mem_acct_t *ent;
+	unsigned long ts = aloe_tick2ms(aloe_ticks()), dur, cnt;
+	size_t live_sum = 0, live, peak;
+	int i;
+
+	dur = ts - aloe_mem_acct.ts_dump;
+	if (dur == 0) dur = 1;
+	for (i = 0; i < ALOE_MEM_ACCT_CNT; i++) {
+		ent = &aloe_mem_acct.ent[i];
+		if (!(cnt = aloe_atomic_load(&ent->cnt))) continue;
+		live = aloe_atomic_load(&ent->live);
+		peak = aloe_atomic_load(&ent->peak);
+		aloe_log_d("mem %s live: %lu, peak: %lu, alloc: %lu, %lu/s\n",
+				i == ALOE_MEM_ACCT_CNT - 1 ? "(other)" :
+						aloe_atomic_load(&ent->name),
+				(unsigned long)live, (unsigned long)peak, cnt,
+				(cnt - ent->cnt_dump) * 1000ul / dur);
+		ent->cnt_dump = cnt;
+		live_sum += live;
+		if (reset) aloe_atomic_store(&ent->peak, live);
+	}
+	aloe_log_d("mem live: %lu\n", (unsigned long)live_sum);
+	aloe_mem_acct.ts_dump = ts;
+	return 0;
+}
+#endif
+
+aloe_pool_t* aloe_pool_create(aloe_mem_id_t id, unsigned obj_sz, unsigned cnt,
+		unsigned align, const char *name) {
+	aloe_pool_t *pool;
+
+	if (cnt < 1 || cnt > aloe_pool_cnt_max) return NULL;
+	if (!(pool = (aloe_pool_t*)aloe_mem_malloc(id,
+			sizeof(*pool) + aloe_pool_size(obj_sz, cnt, align), name))) {
+		return NULL;
+	}
+	if (aloe_pool_init(pool, pool + 1, obj_sz, cnt, align) != 0) {
+		aloe_mem_free(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+void aloe_pool_destroy(aloe_pool_t *pool) {
+	if (pool) aloe_mem_free(pool);
+}
+
 
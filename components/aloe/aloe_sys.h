@@ -78,10 +78,28 @@ typedef struct aloe_thread_rec aloe_thread_t;
 int aloe_thread_run(aloe_thread_t*, void(*)(aloe_thread_t*), size_t stack,
 		int prio, const char *name);
 
+/** Message queue of fixed size item, item copied in and out. */
+typedef struct aloe_mq_rec aloe_mq_t;
+int aloe_mq_init(aloe_mq_t*, int cnt, size_t item_sz, const char *name);
+
+/**
+ * Send item to queue tail.
+ *
+ * @param rt Not NULL when caller from ISR, ie. pointer to BaseType_t
+ * @param dur Milliseconds waiting room, aloe_dur_infinite to wait forever
+ * @return 0 when successful
+ */
+int aloe_mq_send(aloe_mq_t*, const void *item, void *rt, long dur);
+
+/** Receive item from queue head, return 0 when successful. */
+int aloe_mq_recv(aloe_mq_t*, void *item, void *rt, long dur);
+void aloe_mq_destroy(aloe_mq_t*);
+
 // void aloe_thread_sleep(_ms);
 
 // unsigned long aloe_ticks(void);
 // unsigned long aloe_tick2ms(_ts);
+// unsigned long aloe_tick2us(_ts);
 // unsigned long aloe_ms2tick(_ms);
 
 typedef enum aloe_mem_id_enum {
@@ -91,19 +109,85 @@ typedef enum aloe_mem_id_enum {
 	aloe_mem_id_sig
 } aloe_mem_id_t;
 
+/**
+ * Per name accounting of aloe_mem_malloc(), keyed by the name pointer.  Off by
+ * default, 2 atomic on every allocation, opt-in by -DALOE_MEM_ACCT=1.
+ */
+#ifndef ALOE_MEM_ACCT
+#  define ALOE_MEM_ACCT 0
+#endif
+
+/** Accounting table, the last slot take name not fit. */
+#ifndef ALOE_MEM_ACCT_CNT
+#  define ALOE_MEM_ACCT_CNT 32
+#endif
+
 // __attribute__((packed)) cause crash on ameba
 typedef struct /* __attribute__((packed)) */ aloe_mem_rec {
 	const aloe_mem_id_t *sig;
 	aloe_mem_id_t id;
 	size_t sz;
+#if ALOE_MEM_ACCT
+	/* accounting slot */
+	int acct;
+#endif
 } aloe_mem_t;
 
 extern const aloe_mem_id_t aloe_mem_sig;
 
+/** IPv4 of network interface in network byte order. */
+typedef struct aloe_ifaddr_rec {
+	uint32_t addr, netmask, gw;
+} aloe_ifaddr_t;
+
+/**
+ * Query IPv4 of network interface.
+ *
+ * @param ifname NULL for default interface
+ * @return 0 when successful, -1 when interface not found
+ */
+int aloe_ifaddr_get(const char *ifname, aloe_ifaddr_t*);
+
+/**
+ * Allocate from the region.
+ *
+ * @param name Static lifetime string, ie. literal, accounting keyed by the
+ *   pointer and keep it after free
+ */
 void* aloe_mem_malloc(aloe_mem_id_t, size_t, const char *name);
 void* aloe_mem_calloc(aloe_mem_id_t, size_t, size_t, const char *name);
 int aloe_mem_free(void*);
 
+/**
+ * Object pool in the memory region, pool and objects in one allocation.
+ *
+ * @param align Object alignment, power of 2
+ */
+aloe_pool_t* aloe_pool_create(aloe_mem_id_t, unsigned obj_sz, unsigned cnt,
+		unsigned align, const char *name);
+void aloe_pool_destroy(aloe_pool_t*);
+
+#if ALOE_MEM_ACCT
+/** Port call after the header filled, and before release, lock-free. */
+void aloe_mem_acct_add(aloe_mem_t*, const char *name);
+void aloe_mem_acct_del(aloe_mem_t*);
+
+/**
+ * Log live bytes, peak bytes and allocation per second since the last dump,
+ * for each name.
+ *
+ * @param reset Restart peak from live
+ */
+int aloe_mem_acct_dump(int reset);
+#else
+#  define aloe_mem_acct_add(_mm, _nm) do { (void)(_nm); } while(0)
+#  define aloe_mem_acct_del(_mm) do { } while(0)
+#  define aloe_mem_acct_dump(_reset) (-1)
+#endif
+
+/** Largest allocation likely succeed from the region, 0 when not known. */
+size_t aloe_mem_avail(aloe_mem_id_t);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -55,6 +55,9 @@ struct aloe_thread_rec  {
 //unsigned long aloe_tick2ms(_ts);
 #define aloe_tick2ms(_ts) ((_ts) * portTICK_PERIOD_MS)
 
+//unsigned long aloe_tick2us(_ts);
+#define aloe_tick2us(_ts) ((_ts) * portTICK_PERIOD_MS * 1000ul)
+
 //unsigned long aloe_ms2tick(_ms);
 #define aloe_ms2tick(_ms) ((_ms) / portTICK_PERIOD_MS)
 
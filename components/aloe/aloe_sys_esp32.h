@@ -21,6 +21,7 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/semphr.h>
+#include <freertos/queue.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -39,6 +40,10 @@ struct aloe_sem_rec {
 #endif
 };
 
+struct aloe_mq_rec {
+	QueueHandle_t mq;
+};
+
 #define aloe_thread_name_size 10
 struct aloe_thread_rec  {
 	TaskHandle_t thread;
@@ -56,6 +61,9 @@ struct aloe_thread_rec  {
 //unsigned long aloe_tick2ms(_ts);
 #define aloe_tick2ms(_ts) ((_ts) * portTICK_PERIOD_MS)
 
+//unsigned long aloe_tick2us(_ts);
+#define aloe_tick2us(_ts) ((_ts) * portTICK_PERIOD_MS * 1000ul)
+
 //unsigned long aloe_ms2tick(_ms);
 #define aloe_ms2tick(_ms) ((_ms) / portTICK_PERIOD_MS)
 
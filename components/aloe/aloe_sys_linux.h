@@ -37,6 +37,7 @@ extern "C" {
 
 unsigned long aloe_ticks(void);
 #define aloe_tick2ms(_ts) ((_ts) / aloe_10e3)
+#define aloe_tick2us(_ts) (_ts)
 #define aloe_ms2tick(_ms) ((_ms) * aloe_10e3)
 
 #define aloe_sem_name_size 20
@@ -49,16 +50,41 @@ struct aloe_sem_rec {
 	pthread_cond_t not_empty;
 };
 
+struct aloe_mq_rec {
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty, not_full;
+	char *buf;
+	size_t item_sz;
+	int max, cnt, rd;
+};
+
 #define aloe_thread_name_size 20
 struct aloe_thread_rec {
 	pthread_t thread;
 	void (*run)(struct aloe_thread_rec*);
+
+	/* scheduling in simulation */
+	struct sim_thd_rec *sim;
 #if aloe_thread_name_size
 	char name[aloe_thread_name_size];
 #endif
 };
 
-#define aloe_thread_sleep(_ms) usleep(_ms * 1000)
+void aloe_thread_usleep(unsigned long us);
+#define aloe_thread_sleep(_ms) aloe_thread_usleep((_ms) * 1000ul)
+
+/**
+ * Virtual time simulation, call from main thread before start aloe thread.
+ *
+ * aloe thread run one at a time in deterministic order.  aloe_ticks(),
+ * aloe_thread_sleep(), semaphore and message queue wait on virtual clock,
+ * the clock jump to the nearest due when every thread blocked.  Thread must
+ * not block outside aloe.
+ */
+int aloe_sim_start(void);
+
+/** Nonzero when simulation started. */
+int aloe_sim_on(void);
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -137,19 +137,30 @@ aloe_rb_entry_t* aloe_rb_find(aloe_rb_tree_t *rb, const void *key,
 	return RB_FIND(aloe_rb_tree_rec, rb, &ent0);
 }
 
-size_t aloe_log_vfmsg_def(char *buf, size_t buf_sz, int lvl, const char *tag, long lno,
-		const char *fmt, va_list va) {
+size_t aloe_log_prefix(char *buf, size_t buf_sz, unsigned long ms, int lvl,
+		const char *tag, long lno) {
 	int r;
-	size_t sz = 0;
-	unsigned long ms = aloe_tick2ms(aloe_ticks());
 
-	if ((r = snprintf(buf + sz, buf_sz - sz,
+	if ((r = snprintf(buf, buf_sz,
 			"[%02lu:%02lu.%03lu]"
 			"[%s]"
 			"[%s][#%d] ",
 			((ms) % 3600000) / 60000, ((ms) % 60000) / 1000, (ms) % 1000,
 			aloe_log_level_str2(lvl, "", ""),
-			tag, (int)lno)) <= 0 || (sz += r) >= buf_sz) {
+			tag, (int)lno)) <= 0) {
+		return 0;
+	}
+	if ((size_t)r >= buf_sz) return aloe_strabbr(buf, buf_sz, NULL);
+	return r;
+}
+
+size_t aloe_log_vfmsg_def(char *buf, size_t buf_sz, int lvl, const char *tag, long lno,
+		const char *fmt, va_list va) {
+	int r;
+	size_t sz = 0;
+
+	if ((sz = aloe_log_prefix(buf, buf_sz, aloe_tick2ms(aloe_ticks()), lvl,
+			tag, lno)) <= 0 || sz >= buf_sz - 1) {
 		goto finally;
 	}
 	r = vsnprintf(buf + sz, buf_sz - sz, fmt, va);
@@ -298,3 +309,209 @@ int aloe_rinfb_init(aloe_rinfb_t *rinfb, void *buf, int rinfb_unit,
 	}
     return 0;
 }
+
+void aloe_mpsc_init(aloe_mpsc_t *mpsc, void *buf, unsigned data_sz,
+		unsigned cnt) {
+	unsigned i;
+
+	mpsc->wr = mpsc->rd = 0;
+	mpsc->m = cnt - 1;
+	mpsc->slot_sz = aloe_mpsc_slot_sz(data_sz);
+	mpsc->slot = (char*)buf;
+	for (i = 0; i < cnt; i++) *aloe_mpsc_seq(mpsc, i) = i;
+}
+
+#define aloe_pool_tag1 0x100000000ull
+#define aloe_pool_tag_mask 0xffffffff00000000ull
+
+ALOE_SYS_TEXT1_SECTION
+int aloe_pool_init(aloe_pool_t *pool, void *buf, unsigned obj_sz,
+		unsigned cnt, unsigned align) {
+	unsigned i;
+
+	if (cnt < 1 || cnt > aloe_pool_cnt_max || obj_sz < 1 || align < 1
+			|| (align & (align - 1))) {
+		return -1;
+	}
+	pool->next = (uint16_t*)buf;
+	pool->base = (char*)aloe_roundup((unsigned long)(pool->next + cnt),
+			(unsigned long)align);
+	pool->obj_sz = aloe_roundup(obj_sz, align);
+	pool->cnt = cnt;
+	pool->used = pool->used_max = 0;
+
+	// ascending, the first get take the lowest address
+	for (i = 0; i < cnt; i++) pool->next[i] = (uint16_t)(i + 1 < cnt ? i + 2 : 0);
+	pool->head = 1;
+	return 0;
+}
+
+ALOE_SYS_TEXT1_SECTION
+void* aloe_pool_get(aloe_pool_t *pool) {
+	uint64_t head, nx;
+	unsigned idx, used, mx;
+
+	head = aloe_atomic_load(&pool->head);
+	do {
+		if (!(idx = (unsigned)head)) return NULL;
+
+		// stale next when lost the race, cas fail by the tag
+		nx = ((head + aloe_pool_tag1) & aloe_pool_tag_mask)
+				| __atomic_load_n(&pool->next[idx - 1], __ATOMIC_RELAXED);
+	} while (!aloe_atomic_cas(&pool->head, &head, nx));
+
+	used = aloe_atomic_add(&pool->used, 1);
+	mx = aloe_atomic_load(&pool->used_max);
+	while (used > mx && !aloe_atomic_cas(&pool->used_max, &mx, used));
+	return aloe_pool_obj(pool, idx - 1);
+}
+
+ALOE_SYS_TEXT1_SECTION
+int aloe_pool_put(aloe_pool_t *pool, void *obj) {
+	uint64_t head, nx;
+	size_t ofs;
+	unsigned idx;
+
+	ofs = (char*)obj - pool->base;
+	if ((char*)obj < pool->base || ofs % pool->obj_sz
+			|| (idx = ofs / pool->obj_sz) >= pool->cnt) {
+		return -1;
+	}
+
+	head = aloe_atomic_load(&pool->head);
+	do {
+		__atomic_store_n(&pool->next[idx], (uint16_t)head, __ATOMIC_RELAXED);
+		nx = ((head + aloe_pool_tag1) & aloe_pool_tag_mask) | (idx + 1);
+	} while (!aloe_atomic_cas(&pool->head, &head, nx));
+	aloe_atomic_sub(&pool->used, 1);
+	return 0;
+}
+
+#define aloe_tmwheel_occ_set(_tmw, _i) \
+		((_tmw)->occ[(_i) / 32] |= 1u << ((_i) % 32))
+#define aloe_tmwheel_occ_clr(_tmw, _i) \
+		((_tmw)->occ[(_i) / 32] &= ~(1u << ((_i) % 32)))
+
+/** Signed difference, the counter may wrap. */
+#define aloe_tmwheel_diff(_a, _b) ((long)((_a) - (_b)))
+
+ALOE_SYS_TEXT1_SECTION
+int aloe_tmwheel_init(aloe_tmwheel_t *tmw, aloe_tmr_list_t *slot,
+		unsigned slot_cnt, unsigned long res, unsigned long ts) {
+	unsigned i;
+
+	if (slot_cnt <= 0 || (slot_cnt & (slot_cnt - 1))
+			|| slot_cnt > aloe_tmwheel_slot_max || res <= 0) {
+		aloe_log_e("Sanity check invalid timer wheel %d x %d\n",
+				(int)slot_cnt, (int)res);
+		return -1;
+	}
+	tmw->res = res;
+	tmw->ts = ts - (ts % res);
+	tmw->cur = 0;
+	tmw->slot_cnt = slot_cnt;
+	tmw->cnt = 0;
+	tmw->slot = slot;
+	for (i = 0; i < slot_cnt; i++) TAILQ_INIT(&slot[i]);
+	memset(tmw->occ, 0, sizeof(tmw->occ));
+	return 0;
+}
+
+ALOE_SYS_TEXT1_SECTION
+void aloe_tmwheel_cancel(aloe_tmwheel_t *tmw, aloe_tmr_t *tmr) {
+	if (!tmr->armed) return;
+	TAILQ_REMOVE(&tmw->slot[tmr->slot], tmr, qent);
+	if (TAILQ_EMPTY(&tmw->slot[tmr->slot])) aloe_tmwheel_occ_clr(tmw, tmr->slot);
+	tmr->armed = 0;
+	tmw->cnt--;
+}
+
+ALOE_SYS_TEXT1_SECTION
+void aloe_tmwheel_arm(aloe_tmwheel_t *tmw, aloe_tmr_t *tmr,
+		unsigned long tdue) {
+	long d;
+
+	aloe_tmwheel_cancel(tmw, tmr);
+
+	// past due hashed to the cursor slot
+	if ((d = aloe_tmwheel_diff(tdue, tmw->ts)) < 0) {
+		tdue = tmw->ts;
+		d = 0;
+	}
+	tmr->tdue = tdue;
+	tmr->slot = (tmw->cur + (unsigned long)d / tmw->res) & (tmw->slot_cnt - 1);
+	TAILQ_INSERT_TAIL(&tmw->slot[tmr->slot], tmr, qent);
+	aloe_tmwheel_occ_set(tmw, tmr->slot);
+	tmr->armed = 1;
+	tmw->cnt++;
+}
+
+ALOE_SYS_TEXT1_SECTION
+aloe_tmr_t* aloe_tmwheel_expire(aloe_tmwheel_t *tmw, unsigned long now) {
+	aloe_tmr_t *tmr;
+	unsigned long n;
+
+	while (tmw->cnt > 0) {
+		TAILQ_FOREACH(tmr, &tmw->slot[tmw->cur], qent) {
+			if (aloe_tmwheel_diff(tmr->tdue, now) <= 0) {
+				aloe_tmwheel_cancel(tmw, tmr);
+				return tmr;
+			}
+		}
+
+		// cursor slot still ongoing
+		if (aloe_tmwheel_diff(now, tmw->ts) < (long)tmw->res) return NULL;
+		tmw->ts += tmw->res;
+		tmw->cur = (tmw->cur + 1) & (tmw->slot_cnt - 1);
+	}
+
+	// nothing armed, catch up
+	if (aloe_tmwheel_diff(now, tmw->ts) >= (long)tmw->res) {
+		n = (now - tmw->ts) / tmw->res;
+		tmw->ts += n * tmw->res;
+		tmw->cur = (tmw->cur + n) & (tmw->slot_cnt - 1);
+	}
+	return NULL;
+}
+
+ALOE_SYS_TEXT1_SECTION
+unsigned long aloe_tmwheel_next(aloe_tmwheel_t *tmw) {
+	aloe_tmr_t *tmr;
+	unsigned long ts, tdue;
+	unsigned i, k, w;
+	uint32_t occ;
+	int found;
+
+	if (tmw->cnt <= 0) return aloe_dur_infinite;
+
+	// k slot from the cursor, the rest of the bitmap word at a time
+	for (k = 0; k < tmw->slot_cnt; k += w) {
+		i = (tmw->cur + k) & (tmw->slot_cnt - 1);
+		occ = tmw->occ[i / 32] >> (i % 32);
+		w = aloe_min(32 - i % 32, tmw->slot_cnt - i);
+		w = aloe_min(w, tmw->slot_cnt - k);
+		if (w < 32) occ &= (1u << w) - 1;
+		if (!occ) continue;
+
+		// nearest non-empty in the word
+		w = __builtin_ctz(occ);
+		k += w;
+		i = (tmw->cur + k) & (tmw->slot_cnt - 1);
+		ts = tmw->ts + k * tmw->res;
+		found = 0;
+		tdue = 0;
+		TAILQ_FOREACH(tmr, &tmw->slot[i], qent) {
+			// skip timer for later round
+			if (aloe_tmwheel_diff(tmr->tdue, ts + tmw->res) >= 0) continue;
+			if (!found || aloe_tmwheel_diff(tmr->tdue, tdue) < 0) {
+				tdue = tmr->tdue;
+				found = 1;
+			}
+		}
+		if (found) return tdue;
+		w = 1;
+	}
+
+	// all beyond one revolution
+	return tmw->ts + tmw->slot_cnt * tmw->res;
+}
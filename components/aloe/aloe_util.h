@@ -228,6 +228,10 @@ void aloe_log_add_def(int lvl, const char *tag, long lno, const char*,
 		...);
 void aloe_log_add(int lvl, const char *tag, long lno, const char*, ...);
 
+/** Message prefix of time, level, tag and line number, ie. deferred log. */
+size_t aloe_log_prefix(char *buf, size_t buf_sz, unsigned long ms, int lvl,
+		const char *tag, long lno);
+
 /** Patch the abbreviate string to the end of buffer.
  *
  * Useful for logger.
@@ -279,6 +283,209 @@ int aloe_rinfb_init(aloe_rinfb_t *rinfb, void *buf, int rinfb_unit, int rinfb_cn
 #define aloe_rinfb_wr_idx(_rinfb) ((_rinfb)->wr_cnt % (_rinfb)->fb_cnt)
 #define aloe_rinfb_rd_idx(_rinfb) ((_rinfb)->rd_cnt % (_rinfb)->fb_cnt)
 
+/** Memory order for lock-free structure. */
+#define aloe_atomic_load(_p) __atomic_load_n(_p, __ATOMIC_ACQUIRE)
+#define aloe_atomic_store(_p, _v) __atomic_store_n(_p, _v, __ATOMIC_RELEASE)
+#define aloe_atomic_xchg(_p, _v) __atomic_exchange_n(_p, _v, __ATOMIC_SEQ_CST)
+#define aloe_atomic_fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define aloe_atomic_add(_p, _v) __atomic_add_fetch(_p, _v, __ATOMIC_RELAXED)
+#define aloe_atomic_sub(_p, _v) __atomic_sub_fetch(_p, _v, __ATOMIC_RELAXED)
+
+/** Weak compare and swap, *_exp updated when failed. */
+#define aloe_atomic_cas(_p, _exp, _v) __atomic_compare_exchange_n(_p, _exp, \
+		_v, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+/** Single producer single consumer pointer ring, lock-free and ISR safe.
+ *
+ * Entry count must be power of 2.  Slot reusable once popped, the pointed
+ * record return to producer by another ring, ie. sinsvc2 latency trace.
+ */
+typedef struct {
+	unsigned wr, rd, m;
+	void **ent;
+} aloe_spsc_t;
+
+#define aloe_spsc_init(_spsc, _ent, _cnt) do { \
+	(_spsc)->wr = (_spsc)->rd = 0; \
+	(_spsc)->m = (_cnt) - 1; \
+	(_spsc)->ent = (void**)(_ent); \
+} while(0)
+
+/** Producer only. */
+static inline int aloe_spsc_push(aloe_spsc_t *spsc, void *v) {
+	unsigned wr = spsc->wr;
+
+	if (wr - aloe_atomic_load(&spsc->rd) > spsc->m) return -1;
+	spsc->ent[wr & spsc->m] = v;
+	aloe_atomic_store(&spsc->wr, wr + 1);
+	return 0;
+}
+
+/** Consumer only, NULL when empty. */
+static inline void* aloe_spsc_pop(aloe_spsc_t *spsc) {
+	unsigned rd = spsc->rd;
+	void *v;
+
+	if (aloe_atomic_load(&spsc->wr) == rd) return NULL;
+	v = spsc->ent[rd & spsc->m];
+	aloe_atomic_store(&spsc->rd, rd + 1);
+	return v;
+}
+
+/** Multi producer single consumer ring of fixed size slot, lock-free.
+ *
+ * Producer reserve the slot in turn, fill in place then commit, fail instead
+ * of wait when full.  Consumer take slot in reserve order, the slot reserved
+ * but not yet committed hold back the rest.  Slot count must be power of 2.
+ */
+typedef struct {
+	unsigned wr, rd, m, slot_sz;
+	char *slot;
+} aloe_mpsc_t;
+
+/* Slot begin with the sequence, data aligned after. */
+#define aloe_mpsc_hdr_sz sizeof(long long)
+#define aloe_mpsc_slot_sz(_data_sz) (aloe_mpsc_hdr_sz \
+		+ aloe_roundup((size_t)(_data_sz), aloe_mpsc_hdr_sz))
+
+/** Buffer size for aloe_mpsc_init(). */
+#define aloe_mpsc_size(_data_sz, _cnt) (aloe_mpsc_slot_sz(_data_sz) * (_cnt))
+
+#define aloe_mpsc_seq(_mpsc, _pos) ((unsigned*)((_mpsc)->slot \
+		+ (size_t)(_mpsc)->slot_sz * ((_pos) & (_mpsc)->m)))
+
+void aloe_mpsc_init(aloe_mpsc_t *mpsc, void *buf, unsigned data_sz,
+		unsigned cnt);
+
+/** Producer, NULL when full, aloe_mpsc_commit() the slot after fill. */
+static inline void* aloe_mpsc_reserve(aloe_mpsc_t *mpsc) {
+	unsigned pos = aloe_atomic_load(&mpsc->wr), *seq;
+	int dif;
+
+	for (;;) {
+		seq = aloe_mpsc_seq(mpsc, pos);
+		if ((dif = (int)(aloe_atomic_load(seq) - pos)) == 0) {
+			if (aloe_atomic_cas(&mpsc->wr, &pos, pos + 1)) break;
+		} else if (dif < 0) {
+			return NULL;
+		} else {
+			// other producer took the slot
+			pos = aloe_atomic_load(&mpsc->wr);
+		}
+	}
+	return (char*)seq + aloe_mpsc_hdr_sz;
+}
+
+/** Producer, hand the reserved slot to consumer. */
+static inline void aloe_mpsc_commit(aloe_mpsc_t *mpsc, void *data) {
+	unsigned *seq = (unsigned*)((char*)data - aloe_mpsc_hdr_sz);
+
+	(void)mpsc;
+	aloe_atomic_store(seq, *seq + 1);
+}
+
+/** Consumer only, NULL when empty or the head not yet committed. */
+static inline void* aloe_mpsc_peek(aloe_mpsc_t *mpsc) {
+	unsigned *seq = aloe_mpsc_seq(mpsc, mpsc->rd);
+
+	if (aloe_atomic_load(seq) != mpsc->rd + 1) return NULL;
+	return (char*)seq + aloe_mpsc_hdr_sz;
+}
+
+/** Consumer only, hand the head back to producer. */
+static inline void aloe_mpsc_release(aloe_mpsc_t *mpsc) {
+	unsigned rd = mpsc->rd;
+
+	aloe_atomic_store(aloe_mpsc_seq(mpsc, rd), rd + mpsc->m + 1);
+	mpsc->rd = rd + 1;
+}
+
+/** Fixed size object pool, lock-free and ISR safe, O(1) get and put.
+ *
+ * Free list of object index, head tagged against ABA.  Object count up to
+ * aloe_pool_cnt_max.  32 bits target without 8 bytes CAS instruction, ie.
+ * ESP32, take the libatomic one in critical section.
+ */
+typedef struct {
+	/* free head index + 1 in low 32 bits, tag in high 32 bits */
+	uint64_t head;
+
+	/* next free index + 1 of each object, 0 end of list */
+	uint16_t *next;
+
+	char *base;
+	unsigned obj_sz, cnt;
+
+	/* in use, and high-water mark */
+	unsigned used, used_max;
+} aloe_pool_t;
+
+#define aloe_pool_cnt_max 0xffff
+
+/** Buffer size for aloe_pool_init(), align power of 2. */
+#define aloe_pool_size(_obj_sz, _cnt, _align) ( \
+		sizeof(uint16_t) * (_cnt) + (_align) \
+		+ aloe_roundup((size_t)(_obj_sz), (_align)) * (_cnt))
+
+/** Carve the buffer, object size round up to align. */
+int aloe_pool_init(aloe_pool_t *pool, void *buf, unsigned obj_sz,
+		unsigned cnt, unsigned align);
+
+/** NULL when empty. */
+void* aloe_pool_get(aloe_pool_t *pool);
+
+/** -1 when the object not from the pool. */
+int aloe_pool_put(aloe_pool_t *pool, void *obj);
+
+/** Walk object by index, ie. to initialize. */
+#define aloe_pool_obj(_pool, _idx) \
+		((void*)((_pool)->base + (size_t)(_pool)->obj_sz * (_idx)))
+
+/** Timer entry to hashed timer wheel. */
+typedef struct aloe_tmr_rec {
+	unsigned long tdue; /**< Due time in millisecond. */
+	unsigned armed: 1;
+	unsigned slot; /**< Hashed slot while armed. */
+	TAILQ_ENTRY(aloe_tmr_rec) qent;
+} aloe_tmr_t;
+
+typedef TAILQ_HEAD(aloe_tmr_list_rec, aloe_tmr_rec) aloe_tmr_list_t;
+
+#define aloe_tmwheel_slot_max 256
+
+/** Hashed timer wheel.
+ *
+ * Timer hashed to slot by due time from the cursor, arm and cancel are O(1)
+ * list operation.  Timer due beyond one revolution stay in the slot for
+ * later round.  Time compared in signed difference, survive the millisecond
+ * counter wrap.
+ */
+typedef struct {
+	unsigned long res; /**< Millisecond per slot. */
+	unsigned long ts; /**< Start time of the cursor slot. */
+	unsigned cur; /**< Cursor slot. */
+	unsigned slot_cnt; /**< Must be power of 2, up to aloe_tmwheel_slot_max. */
+	int cnt; /**< Armed timer count. */
+	aloe_tmr_list_t *slot;
+
+	/** Non-empty slot bitmap, aloe_tmwheel_next() skip empty in word. */
+	uint32_t occ[aloe_tmwheel_slot_max / 32];
+} aloe_tmwheel_t;
+
+int aloe_tmwheel_init(aloe_tmwheel_t *tmw, aloe_tmr_list_t *slot,
+		unsigned slot_cnt, unsigned long res, unsigned long ts);
+
+/** Arm or re-arm the timer. */
+void aloe_tmwheel_arm(aloe_tmwheel_t *tmw, aloe_tmr_t *tmr, unsigned long tdue);
+
+void aloe_tmwheel_cancel(aloe_tmwheel_t *tmw, aloe_tmr_t *tmr);
+
+/** Pop one timer due before now, NULL when none. */
+aloe_tmr_t* aloe_tmwheel_expire(aloe_tmwheel_t *tmw, unsigned long now);
+
+/** Earliest due time from the nearest non-empty slot, aloe_dur_infinite when none. */
+unsigned long aloe_tmwheel_next(aloe_tmwheel_t *tmw);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
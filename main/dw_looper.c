@@ -12,8 +12,8 @@
 #include "dw_looper.h"
 #include "dw_util.h"
 
-#define log_d(_fmt...) dw_log_m("[Debug]", _fmt)
-#define log_e(_fmt...) dw_log_m("[ERROR]", _fmt)
+#define log_d(...) aloe_log_d(__VA_ARGS__)
+#define log_e(...) aloe_log_e(__VA_ARGS__)
 
 dw_looper_t *dw_looper_main = NULL;
 
@@ -23,7 +23,8 @@ void* dw_looper_init(dw_looper_t *looper, int cnt) {
 //		log_e("Failed alloc looper lock\n");
 //		return NULL;
 //	}
-	if (!(looper->mq = xQueueCreate(cnt, sizeof(dw_looper_msg_t*)))) {
+	if (aloe_mq_init(&looper->mq, cnt, sizeof(dw_looper_msg_t*),
+			"looper") != 0) {
 		log_e("Failed alloc looper mq\n");
 //		aloe_sem_destroy(&looper->lock);
 		return NULL;
@@ -38,23 +39,16 @@ void* dw_looper_init(dw_looper_t *looper, int cnt) {
 ALOE_SYS_TEXT1_SECTION
 int dw_looper_add(dw_looper_t *looper, dw_looper_msg_t *msg, long dur,
 		void *rt) {
-	BaseType_t eno;
-
 	if (!looper || !looper->ready) return -1;
-	if (rt) {
-		eno = xQueueSendFromISR(looper->mq, &msg, (BaseType_t*)rt);
-	} else {
-		eno = xQueueSend(looper->mq, &msg, aloe_msDur(dur));
-	}
-	return eno == pdTRUE ? 0 : -1;
+	return aloe_mq_send(&looper->mq, &msg, rt, dur) == 0 ? 0 : -1;
 }
 
 ALOE_SYS_TEXT1_SECTION
 dw_looper_msg_t* dw_looper_once(dw_looper_t *looper, long dur) {
 	dw_looper_msg_t *msg = NULL;
 
-	if (looper && looper->ready && xQueueReceive(looper->mq, &msg,
-			aloe_msDur(dur)) == pdPASS) {
+	if (looper && looper->ready && aloe_mq_recv(&looper->mq, &msg, NULL,
+			dur) == 0) {
 		return msg;
 	}
 	return NULL;
@@ -21,7 +21,7 @@ extern "C" {
 typedef struct dw_looper_rec {
 	unsigned quit: 1;
 	unsigned ready: 1;
-	QueueHandle_t mq;
+	aloe_mq_t mq;
 //	aloe_sem_t lock;
 } dw_looper_t;
 
@@ -36,7 +36,7 @@ typedef struct dw_looper_msg_rec {
 
 /** Add message to looper.
  *
- * @param rt A pointor to BaseType_t when caller from ISR @ref to xQueueSendFromISR
+ * @param rt A pointor to BaseType_t when caller from ISR @ref to aloe_mq_send
  */
 int dw_looper_add(dw_looper_t*, dw_looper_msg_t*, long dur, void *rt);
 
@@ -14,16 +14,122 @@
 
 #include <aloe_sys.h>
 
-#include <lwip/sockets.h>
+#if defined(ALOE_SYS_LINUX)
+#  include <netinet/in.h>
+#else
+#  include <lwip/sockets.h>
+#endif
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-int dw_sinsvc2_init(void);
+/**
+ * Buffer geometry of sinsvc2, field 0 take the default.  Sizes round up to
+ * 32 bytes.
+ */
+typedef struct {
+	/* max clients */
+	int cln_cnt;
+
+	/* frame buffer, longer frame continue in the next */
+	unsigned frm_sz;
+
+	/*
+	 * Frame buffer budget, split to quota and shared region those left 0,
+	 * shared take one client share.
+	 */
+	unsigned frm_cnt;
+
+	/* frame buffer guaranteed each client, and the shared overflow region */
+	unsigned frm_quota, frm_shared;
+
+	/* socket receive buffer per client */
+	unsigned recv_sz;
+
+	/* credit advertise pending per client, at least one advertise */
+	unsigned resp_sz;
+
+	/* outward segment, dw_sinsvc2_send() payload fit in one */
+	unsigned seg_sz, seg_cnt;
+
+	/*
+	 * Derive frm_quota and frm_shared left 0 from the largest free block,
+	 * take 1 / autosz of it after the fixed part.
+	 */
+	unsigned autosz;
+} dw_sinsvc2_cfg_t;
+
+/**
+ * Start sinsvc2.
+ *
+ * @param cfg NULL for default
+ * @return -1 when geometry out of range or not enough memory
+ */
+int dw_sinsvc2_init(const dw_sinsvc2_cfg_t *cfg);
+
+/**
+ * Queue data to every client, raw bytes as before unless the client sent
+ * the credit control frame, then one dw_pkt2_t with s and e.
+ */
 int dw_sinsvc2_send(const void *data, size_t size);
 int dw_svcaddr(char *addr, size_t len, struct in_addr *sin_addr);
 
+/** Trace of received dw_pkt2 frame, begin with dw_sinsvc2_trace_t. */
+#define DW_SINSVC2_TRACE_MAGIC 0x63727464
+#define DW_SINSVC2_TRACE_VER 1
+
+typedef struct __attribute__((packed)) {
+	uint32_t magic;
+	uint16_t ver;
+
+	/* sizeof(dw_sinsvc2_trace_t), skip to the first record */
+	uint16_t hdr_len;
+} dw_sinsvc2_trace_t;
+
+/** Record followed by len bytes payload, no padding. */
+typedef struct __attribute__((packed)) {
+	/* arrival in microsecond since previous record */
+	uint32_t ts;
+
+	/* client index */
+	uint16_t cln;
+	uint16_t rsv;
+
+	/* dw_pkt2 header */
+	uint32_t tag;
+	uint32_t len;
+} dw_sinsvc2_trace_rec_t;
+
+/**
+ * Record every received frame to the writer, from sinsvc2 task.  The writer
+ * take the trace in order, return -1 stop capture.  NULL writer stop.
+ *
+ * Call after dw_sinsvc2_init().
+ */
+int dw_sinsvc2_capture(int (*wr)(const void*, size_t, void*), void *cbarg);
+
+/**
+ * Log per stage latency histogram of frame from socket read to SPI done, in
+ * microsecond.  Stage: frm wait frame buffer, recv payload, queue in SPI,
+ * xmit trunk, done wait callback, and total.  Logged by the task, block till
+ * done, not from the task or callback.
+ *
+ * @param reset Clear histogram after dump
+ */
+int dw_sinsvc2_lat_dump(int reset);
+
+#if defined(ALOE_SYS_LINUX)
+/**
+ * Feed the trace file to the frame pipeline to SPI, run by sinsvc2 task and
+ * the caller wait done.  Client rejected while replay.
+ *
+ * @param speed Percent of original speed, 0 for as fast as credit allow
+ * @return Frame replayed, -1 when failed
+ */
+long dw_sinsvc2_replay(const char *path, unsigned speed);
+#endif
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -11,16 +11,27 @@
 
 #include <aloe_unitest.h>
 
+#include <limits.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <net/if.h>
+#if defined(ALOE_SYS_LINUX)
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
 
-#include <esp_wifi.h>
+#if !defined(ALOE_SYS_LINUX)
+#  include <esp_wifi.h>
+#endif
 #include "dw_util.h"
 #include "dw_spi.h"
+#include "dw_sinsvc.h"
+#include "dw_sockev.h"
 
 #define log_d(...) aloe_log_d(__VA_ARGS__)
 #define log_e(...) aloe_log_e(__VA_ARGS__)
@@ -47,12 +58,37 @@ typedef enum {
 	sinsvc2_pkt2_tag_ ## _nm ## _bit = _b, \
 	sinsvc2_pkt2_tag_ ## _nm = 1 << (_b)
 
+	/*
+	 * Start and end fragment of a message, s and e both set for whole
+	 * message in one frame, neither outside a chain taken as whole too.
+	 * Fragment of the message go to SPI back-to-back, so as frame longer
+	 * than frame buffer, sinsvc2_hold_max_ms bound the wait.
+	 */
 	tag_ent(s, 0),
 	tag_ent(e, 1),
 
+	/*
+	 * Device to host, payload uint32_t for frame buffer the client could
+	 * borrow.  Host to device once, payload ignored, switch the client to
+	 * dw_pkt2_t framed output with credit advertise, raw payload otherwise.
+	 */
+	tag_ent(credit, 2),
+
 #undef tag_ent
+
+	/* host to device, 2 bits priority class, higher jump ahead to SPI */
+	sinsvc2_pkt2_tag_prio_bit = 3,
+	sinsvc2_pkt2_tag_prio_mask = 0x3 << 3,
 } sinsvc2_pkt2_tag_t;
 
+#define sinsvc2_pkt2_prio(_tag) \
+	(((_tag) & sinsvc2_pkt2_tag_prio_mask) >> sinsvc2_pkt2_tag_prio_bit)
+
+/** Neither s nor e outside a chain, whole message from sender before s|e. */
+#define sinsvc2_pkt2_tag_norm(_tag, _chain_open) ( \
+		((_tag) & (sinsvc2_pkt2_tag_s | sinsvc2_pkt2_tag_e)) || (_chain_open) \
+		? (_tag) : ((_tag) | sinsvc2_pkt2_tag_s | sinsvc2_pkt2_tag_e))
+
 typedef enum {
 #define sel_ent(_nm, _b) \
 	sel_ ## _nm ## _bit = _b, \
@@ -63,6 +99,9 @@ typedef enum {
 	sel_ent(ex, 2),
 	sel_ent(tmr, 3),
 
+	/* resume by mgmt */
+	sel_ent(kick, 4),
+
 	sel_sockrw = sel_rd | sel_wr,
 	sel_sockact = sel_rd | sel_wr | sel_ex,
 #undef sel_ent
@@ -71,7 +110,12 @@ typedef enum {
 typedef struct sock_rec {
 	int fd;
 	unsigned sel_req;
-	unsigned long tdue;
+	aloe_tmr_t tmr;
+
+	/* registered to event backend */
+	int ev_fd;
+	unsigned sel_reg;
+
 	struct sockaddr_in sin;
 	void (*act)(struct sock_rec*, unsigned sel_res);
 } sock_t;
@@ -80,40 +124,223 @@ typedef struct {
 	sock_t sock;
 } svc_t;
 
-#define frm_req_sz (4 * 1024)
+/**
+ * Cut-through, hand the frame to SPI as soon as the header arrived and SPI
+ * transmit trunks when landed.  Otherwise store-and-forward the whole frame.
+ */
+#define sinsvc2_cut_through 1
+
+/*
+ * Open chain or partial frame in SPI hold the bus for every class, drop the
+ * client holding longer than this, in millisecond.
+ */
+#ifndef sinsvc2_hold_max_ms
+#  define sinsvc2_hold_max_ms 2000ul
+#endif
+
+typedef enum {
+#define flag_ent(_nm, _b) \
+	frm_flag_ ## _nm ## _bit = _b, \
+	frm_flag_ ## _nm = 1 << (_b)
+
+	// already handed to spi
+	flag_ent(spi, 0),
+
+	// borrowed from shared region
+	flag_ent(shared, 1),
+
+#undef flag_ent
+} frm_flag_t;
+
+#ifndef frm_req_sz
+#  define frm_req_sz (4 * 1024)
+#endif
 typedef struct {
 	dw_spi2_req_t spi2_req;
 	uint16_t flag;
 	aloe_buf_t fb;
+
+	/* owner to count quota */
+	struct cln_rec *cln;
+
+	/* read before frame buffer borrowed, borrowed and payload landed */
+	unsigned long ts_rd, ts_pop, ts_land;
 } frm_req_t;
 
+/* frame data follow the descriptor in the pool object */
+#define frm_hdr_sz aloe_roundup(sizeof(frm_req_t), 32)
+
+/*
+ * Outward dw_pkt2_t in segment shared by all client, whole frame never span
+ * segment.
+ */
+#ifndef seg_sz_def
+#  define seg_sz_def (2 * 1024)
+#endif
+#ifndef seg_cnt_def
+#  define seg_cnt_def 8
+#endif
+#define seg_cnt_max 32
+
+/* segment descriptor link SPI received frame */
+#define seg_rx_cnt 8
+
+/* segment data follow the descriptor in the pool object */
+#define seg_hdr_sz aloe_roundup(sizeof(seg_t), 32)
+typedef struct seg_rec {
+	aloe_buf_t fb;
+
+	/* client cursor in or not yet passed, plus producer hold the tail */
+	int ref;
+
+	/* linked SPI received frame, producer not hold */
+	dw_spi2_rx_t *rx;
+
+	/* client the frame echoed to, NULL for every client */
+	const void *dst;
+
+	TAILQ_ENTRY(seg_rec) qent;
+} seg_t;
+
+/* cursor pass the frame echoed to other client */
+#define seg_foreign(_seg, _cln) ((_seg)->dst && (_seg)->dst != (_cln))
+
+typedef TAILQ_HEAD(seg_list_rec, seg_rec) seg_list_t;
+
+/* frame latency by stage, stage overlap when cut-through */
+typedef enum {
+	// arrival to frame buffer borrowed
+	sinsvc2_lat_frm,
+
+	// frame buffer borrowed to payload landed
+	sinsvc2_lat_recv,
+
+	// handed to SPI to leave req_list
+	sinsvc2_lat_queue,
+
+	// leave req_list to last trunk done
+	sinsvc2_lat_xmit,
+
+	// last trunk done to cln_frm_done
+	sinsvc2_lat_done,
+
+	// arrival to cln_frm_done
+	sinsvc2_lat_total,
+
+	sinsvc2_lat_cnt,
+} sinsvc2_lat_id_t;
+
+static const char *sinsvc2_lat_name[sinsvc2_lat_cnt] = {
+	"frm", "recv", "queue", "xmit", "done", "total",
+};
+
+/* more than frame buffer, frame done before the task pop, power of 2 */
+#define sinsvc2_lat_ring_cnt 64
+
 typedef struct {
+	uint32_t us[sinsvc2_lat_cnt];
+} sinsvc2_lat_rec_t;
+
+typedef struct {
+	/* cln_frm_done pop free and push full, the task pop full to histogram
+	 * and push back free */
+	aloe_spsc_t free, full;
+	void *free_ent[sinsvc2_lat_ring_cnt], *full_ent[sinsvc2_lat_ring_cnt];
+	sinsvc2_lat_rec_t rec[sinsvc2_lat_ring_cnt];
+
+	/* cln_frm_done only */
+	unsigned drop;
+
+	/* the task only */
+	dw_hist_t hist[sinsvc2_lat_cnt];
+} sinsvc2_lat_t;
+
+typedef struct cln_rec {
 	sock_t sock;
 
 	/* hold dw_pkt1_t in data field */
-	aloe_buf_t recv, resp;
+	aloe_buf_t recv;
+
+	/* credit advertise */
+	aloe_buf_t resp;
+
+	/* outward cursor, hold reference of seg, guarded by store_lock */
+	seg_t *seg;
+	size_t seg_pos;
+
+	/* remain of the frame in progress, credit advertise at frame boundary */
+	size_t seg_frm_rem;
 
 	frm_req_t *frm;
 	dw_pkt2_t pkthdr;
 	size_t pkt_lmt;
 
+	/* payload of the pkt2 frame not yet in frame buffer */
+	size_t pkt_rem;
+
+	/*
+	 * Chain to SPI not yet end, by frame longer than frame buffer or message
+	 * fragment without e, every part in the class of the first one.
+	 */
+	int chain_open;
+	unsigned chain_prio;
+
+	/* chain_open or partial frame in SPI since, in aloe_ticks() millisecond */
+	unsigned long hold_ts;
+
+	/*
+	 * End the chain when client gone, busy until SPI callback, the slot not
+	 * reused before that.
+	 */
+	dw_spi2_req_t chain_end;
+	int chain_end_busy;
+
+	/* last advertised credit */
+	int credit_adv;
+
+	/* negotiated by host, output framed and credit advertised */
+	int framed;
+
+	/* payload of control frame not yet skipped */
+	size_t ctl_rem;
+
+	/* last read in dw_ts_us() */
+	unsigned long ts_rd;
+
+	/*
+	 * Frame buffer held, include those in SPI, frm_borrow - frm_done.
+	 * frm_borrow by the task, frm_done by SPI callback.
+	 */
+	unsigned frm_borrow, frm_done;
+
 	struct {
 		unsigned long ts_accept, ts_log, acc;
 		unsigned long ts_log_frm, acc_frm_spi;
+
+		/* written to client, reverse direction */
+		unsigned long acc_out;
 	} st;
 
 } cln_t;
 
 typedef struct {
+	/* loopback udp kicked to wake the task */
 	sock_t sock;
 
-	/* 32 bytes alignment */
-#define mgmt_sz (2 * 1024)
+	/* outward dw_pkt2_t, client write from the segment in place */
+	seg_list_t seg_list;
+
+	/* free segment with data, and descriptor to link SPI received frame */
+	aloe_pool_t *seg_pool, *seg_rx_pool;
+
+	/* client attached to seg_list */
+	int seg_cln;
 
-	/* outward data feed to mgmt, then copy to client */
-	aloe_buf_t store;
 	aloe_sem_t store_lock;
 
+	/* wake pending for data in seg_list, guarded by store_lock */
+	unsigned store_kick: 1;
+
 } mgmt_t;
 
 ALOE_SYS_DATA1_SECTION
@@ -124,30 +351,91 @@ static struct {
 
 	aloe_thread_t tsk;
 
-	/* for select() */
-	int fds_mx;
-	fd_set fds_rd, fds_wr, fds_ex;
+	/* event backend */
+	dw_sockev_t ev;
+	dw_sockev_res_t *ev_res;
+
+	/* socket timeout, wheel revolution 12.8 seconds */
+#define sinsvc_tmw_slot_cnt 128
+#define sinsvc_tmw_res 100
+	aloe_tmwheel_t tmw;
+	aloe_tmr_list_t tmw_slot[sinsvc_tmw_slot_cnt];
 
 	mgmt_t mgmt;
 
 	svc_t svc;
 
-#define cln_cnt 1
+#define sinsvc2_cln_cnt_def 2
 
 	/* 32 bytes alignment */
 #define cln_recv_sz (64 * 1024)
-#define cln_resp_sz (128)
+#define cln_resp_sz (64)
 
-	cln_t cln[cln_cnt];
+	/* geometry in effect, every field resolved */
+	dw_sinsvc2_cfg_t cfg;
+
+	int cln_cnt;
+	cln_t *cln;
 
 	void *xfer, *xfer_alloc;
 
-#define sock_cnt (1 + 1 + cln_cnt)
-	sock_t *sock_list[sock_cnt];
+	int sock_cnt;
+	sock_t **sock_list;
+
+	/*
+	 * Each client guaranteed cfg.frm_quota frame buffer, then borrow from
+	 * cfg.frm_shared overflow region, so one greedy sender not starve others.
+	 * Default cfg.frm_cnt budget frm_req_quota for each client plus
+	 * frm_req_shared, split by sinsvc2_frm_split().
+	 */
+#ifndef frm_req_quota
+#  define frm_req_quota 2
+#endif
+#ifndef frm_req_shared
+#  define frm_req_shared 2
+#endif
+	int frm_cnt;
+
+	/* free frame, returned by the task or SPI callback */
+	aloe_pool_t *frm_pool;
+
+	/* shared region, frm_shared_borrow - frm_shared_done */
+	unsigned frm_shared_borrow, frm_shared_done;
+
+	/* set by the task, clear by SPI callback to kick */
+	unsigned frm_stall;
+
+	/* capture writer, the task stamp delta from ts */
+	struct {
+		int (*wr)(const void*, size_t, void*);
+		void *cbarg;
+		unsigned long ts;
+		int started;
+	} cap;
+
+	/* client rejected while replay, guarded by store_lock */
+	int replay;
+
+#if defined(ALOE_SYS_LINUX)
+	/* replay posted to the task, the caller wait done */
+	struct {
+		const char *trc;
+		size_t trc_sz;
+		unsigned speed;
+		long r;
+		int pending;
+		aloe_sem_t *done;
+	} rply;
+#endif
+
+	/* NULL when failed allocate */
+	sinsvc2_lat_t *lat;
 
-#define frm_req_cnt ((int)((15 * 1024) / frm_req_sz))
-	dw_spi2_req_list_t frm_list;
-	aloe_sem_t frm_lock;
+	/* latency dump posted to the task, the caller wait done */
+	struct {
+		int reset, pending;
+		aloe_sem_t *done;
+	} latd;
 
 } impl = {};
 
@@ -173,48 +461,34 @@ static const size_t pkt2_hdr_len = aloe_sizewith(dw_pkt2_t, len);
 #  define eno_wouldblock(_eno) ((_eno) == EAGAIN)
 #endif
 
-/** Set due time, for timeout. */
-#define sock_tdue(_dur) ((unsigned long)aloe_tick2ms(aloe_ticks()) + (_dur))
-
-/** Prepare FD_SET and max fd number for select(). */
-#define sinsvc_fds(_sock) do { \
-	if (impl.fds_mx < (_sock)->fd) impl.fds_mx = (_sock)->fd; \
-	if ((_sock)->sel_req & sel_rd) FD_SET((_sock)->fd, &impl.fds_rd); \
-	if ((_sock)->sel_req & sel_wr) FD_SET((_sock)->fd, &impl.fds_wr); \
-	if ((_sock)->sel_req & sel_ex) FD_SET((_sock)->fd, &impl.fds_ex); \
-} while(0)
-
-/** Prepare min due time for select(). */
-#define sinsvc_tdue(_tdue, _ts0, _sock_tdue) if ( \
-		((_tdue) == aloe_dur_infinite || (_tdue) > (_ts0))) { \
-	if ((_sock_tdue) == 0) { \
-		(_tdue) = (_ts0); \
-	} else if (((_sock_tdue) != aloe_dur_infinite) \
-			&& ((_tdue) > (_sock_tdue))) { \
-		(_tdue) = (_sock_tdue); \
+/** Arm timeout, aloe_dur_infinite to cancel. */
+#define sock_tmr_arm(_sock, _dur) do { \
+	if ((_dur) == aloe_dur_infinite) { \
+		aloe_tmwheel_cancel(&impl.tmw, &(_sock)->tmr); \
+	} else { \
+		aloe_tmwheel_arm(&impl.tmw, &(_sock)->tmr, \
+				(unsigned long)aloe_tick2ms(aloe_ticks()) + (_dur)); \
 	} \
-}
-
-/** Check FD_ISSET. */
-#define sinsvc_sel(_sel, _sock) do { \
-		if (FD_ISSET((_sock)->fd, &impl.fds_rd)) *(_sel) |= sel_rd; \
-		if (FD_ISSET((_sock)->fd, &impl.fds_wr)) *(_sel) |= sel_wr; \
-		if (FD_ISSET((_sock)->fd, &impl.fds_ex)) *(_sel) |= sel_ex; \
 } while(0)
 
-/** Check timeout. */
-#define sinsvc_ts_tdue(_ts1, _sock_tdue) ( \
-		(_sock_tdue) != aloe_dur_infinite \
-		&& (_ts1) >= (_sock_tdue))
-
 #define sinsvc_cln_reset(_cln) do { \
-		(_cln)->sock.fd = -1; \
-		_aloe_buf_clear(&(_cln)->recv); \
+		(_cln)->sock.fd = (_cln)->sock.ev_fd = -1; \
+		(_cln)->recv.pos = (_cln)->recv.lmt = 0; \
 		(_cln)->resp.pos = (_cln)->resp.lmt = 0; \
 		(_cln)->frm = NULL; \
+		(_cln)->seg = NULL; \
 		(_cln)->pkt_lmt = 0; \
+		(_cln)->pkt_rem = 0; \
+		(_cln)->chain_open = 0; \
+		(_cln)->credit_adv = -1; \
+		(_cln)->framed = 0; \
+		(_cln)->ctl_rem = 0; \
 } while(0)
 
+/** Open chain or partial frame in SPI, the bus wait for the client. */
+#define cln_holding(_cln) ((_cln)->chain_open \
+		|| ((_cln)->frm && ((_cln)->frm->flag & frm_flag_spi)))
+
 #define log_sockaddr(_msg, _sin) do { \
 	char _buf[50]; \
 	if (!inet_ntop(AF_INET, &(_sin)->sin_addr, _buf, sizeof(_buf))) { \
@@ -233,23 +507,23 @@ static const size_t pkt2_hdr_len = aloe_sizewith(dw_pkt2_t, len);
 ALOE_SYS_TEXT1_SECTION
 static int sinsvc2_svcaddr(char *addr, size_t len, struct in_addr *sin_addr) {
 	char _addr[40];
-	esp_netif_ip_info_t ipinfo;
+	aloe_ifaddr_t ifaddr;
 	int addrLen;
 
-	if (esp_netif_get_ip_info(esp_netif_get_default_netif(), &ipinfo) != ESP_OK) {
+	if (aloe_ifaddr_get(NULL, &ifaddr) != 0) {
 //		log_e("Failed get ip info\n");
 		return -1;
 	}
 
 	log_d("wifi ready ip %d.%d.%d.%d, netmask %d.%d.%d.%d, gw: %d.%d.%d.%d\n",
-			ESPIPADDR_PKARG(&ipinfo.ip), ESPIPADDR_PKARG(&ipinfo.netmask),
-			ESPIPADDR_PKARG(&ipinfo.gw));
+			DW_IPADDR_PKARG(ifaddr.addr), DW_IPADDR_PKARG(ifaddr.netmask),
+			DW_IPADDR_PKARG(ifaddr.gw));
 
-	if (ESPIPADDR_ENT(&ipinfo.ip, 0) == 0) return -1;
+	if (DW_IPADDR_ENT(ifaddr.addr, 0) == 0) return -1;
 
 	if ((addr && len > 0) || sin_addr) {
 		snprintf(_addr, sizeof(_addr), "%d.%d.%d.%d",
-				ESPIPADDR_PKARG(&ipinfo.ip));
+				DW_IPADDR_PKARG(ifaddr.addr));
 		_addr[sizeof(_addr) - 1] = '\0';
 		addrLen = strlen(_addr);
 
@@ -269,69 +543,57 @@ static int sinsvc2_svcaddr(char *addr, size_t len, struct in_addr *sin_addr) {
 	return 0;
 }
 
-#if 0
-static int mgmt_pipe_close(void) {
-	mgmt_t *mgmt = &impl.mgmt;
+/** Wake the task from other task, ie. frame buffer returned. */
+static int mgmt_kick(void) {
+	char evt = 1;
+	int eno;
 
-	if (mgmt->sock.fd != -1) {
-		fd_gc(mgmt->sock.fd);
-		fd_gc(mgmt->pipe_fd1);
-	}
-}
+	if (impl.mgmt.sock.fd == -1) return -1;
 
-static int mgmt_pipe_kick(void) {
-	mgmt_t *mgmt = &impl.mgmt;
-	int r = 1;
+	if (send(impl.mgmt.sock.fd, &evt, sizeof(evt), 0) == sizeof(evt)) return 0;
 
-	if (mgmt->sock.fd != -1
-			&& write(impl.mgmt.pipe_fd1, &r, 1) != 1) {
-		return -1;
-	}
-	return 0;
+	// queue full means wake pending
+	eno = errno;
+	return eno_wouldblock(eno) ? 0 : -1;
 }
 
-static int mgmt_pipe_open(void (*act)(struct sock_rec*, unsigned),
-		unsigned long tdur) {
-	mgmt_t *mgmt = &impl.mgmt;
-	int r, pfd[2] = {-1, -1};
+/** Sync interest to event backend, only when changed. */
+static void sinsvc_sock_arm(sock_t *sock) {
+	unsigned sel = sock->sel_req & sel_sockact;
 
-	if (pipe(pfd) != 0) {
-		r = errno;
-		log_e("open pipe: %s\n", strerror(r));
-		return -1;
-	}
+	if (sock->fd == -1) return;
 
-	if ((act || tdur != aloe_dur_infinite) && fd_nbio(pfd[0]) != 0) {
-		log_e("Failed set nonblock\n");
-		close(pfd[0]); close(pfd[1]);
-		return -1;
-	}
-	if (act) {
-		mgmt->sock.sel_req = sel_rd;
-		mgmt->sock.tdue = (tdur == aloe_dur_infinite) ? tdur : sock_tdue(tdur);
-		mgmt->sock.act = act;
+	if (sock->ev_fd != sock->fd) {
+		if (dw_sockev_add(&impl.ev, sock->fd, sel, sock) != 0) {
+			log_e("Failed add to event backend\n");
+			return;
+		}
+		sock->ev_fd = sock->fd;
+		sock->sel_reg = sel;
+		return;
 	}
 
-	mgmt->sock.fd = pfd[0];
-	mgmt->pipe_fd1 = pfd[1];
-	return 0;
+	if (sock->sel_reg == sel) return;
+	if (dw_sockev_mod(&impl.ev, sock->fd, sel, sock) != 0) {
+		log_e("Failed modify event backend\n");
+		return;
+	}
+	sock->sel_reg = sel;
 }
-#endif
-
-static int sinsvc_close_all(void) {
-	int i;
 
-	for (i = 0; i < sock_cnt; i++) {
-		if (impl.sock_list[i]->fd != -1) {
-			fd_gc(impl.sock_list[i]->fd);
-		}
+/** Unregister from event backend and close. */
+static void sock_gc(sock_t *sock) {
+	if (sock->ev_fd != -1) {
+		dw_sockev_del(&impl.ev, sock->ev_fd);
+		sock->ev_fd = -1;
 	}
-	impl.launched = 0;
-	return 0;
+	aloe_tmwheel_cancel(&impl.tmw, &sock->tmr);
+	fd_gc(sock->fd);
 }
 
 static int sock_svr_open(sock_t *sock, uint16_t port, int sockType,
-		void (*act)(struct sock_rec*, unsigned), unsigned long tdur) {
+		int backlog, void (*act)(struct sock_rec*, unsigned),
+		unsigned long tdur) {
 	int opt1;
 
 	if((sock->fd = socket(AF_INET, sockType, 0)) == -1) {
@@ -361,7 +623,7 @@ static int sock_svr_open(sock_t *sock, uint16_t port, int sockType,
 		return -1;
 	}
 
-	if(listen(sock->fd, 1) != 0) {
+	if(listen(sock->fd, backlog) != 0) {
 		log_e("listen error\n");
 		fd_gc(sock->fd);
 		return -1;
@@ -369,7 +631,7 @@ static int sock_svr_open(sock_t *sock, uint16_t port, int sockType,
 
 	if (act) {
 		sock->sel_req = sel_rd;
-		sock->tdue = (tdur == aloe_dur_infinite) ? tdur : sock_tdue(tdur);
+		sock_tmr_arm(sock, tdur);
 		sock->act = act;
 	}
 
@@ -393,6 +655,7 @@ static void sock_svr_reject(int fd_svr) {
 static int sock_svr_accept(int fd_svr, sock_t *sock,
 		void (*act)(sock_t*, unsigned), unsigned long tdur) {
 	socklen_t sin_len = sizeof(sock->sin);
+	int opt1 = 1;
 
 	if ((sock->fd = accept(fd_svr, (struct sockaddr*)&sock->sin,
 			&sin_len)) == -1) {
@@ -406,8 +669,14 @@ static int sock_svr_accept(int fd_svr, sock_t *sock,
 		return -1;
 	}
 
+	// credit and echo are small write, not wait for delayed ack
+	if (setsockopt(sock->fd, IPPROTO_TCP, TCP_NODELAY, &opt1,
+			sizeof(opt1)) != 0) {
+		log_e("Failed set nodelay\n");
+	}
+
 	sock->sel_req = sel_rd;
-	sock->tdue = tdur == aloe_dur_infinite ? tdur : sock_tdue(tdur);
+	sock_tmr_arm(sock, tdur);
 	sock->act = act;
 
 	return 0;
@@ -437,187 +706,849 @@ static int sock_cln_recv(sock_t *sock, void *data, size_t sz) {
 	return r;
 }
 
-static void cln_frm_done(void *args) {
-	frm_req_t *frm_req = (frm_req_t*)args;
-
-	if (dw_spi2_req_add(&impl.frm_list, &impl.frm_lock, &frm_req->spi2_req) != 0) {
-		log_e("Failed add to frm\n");
-	}
-}
+#define frm_used(_cln) \
+		((int)((_cln)->frm_borrow - aloe_atomic_load(&(_cln)->frm_done)))
+#define frm_shared_used() \
+		((int)(impl.frm_shared_borrow - aloe_atomic_load(&impl.frm_shared_done)))
+#define frm_credit_calc(_cln) \
+		(aloe_max((int)impl.cfg.frm_quota - frm_used(_cln), 0) \
+		+ ((int)impl.cfg.frm_shared - frm_shared_used()))
 
-static void cln_gc(cln_t *cln) {
-	if (cln->frm) {
-		cln_frm_done(cln->frm);
-		cln->frm = NULL;
-	}
-	fd_gc(cln->sock.fd);
-}
+/** Frame buffer the client could borrow, mark stall when no credit. */
+static int frm_credit(cln_t *cln) {
+	int credit;
 
-static void svc_cln_act(sock_t *_sock, unsigned actype) {
-	cln_t *cln = aloe_container_of(_sock, cln_t, sock);
-	aloe_buf_t *fb;
-	int r = 0;
-	dw_spi2_req_t *spi2_req;
+	if ((credit = frm_credit_calc(cln)) > 0) return credit;
 
-	if (actype & sel_tmr) {
-#if 1
-		log_sockaddr("cln timeout ", &_sock->sin);
-#endif
-		r = 0;
-		goto finally;
-	}
+	// check again after mark stall, not miss frame returned in between
+	aloe_atomic_store(&impl.frm_stall, 1);
+	aloe_atomic_fence();
+	return frm_credit_calc(cln);
+}
 
-	if (actype & sel_rd) {
-		dw_pkt2_t *pkt;
+/**
+ * Shared region split among connected client, the sum advertised not over
+ * commit what one greedy sender could take.
+ */
+#define frm_credit_share_calc(_cln, _conn) \
+		(aloe_max((int)impl.cfg.frm_quota - frm_used(_cln), 0) \
+		+ aloe_max((int)impl.cfg.frm_shared - frm_shared_used(), 0) / (_conn))
 
-		pkt = &cln->pkthdr;
+/** Credit to advertise, mark stall to advertise again when returned. */
+static int frm_credit_share(cln_t *cln) {
+	int credit, conn = 0, i;
 
-		if (!cln->frm) {
-			spi2_req = dw_spi2_req_pop(&impl.frm_list, &impl.frm_lock);
-			if (spi2_req == NULL) {
-				log_e("out of frame buffer\n");
-				r = 0;
-				goto finally;
-			}
-			cln->frm = aloe_container_of(spi2_req, frm_req_t, spi2_req);
-			cln->frm->flag = 0;
-			_aloe_buf_clear(&cln->frm->fb);
+	for (i = 0; i < impl.cln_cnt; i++) {
+		if (impl.cln[i].sock.fd != -1) conn++;
+	}
+	if (conn < 1) conn = 1;
+	if ((credit = frm_credit_share_calc(cln, conn)) > 0) return credit;
 
-			// prepared to read header
+	aloe_atomic_store(&impl.frm_stall, 1);
+	aloe_atomic_fence();
+	return frm_credit_share_calc(cln, conn);
+}
 
-			cln->pkt_lmt = 0;
-		}
+/** Borrow frame buffer, from client quota then shared region. */
+static frm_req_t* frm_pop(cln_t *cln) {
+	frm_req_t *frm;
 
-		if (cln->pkt_lmt < pkt2_hdr_len) {
-			// read header
+	if (frm_credit(cln) <= 0) return NULL;
 
-			if ((r = sock_cln_recv(_sock, (char*)pkt + cln->pkt_lmt,
-					pkt2_hdr_len - cln->pkt_lmt)) <= 0) {
-				goto finally;
-			}
-			cln->pkt_lmt += r;
-			cln->st.acc += r;
+	// the last returned first, still in cache
+	if (!(frm = (frm_req_t*)aloe_pool_get(impl.frm_pool))) {
+		log_e("Sanity check frame buffer quota\n");
+		return NULL;
+	}
+	frm->cln = cln;
+	frm->ts_rd = cln->ts_rd;
+	frm->ts_pop = dw_ts_us();
+	frm->ts_land = 0;
+	if (frm_used(cln) < (int)impl.cfg.frm_quota) {
+		frm->flag = 0;
+		cln->frm_borrow++;
+	} else {
+		frm->flag = frm_flag_shared;
+		impl.frm_shared_borrow++;
+	}
+	return frm;
+}
 
-			if (cln->pkt_lmt < pkt2_hdr_len) {
-//				log_d("wait more for pkt2 hdr\n");
-				r = 0;
-				goto finally;
-			}
+/** Return frame buffer not handed to SPI, the task only. */
+static void frm_put(frm_req_t *frm_req) {
+	aloe_pool_put(impl.frm_pool, frm_req);
+	if (frm_req->flag & frm_flag_shared) {
+		impl.frm_shared_borrow--;
+	} else {
+		frm_req->cln->frm_borrow--;
+	}
+}
 
-			// found header, prepare to read payload (frame)
+/** Push stage latency of the frame from SPI task, lock-free. */
+static void cln_frm_lat(frm_req_t *frm_req) {
+	sinsvc2_lat_t *lat = impl.lat;
+	dw_spi2_req_t *req = &frm_req->spi2_req;
+	sinsvc2_lat_rec_t *rec;
+	unsigned long ts = dw_ts_us();
 
-			fb = &cln->frm->fb;
+	// truncated when client gone
+	if (!lat || frm_req->ts_land == 0) return;
 
-			if (pkt->len > fb->cap) {
-				log_e("payload length too large\n");
-				r = -1;
-				goto finally;
-			}
+	if (!(rec = (sinsvc2_lat_rec_t*)aloe_spsc_pop(&lat->free))) {
+		aloe_atomic_store(&lat->drop, lat->drop + 1);
+		return;
+	}
+	rec->us[sinsvc2_lat_frm] = frm_req->ts_pop - frm_req->ts_rd;
+	rec->us[sinsvc2_lat_recv] = frm_req->ts_land - frm_req->ts_pop;
+	rec->us[sinsvc2_lat_queue] = req->ts_deq - req->ts;
+	rec->us[sinsvc2_lat_xmit] = req->ts_fin - req->ts_deq;
+	rec->us[sinsvc2_lat_done] = ts - req->ts_fin;
+	rec->us[sinsvc2_lat_total] = ts - frm_req->ts_rd;
+
+	// record count never more than the ring
+	aloe_spsc_push(&lat->full, rec);
+
+	// the task may sleep without client, ie. replay
+	if (lat->full.wr - aloe_atomic_load(&lat->full.rd)
+			== sinsvc2_lat_ring_cnt / 2) {
+		mgmt_kick();
+	}
+}
 
-			// init fb pointer
-			fb->pos = 0;
-			fb->lmt = pkt->len;
-		} else {
-			fb = &cln->frm->fb;
-		}
+/** Histogram stage latency pushed from SPI task, the task only. */
+static void sinsvc_lat_drain(void) {
+	sinsvc2_lat_t *lat = impl.lat;
+	sinsvc2_lat_rec_t *rec;
+	int i;
 
-		if (fb->lmt == 0 || fb->pos >= fb->lmt) {
-			log_e("Sanity check, previous frame not process (or payload length too large)\n");
-			r = -1;
-			goto finally;
-		}
+	if (!lat) return;
 
-		if ((r = sock_cln_recv(_sock, (char*)fb->data + fb->pos,
-				fb->lmt - fb->pos)) <= 0) {
-			goto finally;
+	while ((rec = (sinsvc2_lat_rec_t*)aloe_spsc_pop(&lat->full))) {
+		for (i = 0; i < sinsvc2_lat_cnt; i++) {
+			dw_hist_add(&lat->hist[i], rec->us[i]);
 		}
-		fb->pos += r;
-		cln->st.acc += r;
+		aloe_spsc_push(&lat->free, rec);
+	}
+}
 
-#if 1
-		// state network speed
-		{
-			unsigned long ts = aloe_tick2ms(aloe_ticks());
-			if (cln->st.ts_log == 0) cln->st.ts_log = ts;
-			if (ts - cln->st.ts_log >= 1000) {
-				// duration unit millisecond => result KBps
-				double r2, rd100;
+/** Log stage latency histogram, the task only. */
+static void sinsvc_lat_log(int reset) {
+	sinsvc2_lat_t *lat = impl.lat;
+	unsigned drop;
+	int i;
 
-				FPS_CALC1(cln->st.acc, ts - cln->st.ts_accept);
-				log_d("data rate: %d.%02dKBps\n", (int)r2, (int)rd100);
+	sinsvc_lat_drain();
+	for (i = 0; i < sinsvc2_lat_cnt; i++) {
+		dw_hist_log(&lat->hist[i], sinsvc2_lat_name[i]);
+	}
+	if ((drop = aloe_atomic_load(&lat->drop)) > 0) {
+		log_d("trace dropped: %u\n", drop);
+	}
+	log_d("frame buffer used max: %u / %u, segment: %u / %u\n",
+			impl.frm_pool->used_max, impl.frm_pool->cnt,
+			impl.mgmt.seg_pool->used_max, impl.mgmt.seg_pool->cnt);
+	if (reset) memset(lat->hist, 0, sizeof(lat->hist));
+}
 
-				cln->st.ts_log = aloe_tick2ms(aloe_ticks());
-			}
-		}
+/* test seam, the task pop the frame between the put and the count */
+#ifndef sinsvc2_frm_done_race
+#  define sinsvc2_frm_done_race(_frm_req) do { } while(0)
 #endif
-		if (fb->pos < fb->lmt) {
-//			log_d("wait more for pkt2 payload\n");
-			r = 0;
-			goto finally;
-		}
 
-		spi2_req = &cln->frm->spi2_req;
-		spi2_req->data = cln->frm->fb.data;
-		spi2_req->sz = cln->frm->fb.lmt;
-		spi2_req->cb = &cln_frm_done;
-		spi2_req->cbarg = cln->frm;
+/** Return frame buffer from SPI task, lock-free. */
+static void cln_frm_done(void *args) {
+	frm_req_t *frm_req = (frm_req_t*)args;
+	unsigned *done;
 
-//		log_d("frame done\n");
-		cln->frm = NULL;
+	cln_frm_lat(frm_req);
 
-//		if (dw_spi2_add(spi2_req) != 0)
-		{
-//			log_e("Failed add to spi\n");
-			cln_frm_done(spi2_req->cbarg);
-			r = 0;
-			goto finally;
-		}
-		cln->st.acc_frm_spi++;
-		r = 0;
-	}
-	if (actype & sel_wr) {
-		fb = &cln->resp;
-		if (fb->lmt > fb->pos) {
-			r = write(_sock->fd, (char*)fb->data + fb->pos, fb->lmt - fb->pos);
-			if (r == 0) {
-				r = -1;
-#if 1
-				log_sockaddr("cln closed ", &_sock->sin);
-#endif
-				goto finally;
-			}
-			if (r < 0) {
-				r = errno;
-				if (eno_wouldblock(r)) {
-					r = 0;
-				} else {
-					log_e("svc client err: %d(0x%x)\n", r, r);
-					r = -1;
-				}
-				goto finally;
-			}
-			fb->pos += r;
-			aloe_buf_rewind(fb);
-		}
-		r = 0;
+	// the task may pop it again once in the pool
+	done = (frm_req->flag & frm_flag_shared) ? &impl.frm_shared_done :
+			&frm_req->cln->frm_done;
+
+	// pool before count, the task see credit then pop
+	if (aloe_pool_put(impl.frm_pool, frm_req) != 0) {
+		log_e("Sanity check frame not from pool\n");
+		return;
 	}
-finally:
-	if (r < 0) {
-		cln_gc(cln);
-	} else {
-		_sock->sel_req = sel_rd;
+	sinsvc2_frm_done_race(frm_req);
+	aloe_atomic_store(done, *done + 1);
 
-		// data to send
-		fb = &cln->resp;
-		if (fb->lmt > fb->pos) _sock->sel_req |= sel_wr;
+	// wake client stopped reading
+	aloe_atomic_fence();
+	if (aloe_atomic_xchg(&impl.frm_stall, 0)) mgmt_kick();
+}
 
-		_sock->tdue = sock_tdue(10000);
-	}
+/** Advertise credit to framed sender when changed. */
+static void cln_credit_adv(cln_t *cln) {
+	aloe_buf_t *fb = &cln->resp;
+	struct __attribute__((packed)) {
+		dw_pkt2_t hdr;
+		uint32_t credit;
+	} pkt;
+	int credit;
+
+	if (!cln->framed) return;
+	credit = frm_credit_share(cln);
+	if (credit == cln->credit_adv || fb->cap - fb->lmt < sizeof(pkt)) return;
+
+	pkt.hdr.tag = sinsvc2_pkt2_tag_credit;
+	pkt.hdr.len = sizeof(pkt.credit);
+	pkt.credit = (uint32_t)credit;
+	memcpy((char*)fb->data + fb->lmt, &pkt, sizeof(pkt));
+	fb->lmt += sizeof(pkt);
+	cln->credit_adv = credit;
+}
+
+/** Release segment reference, store_lock held. */
+static void seg_unref(seg_t *seg) {
+	if (--seg->ref > 0) return;
+
+	// passed by all cursor, must be the head
+	TAILQ_REMOVE(&impl.mgmt.seg_list, seg, qent);
+	if (seg->rx) {
+		dw_spi2_rx_free(seg->rx);
+		seg->rx = NULL;
+		seg->fb.data = NULL;
+		seg->fb.cap = seg->fb.pos = seg->fb.lmt = 0;
+		aloe_pool_put(impl.mgmt.seg_rx_pool, seg);
+		return;
+	}
+	seg->fb.pos = seg->fb.lmt = 0;
+	aloe_pool_put(impl.mgmt.seg_pool, seg);
+}
+
+/** Segment to append, new one when tail has no room, store_lock held. */
+static seg_t* seg_tail(size_t len) {
+	seg_t *tail = TAILQ_LAST(&impl.mgmt.seg_list, seg_list_rec), *seg;
+
+	if (tail && tail->fb.cap - tail->fb.lmt >= len) return tail;
+
+	if (!(seg = (seg_t*)aloe_pool_get(impl.mgmt.seg_pool))) return NULL;
+
+	// every attached cursor will pass through
+	seg->ref = impl.mgmt.seg_cln + 1;
+	seg->dst = NULL;
+	TAILQ_INSERT_TAIL(&impl.mgmt.seg_list, seg, qent);
+
+	// producer moved to new tail
+	if (tail && !tail->rx) seg_unref(tail);
+	return seg;
+}
+
+/**
+ * Link SPI received frame as one dw_pkt2_t, header in the headroom,
+ * store_lock held.
+ */
+static int seg_link_rx(dw_spi2_rx_t *rx) {
+	seg_t *tail = TAILQ_LAST(&impl.mgmt.seg_list, seg_list_rec), *seg;
+	dw_pkt2_t pkt;
+
+	if (rx->fb.pos < pkt2_hdr_len) {
+		log_e("Sanity check no headroom\n");
+		return -1;
+	}
+	if (!(seg = (seg_t*)aloe_pool_get(impl.mgmt.seg_rx_pool))) return -1;
+
+	pkt.tag = sinsvc2_pkt2_tag_s | sinsvc2_pkt2_tag_e;
+	pkt.len = rx->fb.lmt - rx->fb.pos;
+	rx->fb.pos -= pkt2_hdr_len;
+	memcpy((char*)rx->fb.data + rx->fb.pos, &pkt, pkt2_hdr_len);
+
+	seg->rx = rx;
+	seg->dst = rx->chain;
+	seg->fb.data = (char*)rx->fb.data + rx->fb.pos;
+	seg->fb.cap = seg->fb.lmt = rx->fb.lmt - rx->fb.pos;
+	seg->fb.pos = 0;
+
+	// nothing append to it, only attached cursor
+	seg->ref = impl.mgmt.seg_cln;
+	TAILQ_INSERT_TAIL(&impl.mgmt.seg_list, seg, qent);
+
+	// producer moved to new tail
+	if (tail && !tail->rx) seg_unref(tail);
+	return 0;
+}
+
+/** SPI received frame to client, from SPI task. */
+static void sinsvc_spi_rx(dw_spi2_rx_t *rx, void *cbarg) {
+	(void)cbarg;
+
+	if ((aloe_sem_wait(&impl.mgmt.store_lock, NULL, aloe_dur_infinite,
+			"sinsvc2")) != 0) {
+		log_e("lock\n");
+		dw_spi2_rx_free(rx);
+		return;
+	}
+	if (impl.mgmt.seg_cln <= 0 || seg_link_rx(rx) != 0) {
+		aloe_sem_post(&impl.mgmt.store_lock, NULL, "sinsvc2");
+//		log_d("drop spi rx\n");
+		dw_spi2_rx_free(rx);
+		return;
+	}
+	if (!impl.mgmt.store_kick && mgmt_kick() == 0) impl.mgmt.store_kick = 1;
+	aloe_sem_post(&impl.mgmt.store_lock, NULL, "sinsvc2");
+}
+
+/** Cursor start from the tail, store_lock held. */
+static int cln_seg_attach(cln_t *cln) {
+	seg_t *seg;
+
+	if (!(seg = seg_tail(0))) return -1;
+	seg->ref++;
+	impl.mgmt.seg_cln++;
+	cln->seg = seg;
+	cln->seg_pos = seg->fb.lmt;
+	cln->seg_frm_rem = 0;
+	return 0;
+}
+
+/** Release segment not yet passed, store_lock held. */
+static void cln_seg_detach(cln_t *cln) {
+	seg_t *seg, *seg_next;
+
+	if (!cln->seg) return;
+	for (seg = cln->seg; seg; seg = seg_next) {
+		seg_next = TAILQ_NEXT(seg, qent);
+		seg_unref(seg);
+	}
+	impl.mgmt.seg_cln--;
+	cln->seg = NULL;
+}
+
+/**
+ * Move cursor forward, store_lock held.
+ *
+ * Header of segment frame not written to raw client, skipped here.
+ */
+static void cln_seg_fwd(cln_t *cln, size_t len) {
+	seg_t *seg;
+	dw_pkt2_t pkt;
+	size_t n;
+
+	while ((seg = cln->seg)) {
+		if (cln->seg_pos >= seg->fb.lmt || seg_foreign(seg, cln)) {
+			// the tail may grow
+			if (!TAILQ_NEXT(seg, qent)) break;
+			cln->seg = TAILQ_NEXT(seg, qent);
+			cln->seg_pos = 0;
+			seg_unref(seg);
+			continue;
+		}
+		if (cln->seg_frm_rem == 0) {
+			memcpy(&pkt, (char*)seg->fb.data + cln->seg_pos, pkt2_hdr_len);
+			if (!cln->framed) {
+				cln->seg_pos += pkt2_hdr_len;
+				cln->seg_frm_rem = pkt.len;
+				continue;
+			}
+			if (len <= 0) break;
+			cln->seg_frm_rem = pkt2_hdr_len + pkt.len;
+		}
+		if (len <= 0) break;
+		n = aloe_min(len, cln->seg_frm_rem);
+		cln->seg_pos += n;
+		cln->seg_frm_rem -= n;
+		len -= n;
+	}
+}
+
+/** Pending output, frame echoed to other client not count, store_lock held. */
+static int cln_seg_pending(cln_t *cln) {
+	seg_t *seg;
+	size_t pos = cln->seg_pos;
+
+	for (seg = cln->seg; seg; seg = TAILQ_NEXT(seg, qent), pos = 0) {
+		if (!seg_foreign(seg, cln) && pos < seg->fb.lmt) return 1;
+	}
+	return 0;
+}
+
+/**
+ * Write credit advertise and outward segment in place.
+ *
+ * Credit advertise placed at frame boundary.  Raw client take payload of
+ * each frame without header.
+ */
+static int cln_output(cln_t *cln) {
+	struct iovec iov[seg_cnt_max + 2];
+	int iov_cnt = 0, iov_resp = -1, r, i;
+	aloe_buf_t *fb = &cln->resp;
+	seg_t *seg;
+	size_t pos, n;
+
+	if ((aloe_sem_wait(&impl.mgmt.store_lock, NULL, aloe_dur_infinite,
+			"sinsvc2")) != 0) {
+		log_e("lock\n");
+		return 0;
+	}
+	seg = cln->seg;
+	pos = cln->seg_pos;
+
+	// finish the frame in progress
+	if (seg && cln->seg_frm_rem > 0) {
+		iov[iov_cnt].iov_base = (char*)seg->fb.data + pos;
+		iov[iov_cnt++].iov_len = cln->seg_frm_rem;
+		pos += cln->seg_frm_rem;
+	}
+	if (fb->lmt > fb->pos) {
+		iov_resp = iov_cnt;
+		iov[iov_cnt].iov_base = (char*)fb->data + fb->pos;
+		iov[iov_cnt++].iov_len = fb->lmt - fb->pos;
+	}
+	for ( ; seg && iov_cnt < (int)aloe_arraysize(iov);
+			seg = TAILQ_NEXT(seg, qent), pos = 0) {
+		if (seg_foreign(seg, cln)) continue;
+		if (cln->framed) {
+			if (seg->fb.lmt <= pos) continue;
+			iov[iov_cnt].iov_base = (char*)seg->fb.data + pos;
+			iov[iov_cnt++].iov_len = seg->fb.lmt - pos;
+			continue;
+		}
+		while (pos < seg->fb.lmt && iov_cnt < (int)aloe_arraysize(iov)) {
+			dw_pkt2_t pkt;
+
+			memcpy(&pkt, (char*)seg->fb.data + pos, pkt2_hdr_len);
+			pos += pkt2_hdr_len;
+			iov[iov_cnt].iov_base = (char*)seg->fb.data + pos;
+			iov[iov_cnt++].iov_len = pkt.len;
+			pos += pkt.len;
+		}
+	}
+	aloe_sem_post(&impl.mgmt.store_lock, NULL, "sinsvc2");
+
+	if (iov_cnt <= 0) return 0;
+
+	r = writev(cln->sock.fd, iov, iov_cnt);
+	if (r == 0) {
+#if 1
+		log_sockaddr("cln closed ", &cln->sock.sin);
+#endif
+		return -1;
+	}
+	if (r < 0) {
+		r = errno;
+		if (eno_wouldblock(r)) return 0;
+		log_e("svc client err: %d(0x%x)\n", r, r);
+		return -1;
+	}
+
+	if ((aloe_sem_wait(&impl.mgmt.store_lock, NULL, aloe_dur_infinite,
+			"sinsvc2")) != 0) {
+		log_e("lock\n");
+		return -1;
+	}
+	for (n = r, i = 0; i < iov_cnt && n > 0; i++) {
+		size_t len = aloe_min(n, iov[i].iov_len);
+
+		if (i == iov_resp) {
+			fb->pos += len;
+			aloe_buf_rewind(fb);
+		} else {
+			cln_seg_fwd(cln, len);
+			cln->st.acc_out += len;
+		}
+		n -= len;
+	}
+	aloe_sem_post(&impl.mgmt.store_lock, NULL, "sinsvc2");
+	return r;
+}
+
+/** Chain end left SPI, from SPI task. */
+static void cln_chain_end_done(void *args) {
+	cln_t *cln = (cln_t*)args;
+
+	aloe_atomic_store(&cln->chain_end_busy, 0);
+}
+
+/** Close the chain open to SPI, the bus wait for the rest otherwise. */
+static void cln_chain_end(cln_t *cln) {
+	if (!cln->chain_open) return;
+
+	// slot not reused while queued
+	if (aloe_atomic_load(&cln->chain_end_busy)) {
+		log_e("Sanity check chain end still queued\n");
+		return;
+	}
+
+	// empty part without more
+	memset(&cln->chain_end, 0, sizeof(cln->chain_end));
+	cln->chain_end.prio = cln->chain_prio;
+	cln->chain_end.chain = cln;
+	cln->chain_end.cb = &cln_chain_end_done;
+	cln->chain_end.cbarg = cln;
+	aloe_atomic_store(&cln->chain_end_busy, 1);
+	if (dw_spi2_add(&cln->chain_end) != 0) {
+		log_e("Failed end chain\n");
+		aloe_atomic_store(&cln->chain_end_busy, 0);
+	}
+	cln->chain_open = 0;
+}
+
+static void cln_gc(cln_t *cln) {
+	if (cln->seg) {
+		if ((aloe_sem_wait(&impl.mgmt.store_lock, NULL, aloe_dur_infinite,
+				"sinsvc2")) != 0) {
+			log_e("lock\n");
+		} else {
+			cln_seg_detach(cln);
+			aloe_sem_post(&impl.mgmt.store_lock, NULL, "sinsvc2");
+		}
+	}
+	if (cln->frm) {
+		if (cln->frm->flag & frm_flag_spi) {
+			// truncate the partial frame and the chain, spi callback recycle it
+			dw_spi2_req_wmk(&cln->frm->spi2_req, cln->frm->fb.pos, 1);
+			cln->chain_open = 0;
+		} else {
+			frm_put(cln->frm);
+		}
+		cln->frm = NULL;
+	}
+	cln_chain_end(cln);
+	cln->pkt_rem = 0;
+	sock_gc(&cln->sock);
+}
+
+/**
+ * Hand the frame to SPI.
+ *
+ * @param wmk Bytes already landed in the frame.
+ */
+static int cln_frm_dispatch(cln_t *cln, size_t wmk) {
+	dw_spi2_req_t *spi2_req;
+
+	spi2_req = &cln->frm->spi2_req;
+	spi2_req->data = cln->frm->fb.data;
+	spi2_req->seg = NULL;
+	spi2_req->sz = cln->frm->fb.lmt;
+	spi2_req->wmk = wmk;
+	if (!cln->chain_open) {
+		cln->chain_prio = sinsvc2_pkt2_prio(cln->pkthdr.tag);
+		cln->hold_ts = aloe_tick2ms(aloe_ticks());
+	}
+	spi2_req->prio = cln->chain_prio;
+	spi2_req->chain = cln;
+	spi2_req->more = cln->pkt_rem > 0
+			|| !(cln->pkthdr.tag & sinsvc2_pkt2_tag_e);
+	spi2_req->cb = &cln_frm_done;
+	spi2_req->cbarg = cln->frm;
+
+	if (dw_spi2_add(spi2_req) != 0) {
+		log_e("Failed add to spi\n");
+		return -1;
+	}
+	cln->chain_open = spi2_req->more;
+	cln->frm->flag |= frm_flag_spi;
+	cln->st.acc_frm_spi++;
+	return 0;
+}
+
+/** Record the frame just landed, stop capture when writer failed. */
+static void cln_frm_capture(cln_t *cln) {
+	int (*wr)(const void*, size_t, void*) = aloe_atomic_load(&impl.cap.wr);
+	dw_sinsvc2_trace_rec_t rec;
+	unsigned long dur = 0;
+
+	if (!wr) return;
+
+	if (!impl.cap.started) {
+		dw_sinsvc2_trace_t hdr = {
+			.magic = DW_SINSVC2_TRACE_MAGIC,
+			.ver = DW_SINSVC2_TRACE_VER,
+			.hdr_len = sizeof(hdr),
+		};
+
+		if ((*wr)(&hdr, sizeof(hdr), impl.cap.cbarg) != 0) goto failed;
+		impl.cap.started = 1;
+		impl.cap.ts = cln->frm->ts_rd;
+	}
+
+	// frame of other client may land late
+	if ((long)(cln->frm->ts_rd - impl.cap.ts) > 0) {
+		dur = cln->frm->ts_rd - impl.cap.ts;
+		impl.cap.ts = cln->frm->ts_rd;
+	}
+	rec.ts = (uint32_t)aloe_min(dur, (unsigned long)UINT32_MAX);
+	rec.cln = (uint16_t)(cln - impl.cln);
+	rec.rsv = 0;
+
+	// part of long frame recorded as fragment
+	rec.tag = cln->pkthdr.tag;
+	rec.len = cln->frm->fb.lmt;
+	if (rec.len + cln->pkt_rem < cln->pkthdr.len) {
+		rec.tag &= ~sinsvc2_pkt2_tag_s;
+	}
+	if (cln->pkt_rem > 0) rec.tag &= ~sinsvc2_pkt2_tag_e;
+	if ((*wr)(&rec, sizeof(rec), impl.cap.cbarg) != 0
+			|| (*wr)(cln->frm->fb.data, rec.len, impl.cap.cbarg) != 0) {
+		goto failed;
+	}
+	return;
+failed:
+	log_e("Failed write capture, stopped\n");
+	aloe_atomic_store(&impl.cap.wr, NULL);
+}
+
+/**
+ * Frame buffer take the next part of pkt2 payload, hand to SPI when
+ * cut-through.
+ */
+static int cln_frm_start(cln_t *cln) {
+	aloe_buf_t *fb = &cln->frm->fb;
+
+	fb->pos = 0;
+	fb->lmt = aloe_min(cln->pkt_rem, fb->cap);
+	cln->pkt_rem -= fb->lmt;
+
+#if sinsvc2_cut_through
+	if (cln_frm_dispatch(cln, 0) != 0) return -1;
+#endif
+	return 0;
+}
+
+/* payload limit of host to device control frame */
+#define sinsvc2_ctl_max 64
+
+/**
+ * Parse every complete header and payload in cln->recv to frame.
+ *
+ * Partial payload copied to frame buffer, partial header stay in cln->pkthdr.
+ * Payload longer than frame buffer continue in the next one.  Unparsed data
+ * remain in cln->recv when out of frame buffer.
+ *
+ * @return -1 when protocol error, otherwise 0
+ */
+static int cln_recv_parse(cln_t *cln) {
+	aloe_buf_t *recv = &cln->recv, *fb;
+	dw_pkt2_t *pkt = &cln->pkthdr;
+	size_t sz;
+	int r = 0;
+
+	while (recv->lmt > recv->pos) {
+		if (cln->ctl_rem > 0) {
+			// control payload not for SPI
+			sz = aloe_min(cln->ctl_rem, recv->lmt - recv->pos);
+			recv->pos += sz;
+			cln->ctl_rem -= sz;
+			continue;
+		}
+		if (!cln->frm) {
+			if (!(cln->frm = frm_pop(cln))) {
+//				log_d("out of frame buffer\n");
+				break;
+			}
+			_aloe_buf_clear(&cln->frm->fb);
+
+			if (cln->pkt_rem > 0) {
+				// rest of long frame
+				if (cln_frm_start(cln) != 0) {
+					r = -1;
+					break;
+				}
+			} else {
+				// prepared to read header
+				cln->pkt_lmt = 0;
+			}
+		}
+		fb = &cln->frm->fb;
+
+		if (cln->pkt_lmt < pkt2_hdr_len) {
+			// read header
+
+			sz = aloe_min(pkt2_hdr_len - cln->pkt_lmt, recv->lmt - recv->pos);
+			memcpy((char*)pkt + cln->pkt_lmt, (char*)recv->data + recv->pos, sz);
+			recv->pos += sz;
+			cln->pkt_lmt += sz;
+
+			if (cln->pkt_lmt < pkt2_hdr_len) {
+//				log_d("wait more for pkt2 hdr\n");
+				break;
+			}
+
+			// found header, prepare to read payload (frame)
+
+			if (pkt->tag & sinsvc2_pkt2_tag_credit) {
+				if (cln->chain_open || pkt->len > sinsvc2_ctl_max) {
+					log_e("invalid control frame\n");
+					r = -1;
+					break;
+				}
+				cln->framed = 1;
+				cln->ctl_rem = pkt->len;
+
+				// frame buffer for the next header
+				frm_put(cln->frm);
+				cln->frm = NULL;
+				continue;
+			}
+
+			pkt->tag = sinsvc2_pkt2_tag_norm(pkt->tag, cln->chain_open);
+
+			// s only for the first fragment
+			if (((pkt->tag & sinsvc2_pkt2_tag_s) != 0) == cln->chain_open) {
+				log_e("fragment out of order\n");
+				r = -1;
+				break;
+			}
+			if (pkt->len == 0) {
+				log_e("payload length zero\n");
+				r = -1;
+				break;
+			}
+			cln->pkt_rem = pkt->len;
+			if (cln_frm_start(cln) != 0) {
+				r = -1;
+				break;
+			}
+		}
+
+		if (fb->lmt == 0 || fb->pos >= fb->lmt) {
+			log_e("Sanity check, previous frame not process\n");
+			r = -1;
+			break;
+		}
+
+		sz = aloe_min(fb->lmt - fb->pos, recv->lmt - recv->pos);
+		memcpy((char*)fb->data + fb->pos, (char*)recv->data + recv->pos, sz);
+		recv->pos += sz;
+		fb->pos += sz;
+		if (fb->pos >= fb->lmt) cln->frm->ts_land = dw_ts_us();
+
+#if sinsvc2_cut_through
+		dw_spi2_req_wmk(&cln->frm->spi2_req, fb->pos, 0);
+#endif
+
+		if (fb->pos < fb->lmt) {
+//			log_d("wait more for pkt2 payload\n");
+			break;
+		}
+
+#if !sinsvc2_cut_through
+		if (cln_frm_dispatch(cln, fb->lmt) != 0) {
+			r = -1;
+			break;
+		}
+#endif
+		cln_frm_capture(cln);
+//		log_d("frame done\n");
+		cln->frm = NULL;
+	}
+	aloe_buf_rewind(recv);
+	return r;
+}
+
+static void svc_cln_act(sock_t *_sock, unsigned actype) {
+	cln_t *cln = aloe_container_of(_sock, cln_t, sock);
+	aloe_buf_t *fb;
+	int r = 0;
+
+	// the bus wait for nobody else
+	if (cln_holding(cln) && (long)(aloe_tick2ms(aloe_ticks())
+			- cln->hold_ts) >= (long)sinsvc2_hold_max_ms) {
+		log_sockaddr("cln hold SPI too long ", &_sock->sin);
+		r = -1;
+		goto finally;
+	}
+
+	if (actype & sel_tmr) {
+#if 1
+		log_sockaddr("cln timeout ", &_sock->sin);
+#endif
+		r = 0;
+		goto finally;
+	}
+
+	if (actype & sel_kick) {
+		// frame buffer returned, continue unparsed data
+		if ((r = cln_recv_parse(cln)) != 0) goto finally;
+		r = 0;
+	}
+
+	if (actype & sel_rd) {
+		fb = &cln->recv;
+
+		// read as much as possible in one call
+		if (fb->cap > fb->lmt) {
+			if ((r = sock_cln_recv(_sock, (char*)fb->data + fb->lmt,
+					fb->cap - fb->lmt)) <= 0) {
+				goto finally;
+			}
+			fb->lmt += r;
+			cln->st.acc += r;
+			cln->ts_rd = dw_ts_us();
+		}
+
+#if 1
+		// state network speed
+		{
+			unsigned long ts = aloe_tick2ms(aloe_ticks());
+			if (cln->st.ts_log == 0) cln->st.ts_log = ts;
+			if (ts - cln->st.ts_log >= 1000) {
+				// duration unit millisecond => result KBps
+				double r2, rd100;
+				int out, out100;
+
+				FPS_CALC1(cln->st.acc_out, ts - cln->st.ts_accept);
+				out = (int)r2;
+				out100 = (int)rd100;
+				FPS_CALC1(cln->st.acc, ts - cln->st.ts_accept);
+				log_d("data rate: %d.%02dKBps, out: %d.%02dKBps\n",
+						(int)r2, (int)rd100, out, out100);
+
+				cln->st.ts_log = aloe_tick2ms(aloe_ticks());
+			}
+		}
+#endif
+
+		if ((r = cln_recv_parse(cln)) != 0) goto finally;
+		r = 0;
+	}
+	if (actype & sel_wr) {
+		if ((r = cln_output(cln)) < 0) goto finally;
+		r = 0;
+	}
+finally:
+	if (r < 0) {
+		cln_gc(cln);
+	} else {
+		int credit = frm_credit(cln);
+
+		_sock->sel_req = 0;
+
+		// stop read when no credit or no room for more data, wait kick
+		fb = &cln->recv;
+		if ((cln->frm || credit > 0) && fb->cap > fb->lmt) {
+			_sock->sel_req |= sel_rd;
+		}
+
+		// data to send
+		cln_credit_adv(cln);
+		fb = &cln->resp;
+		if (fb->lmt > fb->pos) {
+			_sock->sel_req |= sel_wr;
+		} else if ((aloe_sem_wait(&impl.mgmt.store_lock, NULL,
+				aloe_dur_infinite, "sinsvc2")) == 0) {
+			if (cln_seg_pending(cln)) _sock->sel_req |= sel_wr;
+			aloe_sem_post(&impl.mgmt.store_lock, NULL, "sinsvc2");
+		}
+
+		// wake at the hold deadline
+		if (cln_holding(cln)) {
+			long due = (long)(cln->hold_ts + sinsvc2_hold_max_ms
+					- aloe_tick2ms(aloe_ticks()));
+
+			sock_tmr_arm(_sock, (unsigned long)aloe_max(due, 0l));
+		} else {
+			sock_tmr_arm(_sock, 10000ul);
+		}
+		sinsvc_sock_arm(_sock);
+	}
 }
 
 static void svc_accept(struct sock_rec *_sock, unsigned actype) {
 	svc_t *svc = NULL;
-	int i;
+	int i, r;
 
 	if ((_sock != &impl.svc.sock)) {
 		log_e("Sanity check invalid svc\n");
@@ -635,10 +1566,14 @@ static void svc_accept(struct sock_rec *_sock, unsigned actype) {
 	if (actype & sel_rd) {
 		cln_t *cln;
 
-		for (i = 0; i < (int)aloe_arraysize(impl.cln); i++) {
-			if (impl.cln[i].sock.fd == -1) break;
+		for (i = 0; i < impl.cln_cnt; i++) {
+			// chain end of the previous one still queued
+			if (impl.cln[i].sock.fd == -1
+					&& !aloe_atomic_load(&impl.cln[i].chain_end_busy)) {
+				break;
+			}
 		}
-		if (i >= (int)aloe_arraysize(impl.cln)) {
+		if (i >= impl.cln_cnt) {
 			log_e("all svc client slot busy\n");
 			sock_svr_reject(_sock->fd);
 			goto finally;
@@ -658,12 +1593,36 @@ static void svc_accept(struct sock_rec *_sock, unsigned actype) {
 #endif
 		memset(&cln->st, 0, sizeof(cln->st));
 		cln->st.ts_log = cln->st.ts_accept = aloe_tick2ms(aloe_ticks());
+
+		// outward data queued from now
+		if ((aloe_sem_wait(&impl.mgmt.store_lock, NULL, aloe_dur_infinite,
+				"sinsvc2")) != 0) {
+			log_e("lock\n");
+			cln_gc(cln);
+			goto finally;
+		}
+		r = impl.replay ? 1 : cln_seg_attach(cln);
+		aloe_sem_post(&impl.mgmt.store_lock, NULL, "sinsvc2");
+		if (r > 0) {
+			log_e("reject client while replay\n");
+			cln_gc(cln);
+			goto finally;
+		}
+		if (r != 0) {
+			log_e("Sanity check no segment\n");
+			cln_gc(cln);
+			goto finally;
+		}
+
+		// credit advertised once the host asked framed output
+		sinsvc_sock_arm(&cln->sock);
 	}
 
 finally:
 	if (svc) {
 		svc->sock.sel_req = sel_rd;
-		svc->sock.tdue = sock_tdue(10000);
+		sock_tmr_arm(&svc->sock, 10000ul);
+		sinsvc_sock_arm(&svc->sock);
 	}
 }
 
@@ -672,11 +1631,14 @@ static int svc_open(void) {
 
 	if (svc->sock.fd != -1) return 0;
 
+	// every client slot could connect at once
 	if (sock_svr_open(&svc->sock, DECKWIFI_SOCKET_SVC_PORT, SOCK_STREAM,
-			&svc_accept, 10000ul) != 0) {
+			aloe_min(impl.cln_cnt, SOMAXCONN), &svc_accept, 10000ul) != 0) {
 		return -1;
 	}
 
+	sinsvc_sock_arm(&svc->sock);
+
 #if 1
 	log_sockaddr("svc listen on ", &svc->sock.sin);
 #endif
@@ -684,159 +1646,249 @@ static int svc_open(void) {
 	return 0;
 }
 
+#if defined(ALOE_SYS_LINUX)
+/* poll interval when out of credit, and give up */
+#define sinsvc2_replay_wait_us 50
+#define sinsvc2_replay_stall_us 1000000ul
+
+/** Feed the trace posted by dw_sinsvc2_replay(), the task only. */
+static long sinsvc_replay_run(const char *trc, size_t trc_sz,
+		unsigned speed) {
+	int replaying = 0;
+	dw_sinsvc2_trace_t hdr;
+	dw_sinsvc2_trace_rec_t rec;
+	size_t pos;
+	unsigned long ts0, now;
+	unsigned long long due = 0, byte_cnt = 0;
+	long r = -1, frm_cnt = 0;
+	cln_t *cln;
+	int i;
+
+	memcpy(&hdr, trc, sizeof(hdr));
+
+	// frame buffer only for replay from now
+	if ((aloe_sem_wait(&impl.mgmt.store_lock, NULL, aloe_dur_infinite,
+			"sinsvc2")) != 0) {
+		log_e("lock\n");
+		goto finally;
+	}
+	if (impl.mgmt.seg_cln > 0) {
+		aloe_sem_post(&impl.mgmt.store_lock, NULL, "sinsvc2");
+		log_e("client connected\n");
+		goto finally;
+	}
+	impl.replay = replaying = 1;
+	aloe_sem_post(&impl.mgmt.store_lock, NULL, "sinsvc2");
+
+	// same clock as captured arrival
+	ts0 = dw_ts_us();
+	for (pos = hdr.hdr_len; pos + sizeof(rec) <= trc_sz;
+			pos += sizeof(rec) + rec.len) {
+		memcpy(&rec, trc + pos, sizeof(rec));
+		if (rec.len > trc_sz - pos - sizeof(rec)) {
+			log_e("trace truncated\n");
+			break;
+		}
+		if (rec.len == 0 || rec.len > impl.cfg.frm_sz) {
+			log_e("Invalid frame length %u\n", (unsigned)rec.len);
+			goto finally;
+		}
+
+		if (speed > 0) {
+			due += rec.ts;
+			if ((now = dw_ts_us() - ts0) < due * 100 / speed) {
+				aloe_thread_usleep(due * 100 / speed - now);
+			}
+		}
+
+		cln = &impl.cln[rec.cln % impl.cln_cnt];
+		cln->ts_rd = dw_ts_us();
+		while ((!cln->chain_open && aloe_atomic_load(&cln->chain_end_busy))
+				|| !(cln->frm = frm_pop(cln))) {
+			// frame of other client stuck behind open chain
+			if (dw_ts_us() - cln->ts_rd >= sinsvc2_replay_stall_us) {
+				log_e("replay stalled\n");
+				goto finally;
+			}
+			sinsvc_lat_drain();
+			aloe_thread_usleep(sinsvc2_replay_wait_us);
+		}
+		memcpy(cln->frm->fb.data, trc + pos + sizeof(rec), rec.len);
+		cln->frm->fb.pos = cln->frm->fb.lmt = rec.len;
+		cln->frm->ts_land = dw_ts_us();
+		cln->pkthdr.tag = sinsvc2_pkt2_tag_norm(rec.tag, cln->chain_open);
+		cln->pkthdr.len = rec.len;
+		cln->pkt_rem = 0;
+		if (cln_frm_dispatch(cln, rec.len) != 0) {
+			frm_put(cln->frm);
+			cln->frm = NULL;
+			goto finally;
+		}
+		cln->frm = NULL;
+		frm_cnt++;
+		byte_cnt += rec.len;
+		sinsvc_lat_drain();
+	}
+	now = (dw_ts_us() - ts0) / 1000;
+	log_d("replay frame: %ld, bytes: %llu, %lums, %.2fKBps\n", frm_cnt,
+			byte_cnt, now, now > 0 ? (double)byte_cnt / now : 0.0);
+	r = frm_cnt;
+finally:
+	if (replaying) {
+		// trace end in the middle of message
+		for (i = 0; i < impl.cln_cnt; i++) cln_chain_end(&impl.cln[i]);
+		aloe_sem_wait(&impl.mgmt.store_lock, NULL, aloe_dur_infinite,
+				"sinsvc2");
+		impl.replay = 0;
+		aloe_sem_post(&impl.mgmt.store_lock, NULL, "sinsvc2");
+	}
+	return r;
+}
+#endif
+
 static void mgmt_close(void) {
 	mgmt_t *mgmt = &impl.mgmt;
 
+	if (mgmt->sock.fd != -1) sock_gc(&mgmt->sock);
 	mgmt->sock.act = NULL;
 
 	log_d("mgmt closed\n");
 }
 
 static void mgmt_act(struct sock_rec *_sock, unsigned actype) {
-	char f_locked = 0;
-	int r = 0;
-	aloe_buf_t *store = &impl.mgmt.store;
+	int r = 0, cln_idx;
+	cln_t *cln;
 
 	if ((_sock != &impl.mgmt.sock)) {
 		log_e("Sanity check invalid mgmt\n");
 		return;
 	}
 
-	if (actype & sel_tmr) {
-		r = 0;
-//		log_d("mgmt not busy\n");
-		goto finally;
-	}
-
-	if (actype & sel_rd) {
+	// timeout also flush segment in case kick lost
+	if (actype & (sel_rd | sel_tmr)) {
+		char evt[16];
 
-#if 0
 		// drain the event
-		mgmt_event_gc(sel_rd);
+		if (actype & sel_rd) {
+			while (recv(_sock->fd, evt, sizeof(evt), 0) > 0);
+		}
+
+#if defined(ALOE_SYS_LINUX)
+		if (aloe_atomic_load(&impl.rply.pending)) {
+			impl.rply.r = sinsvc_replay_run(impl.rply.trc, impl.rply.trc_sz,
+					impl.rply.speed);
+			aloe_atomic_store(&impl.rply.pending, 0);
+			aloe_sem_post(impl.rply.done, NULL, "sinsvc2rply");
+		}
 #endif
 
-		if (!f_locked) {
-			if ((aloe_sem_wait(&impl.mgmt.store_lock, NULL, aloe_dur_infinite,
-					"sinsvc2")) != 0) {
-				log_e("lock\n");
-				r = 0;
-				goto finally;
-			}
-			f_locked = 1;
+		if (aloe_atomic_load(&impl.latd.pending)) {
+			sinsvc_lat_log(impl.latd.reset);
+			aloe_atomic_store(&impl.latd.pending, 0);
+			aloe_sem_post(impl.latd.done, NULL, "sinsvc2lat");
 		}
 
-		// move data to cln
-		if (store->lmt > store->pos) {
-			int cln_idx, rlen = store->lmt - store->pos;
-			int drain_min = -1, drain_max = 0;
-			void *rdata = (char*)store->data + store->pos;
-			cln_t *cln;
-			aloe_buf_t *fb;
-
-			for (cln_idx = 0; cln_idx < cln_cnt; cln_idx++) {
-				int wlen;
-
-				cln = &impl.cln[cln_idx];
-
-				if (cln->sock.fd == -1) continue;
-
-				// any client avaliable
-				fb = &cln->resp;
-				wlen = fb->cap - fb->lmt;
-				if (wlen > rlen) wlen = rlen;
-				if (wlen > 0) {
-					memcpy((char*)fb->data + fb->lmt, rdata, wlen);
-					fb->lmt += wlen;
-
-					if (drain_min < 0) {
-						drain_min = drain_max = wlen;
-					} else {
-						if (wlen < drain_min) drain_min = wlen;
-						if (wlen > drain_max) drain_max = wlen;
-					}
-				}
-			}
+		// resume client stopped reading
+		for (cln_idx = 0; cln_idx < impl.cln_cnt; cln_idx++) {
+			cln = &impl.cln[cln_idx];
+			if (cln->sock.fd == -1) continue;
 
-			if (drain_min < 0) {
-				log_e("no cln, drain all\n");
-				store->pos = store->lmt;
-			} else {
-				if (drain_min != drain_max) {
-					log_e("cln might lost data\n");
-				}
-				store->pos += drain_max;
-			}
-			aloe_buf_rewind(store);
-
-			// still hold lock
-			if (store->lmt > store->pos) {
-//				mgmt_kick();
-			}
+			svc_cln_act(&cln->sock, sel_kick);
+		}
 
-			aloe_sem_post(&impl.mgmt.store_lock, NULL, "sinsvcmgmttx");
-			f_locked = 0;
+		if ((aloe_sem_wait(&impl.mgmt.store_lock, NULL, aloe_dur_infinite,
+				"sinsvc2")) != 0) {
+			log_e("lock\n");
+			r = 0;
+			goto finally;
+		}
+		impl.mgmt.store_kick = 0;
+		aloe_sem_post(&impl.mgmt.store_lock, NULL, "sinsvc2");
 
-			// kick client do output
-			for (cln_idx = 0; cln_idx < cln_cnt; cln_idx++) {
-				cln = &impl.cln[cln_idx];
-				if (cln->sock.fd == -1) continue;
+		// client write from segment by own cursor
+		for (cln_idx = 0; cln_idx < impl.cln_cnt; cln_idx++) {
+			cln = &impl.cln[cln_idx];
+			if (cln->sock.fd == -1) continue;
 
-				svc_cln_act(&cln->sock, sel_wr);
-			}
+			svc_cln_act(&cln->sock, sel_wr);
 		}
 		r = 0;
 	}
 finally:
-	if (f_locked) aloe_sem_post(&impl.mgmt.store_lock, NULL, "sinsvcmgmttx");
 	if (r < 0) {
 		mgmt_close();
 	} else {
 		_sock->sel_req = sel_rd;
-		_sock->tdue = sock_tdue(10000);
+		sock_tmr_arm(_sock, 10000ul);
+		sinsvc_sock_arm(_sock);
 	}
 }
 
+/** Loopback udp connected to itself, lwip not support pipe(). */
 static int mgmt_open(void) {
 	mgmt_t *mgmt = &impl.mgmt;
+	socklen_t sin_len = sizeof(mgmt->sock.sin);
+
+	if (mgmt->sock.fd != -1) return 0;
 
-	if (mgmt->sock.act) return 0;
+	if ((mgmt->sock.fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+		log_e("create socket\n");
+		return -1;
+	}
+
+	memset(&mgmt->sock.sin, 0, sizeof(mgmt->sock.sin));
+	mgmt->sock.sin.sin_family = AF_INET;
+	mgmt->sock.sin.sin_port = 0;
+	mgmt->sock.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(mgmt->sock.fd, (struct sockaddr*)&mgmt->sock.sin,
+			sizeof(mgmt->sock.sin)) != 0
+			|| getsockname(mgmt->sock.fd, (struct sockaddr*)&mgmt->sock.sin,
+					&sin_len) != 0
+			|| connect(mgmt->sock.fd, (struct sockaddr*)&mgmt->sock.sin,
+					sin_len) != 0) {
+		log_e("bind loopback error\n");
+		fd_gc(mgmt->sock.fd);
+		return -1;
+	}
+
+	if (fd_nbio(mgmt->sock.fd) != 0) {
+		log_e("Failed set nonblock\n");
+		fd_gc(mgmt->sock.fd);
+		return -1;
+	}
 
 	mgmt->sock.sel_req = sel_rd;
-	mgmt->sock.tdue = sock_tdue(10000ul);
+	sock_tmr_arm(&mgmt->sock, 10000ul);
 	mgmt->sock.act = &mgmt_act;
+	sinsvc_sock_arm(&mgmt->sock);
 
 	log_d("mgmt opened\n");
 	return 0;
 }
 
-static int sinsvc_sock_sel(sock_t *sock, unsigned long ts0, unsigned long *tdue) {
-
-	if (ts0 == aloe_dur_infinite) ts0 = aloe_tick2ms(aloe_ticks());
+static int sinsvc_close_all(void) {
+	int i;
 
-	if (sock->fd != -1) {
-		sinsvc_fds(sock);
-		sinsvc_tdue(*tdue, ts0, sock->tdue);
-		return 1;
+	// client also release frame and segment
+	for (i = 0; i < impl.cln_cnt; i++) {
+		if (impl.cln[i].sock.fd != -1) cln_gc(&impl.cln[i]);
 	}
+	if (impl.svc.sock.fd != -1) sock_gc(&impl.svc.sock);
+	if (impl.mgmt.sock.fd != -1) sock_gc(&impl.mgmt.sock);
+	impl.launched = 0;
 	return 0;
 }
 
-static int sinsvc_sock_act(sock_t *sock, unsigned long ts1) {
-	unsigned sel = 0;
+static int sinsvc_sock_act(sock_t *sock, unsigned sel) {
 
-	if (ts1 == aloe_dur_infinite) ts1 = aloe_tick2ms(aloe_ticks());
-
-	if (sock->fd != -1) {
-		sinsvc_sel(&sel, sock);
-	}
-
-	// timeout iff no sock action
-	if ((sel == 0) && sinsvc_ts_tdue(ts1, sock->tdue)) sel |= sel_tmr;
+	// closed by previous action
+	if (sock->fd == -1) sel = 0;
 
 	if (sel && sock->act) {
 		// clear trigger
 		sock->sel_req = 0;
-		sock->tdue = aloe_dur_infinite;
+		aloe_tmwheel_cancel(&impl.tmw, &sock->tmr);
 
 		(*sock->act)(sock, sel);
 		return 1;
@@ -845,14 +1897,18 @@ static int sinsvc_sock_act(sock_t *sock, unsigned long ts1) {
 }
 
 static void sinsvc_task(aloe_thread_t *args) {
-	unsigned long ts0, ts1, tdue;
-	struct timeval _tv, *tv;
+	unsigned long ts0, ts1, tdue, dur;
+	aloe_tmr_t *tmr;
 	int r, i;
 	char buf[50];
 
 	(void)args;
 
-	log_d("sinsvc2 task run, frm_req_sz: %dKB\n", frm_req_sz / 1024);
+	log_d("sinsvc2 task run, frm_sz: %u, frm_cnt: %d (quota: %u, shared: %u), "
+			"cln_cnt: %d, seg: %u x %u, event backend: %s\n",
+			impl.cfg.frm_sz, impl.frm_cnt, impl.cfg.frm_quota,
+			impl.cfg.frm_shared, impl.cln_cnt, impl.cfg.seg_cnt,
+			impl.cfg.seg_sz, impl.ev.ops->name);
 
 	while (!impl.quit) {
 		if (!impl.launched) {
@@ -870,206 +1926,493 @@ static void sinsvc_task(aloe_thread_t *args) {
 		}
 		impl.launched = 1;
 
-		FD_ZERO(&impl.fds_rd);
-		FD_ZERO(&impl.fds_wr);
-		FD_ZERO(&impl.fds_ex);
-		impl.fds_mx = -1;
 		ts0 = aloe_tick2ms(aloe_ticks());
 
-		// socket poll infinite bad?
-		tdue = ts0 + 10000;
-
-		// svc and client
-		sinsvc_sock_sel(&impl.svc.sock, ts0, &tdue);
-		for (i = 0; i < (int)aloe_arraysize(impl.cln); i++) {
-			sinsvc_sock_sel(&impl.cln[i].sock, ts0, &tdue);
+		// socket poll infinite bad?, signed difference when counter wrap
+		if ((tdue = aloe_tmwheel_next(&impl.tmw)) == aloe_dur_infinite
+				|| (long)(tdue - ts0) > 10000) {
+			tdue = ts0 + 10000;
 		}
 
+		if ((long)(tdue - ts0) <= 0) {
+			dur = 0;
 #if 0
-		// mgmt
-		sinsvc_sock_sel(&impl.mgmt.sock, ts0, &tdue);
-#endif
-
-		if (impl.fds_mx == -1) {
-			log_d("no socket avaliable\n");
-			aloe_thread_sleep(1000);
-			continue;
-		}
-
-		if (tdue == aloe_dur_infinite) {
-			tv = NULL;
-			log_e("Sanity check socket poll infinite\n");
-#if 1
-		} else if (tdue <= ts0) {
-			tv = &_tv;
-			tv->tv_sec = 0;
-			tv->tv_usec = 0;
 			log_d("socket poll immediately\n");
 #endif
-		} else if (tdue <= (ts0 + 100)) {
+		} else if ((long)(tdue - ts0) <= 100) {
 			// at least 100ms
-			tv = &_tv;
-			tv->tv_sec = 0;
-			tv->tv_usec = 100000;
+			dur = 100;
 		} else {
-			tv = &_tv;
-			tv->tv_sec = (tdue - ts0) / 1000; // ms to sec
-			tv->tv_usec = ((tdue - ts0) % 1000) * 1000; // ms to us
+			dur = tdue - ts0;
 		}
 
-		if ((r = select(impl.fds_mx + 1, &impl.fds_rd, &impl.fds_wr,
-						&impl.fds_ex, tv)) < 0) {
+		if ((r = dw_sockev_wait(&impl.ev, dur, impl.ev_res,
+				impl.sock_cnt)) < 0) {
 			r = errno;
 			if (r == EINTR) {
 //				log_d("eintr\n");
 				aloe_thread_sleep(500);
 			} else {
-				log_e("select failed\n");
+				log_e("event wait failed\n");
 				impl.launched = 0;
 				aloe_thread_sleep(5000);
 			}
 			continue;
 		}
-//		if (r == 0) {
-//			// no trigger
-//		}
 
 		ts1 = aloe_tick2ms(aloe_ticks());
 
-		// svc and client act
-		sinsvc_sock_act(&impl.svc.sock, ts1);
-		for (i = 0; i < (int)aloe_arraysize(impl.cln); i++) {
-			sinsvc_sock_act(&impl.cln[i].sock, ts1);
+		// only ready socket
+		for (i = 0; i < r; i++) {
+			sinsvc_sock_act((sock_t*)impl.ev_res[i].ctx, impl.ev_res[i].sel);
 		}
 
-#if 0
-		// mgmt act
-		sinsvc_sock_act(&impl.mgmt.sock, ts1);
-#endif
+		// timeout iff no sock action, those acted re-armed
+		while ((tmr = aloe_tmwheel_expire(&impl.tmw, ts1))) {
+			sinsvc_sock_act(aloe_container_of(tmr, sock_t, tmr), sel_tmr);
+		}
+
+		sinsvc_lat_drain();
+	}
+}
+
+/** Client array, client buffer and segment pool. */
+#define sinsvc2_cln_sz(_cfg) ( \
+		sizeof(cln_t) * (_cfg)->cln_cnt \
+		+ (sizeof(sock_t*) + sizeof(dw_sockev_res_t)) * (2 + (_cfg)->cln_cnt) \
+		+ 32 + ((_cfg)->recv_sz + (_cfg)->resp_sz) * (_cfg)->cln_cnt)
+#define sinsvc2_fixed_sz(_cfg) (sinsvc2_cln_sz(_cfg) \
+		+ sizeof(aloe_pool_t) \
+		+ aloe_pool_size(seg_hdr_sz + (_cfg)->seg_sz, (_cfg)->seg_cnt, 32) \
+		+ sizeof(aloe_pool_t) + aloe_pool_size(sizeof(seg_t), seg_rx_cnt, 8) \
+		+ sizeof(aloe_pool_t) + 32)
+
+/** Frame pool object and the free list entry. */
+#define sinsvc2_frm_unit(_cfg) \
+		(frm_hdr_sz + (_cfg)->frm_sz + sizeof(uint16_t))
+
+/* bound of auto sizing */
+#define sinsvc2_autosz_quota_max 16
+#define sinsvc2_autosz_shared_max 32
+
+/**
+ * Fill the quota and shared region left 0 from frame budget, shared take one
+ * client share and the remainder.
+ */
+static int sinsvc2_frm_split(dw_sinsvc2_cfg_t *cfg, unsigned frm_cnt,
+		unsigned quota_max, unsigned shared_max) {
+	unsigned quota, shared;
+
+	shared = cfg->frm_shared ? cfg->frm_shared :
+			aloe_min(frm_cnt / (cfg->cln_cnt + 1), shared_max);
+	quota = cfg->frm_quota ? cfg->frm_quota :
+			aloe_min((frm_cnt - aloe_min(shared, frm_cnt)) / cfg->cln_cnt,
+			quota_max);
+	if (quota < 1) {
+		log_e("Not enough frame buffer %u for %d client\n", frm_cnt,
+				cfg->cln_cnt);
+		return -1;
+	}
+	if (cfg->frm_shared == 0 && frm_cnt > quota * cfg->cln_cnt) {
+		shared = aloe_min(frm_cnt - quota * cfg->cln_cnt, shared_max);
+	}
+	cfg->frm_quota = quota;
+	cfg->frm_shared = shared;
+	return 0;
+}
+
+/** Frame budget from the largest free block. */
+static int sinsvc2_autosz(dw_sinsvc2_cfg_t *cfg) {
+	size_t avail, fixed, frm_cnt;
 
+	avail = aloe_mem_avail(aloe_mem_id_psram) / cfg->autosz;
+	fixed = sinsvc2_fixed_sz(cfg);
+	if (avail <= fixed) {
+		log_e("Not enough memory, %lu less than %lu\n",
+				(unsigned long)avail, (unsigned long)fixed);
+		return -1;
 	}
+	frm_cnt = (avail - fixed) / sinsvc2_frm_unit(cfg);
+	if (sinsvc2_frm_split(cfg, (unsigned)aloe_min(frm_cnt, (size_t)UINT_MAX),
+			sinsvc2_autosz_quota_max, sinsvc2_autosz_shared_max) != 0) {
+		return -1;
+	}
+	log_d("autosz avail: %lu, frame budget: %lu\n",
+			(unsigned long)avail, (unsigned long)frm_cnt);
+	return 0;
+}
+
+/** Resolve default and check range, sizes round up keep 32 alignment. */
+static int sinsvc2_cfg_resolve(dw_sinsvc2_cfg_t *cfg) {
+	if (cfg->cln_cnt <= 0) cfg->cln_cnt = sinsvc2_cln_cnt_def;
+	if (cfg->frm_sz == 0) cfg->frm_sz = frm_req_sz;
+	if (cfg->recv_sz == 0) cfg->recv_sz = cln_recv_sz;
+	if (cfg->resp_sz == 0) cfg->resp_sz = cln_resp_sz;
+	if (cfg->seg_sz == 0) cfg->seg_sz = seg_sz_def;
+	if (cfg->seg_cnt == 0) cfg->seg_cnt = seg_cnt_def;
+	cfg->frm_sz = aloe_roundup(cfg->frm_sz, 32);
+	cfg->recv_sz = aloe_roundup(cfg->recv_sz, 32);
+	cfg->resp_sz = aloe_roundup(cfg->resp_sz, 32);
+	cfg->seg_sz = aloe_roundup(cfg->seg_sz, 32);
+
+	if (cfg->autosz) {
+		if (sinsvc2_autosz(cfg) != 0) return -1;
+	} else if (cfg->frm_quota == 0 || cfg->frm_shared == 0) {
+		if (cfg->frm_cnt == 0) {
+			cfg->frm_cnt = frm_req_quota * cfg->cln_cnt + frm_req_shared;
+		}
+		if (sinsvc2_frm_split(cfg, cfg->frm_cnt, UINT_MAX, UINT_MAX) != 0) {
+			return -1;
+		}
+	}
+	cfg->frm_cnt = cfg->frm_quota * cfg->cln_cnt + cfg->frm_shared;
+
+	if (cfg->frm_sz < 256 || cfg->frm_sz > 1024 * 1024) {
+		log_e("Invalid frame size %u\n", cfg->frm_sz);
+		return -1;
+	}
+	if (cfg->recv_sz < 1024) {
+		log_e("Invalid receive size %u\n", cfg->recv_sz);
+		return -1;
+	}
+	if (cfg->resp_sz < pkt2_hdr_len + sizeof(uint32_t)
+			|| cfg->resp_sz > cfg->recv_sz) {
+		log_e("Invalid response size %u\n", cfg->resp_sz);
+		return -1;
+	}
+	if (cfg->seg_sz < 256 || cfg->seg_cnt < 2 || cfg->seg_cnt > seg_cnt_max) {
+		log_e("Invalid segment %u x %u\n", cfg->seg_cnt, cfg->seg_sz);
+		return -1;
+	}
+	return 0;
+}
+
+/** Release memory taken in dw_sinsvc2_init(). */
+static void sinsvc2_mem_free(void) {
+	aloe_pool_destroy(impl.frm_pool);
+	aloe_pool_destroy(impl.mgmt.seg_rx_pool);
+	aloe_pool_destroy(impl.mgmt.seg_pool);
+	if (impl.xfer_alloc) aloe_mem_free(impl.xfer_alloc);
 }
 
 ALOE_SYS_TEXT1_SECTION
-int dw_sinsvc2_init(void) {
+int dw_sinsvc2_init(const dw_sinsvc2_cfg_t *cfg) {
 	int i;
 	cln_t *cln;
 	frm_req_t *frm_req;
+	seg_t *seg;
+	char *buf;
+	dw_sinsvc2_cfg_t geo = {};
 
 	if (impl.ready) {
 		log_e("alread initialized\n");
 		return -1;
 	}
 
+	if (cfg) geo = *cfg;
+	if (sinsvc2_cfg_resolve(&geo) != 0) return -1;
+
 	memset(&impl, 0, sizeof(impl));
-	TAILQ_INIT(&impl.frm_list);
+	impl.cfg = geo;
+	TAILQ_INIT(&impl.mgmt.seg_list);
+	aloe_tmwheel_init(&impl.tmw, impl.tmw_slot, sinsvc_tmw_slot_cnt,
+			sinsvc_tmw_res, aloe_tick2ms(aloe_ticks()));
 
-	impl.sock_list[0] = &impl.svc.sock;
-	impl.sock_list[1] = &impl.mgmt.sock;
-	for (i = 0; i < cln_cnt; i++) impl.sock_list[2 + i] = &impl.cln[i].sock;
-	for (i = 0; i < sock_cnt; i++) impl.sock_list[i]->fd = -1;
+	impl.cln_cnt = impl.cfg.cln_cnt;
+	impl.sock_cnt = 1 + 1 + impl.cln_cnt;
+	impl.frm_cnt = impl.cfg.frm_cnt;
+
+	if (impl.frm_cnt > aloe_pool_cnt_max) {
+		log_e("Too many frame buffer %d\n", impl.frm_cnt);
+		return -1;
+	}
+
+	/*
+	 * Frame (frm_req_t, 32 align, data), segment (seg_t, 32 align, data)
+	 * and seg_t linking SPI received frame each in the pool.
+	 */
+	if (!(impl.frm_pool = aloe_pool_create(aloe_mem_id_psram,
+			frm_hdr_sz + impl.cfg.frm_sz, impl.frm_cnt, 32, "sinsvc2_frm"))
+			|| !(impl.mgmt.seg_pool = aloe_pool_create(aloe_mem_id_psram,
+			seg_hdr_sz + impl.cfg.seg_sz, impl.cfg.seg_cnt, 32,
+			"sinsvc2_seg"))
+			|| !(impl.mgmt.seg_rx_pool = aloe_pool_create(aloe_mem_id_psram,
+			sizeof(seg_t), seg_rx_cnt, 8, "sinsvc2_seg_rx"))) {
+		log_e("alloc pool\n");
+		sinsvc2_mem_free();
+		return -1;
+	}
+
+	/*
+	 * cln_t[cln_cnt], sock_t*[sock_cnt], dw_sockev_res_t[sock_cnt],
+	 * 32 align, (cln recv, cln resp)[cln_cnt]
+	 */
 	if (!(impl.xfer_alloc = (void*)aloe_mem_malloc(aloe_mem_id_psram,
-			32 + mgmt_sz
-			+ (cln_recv_sz + cln_resp_sz) * cln_cnt
-			+ 32 + (sizeof(frm_req_t) + frm_req_sz) * frm_req_cnt,
-			"sinsvc2"))) {
+			sinsvc2_cln_sz(&impl.cfg), "sinsvc2"))) {
 		log_e("alloc buffer\n");
+		sinsvc2_mem_free();
 		return -1;
 	}
 
-	// 32 align
-	impl.xfer = (void*)aloe_roundup((unsigned long)impl.xfer_alloc, 32);
+	buf = (char*)impl.xfer_alloc;
+	impl.cln = (cln_t*)buf;
+	memset(impl.cln, 0, sizeof(cln_t) * impl.cln_cnt);
+	buf += sizeof(cln_t) * impl.cln_cnt;
+
+	impl.sock_list = (sock_t**)buf;
+	buf += sizeof(sock_t*) * impl.sock_cnt;
 
-	impl.mgmt.store.data = (char*)impl.xfer;
-	impl.mgmt.store.cap = mgmt_sz;
+	impl.ev_res = (dw_sockev_res_t*)buf;
+	buf += sizeof(dw_sockev_res_t) * impl.sock_cnt;
+
+	impl.sock_list[0] = &impl.svc.sock;
+	impl.sock_list[1] = &impl.mgmt.sock;
+	for (i = 0; i < impl.cln_cnt; i++) impl.sock_list[2 + i] = &impl.cln[i].sock;
+	for (i = 0; i < impl.sock_cnt; i++) {
+		impl.sock_list[i]->fd = impl.sock_list[i]->ev_fd = -1;
+	}
 
-	cln = &impl.cln[0];
-	cln->recv.data = (char*)impl.mgmt.store.data + impl.mgmt.store.cap;
-	cln->recv.cap = cln_recv_sz;
-	cln->resp.data = (char*)cln->recv.data + cln->recv.cap;
-	cln->resp.cap = cln_resp_sz;
-	for (i = 1; i < cln_cnt; i++) {
-		cln_t *cln_prev = &impl.cln[i - 1];
+	// 32 align
+	impl.xfer = (void*)aloe_roundup((unsigned long)buf, 32);
+	buf = (char*)impl.xfer;
 
+	for (i = 0; i < impl.cln_cnt; i++) {
 		cln = &impl.cln[i];
-		cln->recv.data = (char*)cln_prev->resp.data + cln_prev->resp.cap;
-		cln->recv.cap = cln_recv_sz;
-		cln->resp.data = (char*)cln->recv.data + cln->recv.cap;
-		cln->resp.cap = cln_resp_sz;
+		cln->recv.data = buf;
+		cln->recv.cap = impl.cfg.recv_sz;
+		buf += cln->recv.cap;
+		cln->resp.data = buf;
+		cln->resp.cap = impl.cfg.resp_sz;
+		buf += cln->resp.cap;
 	}
 
-	// here cln pointer to last valid item
-	frm_req = (frm_req_t*)((char*)cln->resp.data + cln->resp.cap);
-	frm_req[0].fb.data = (void*)aloe_roundup((unsigned long)&frm_req[frm_req_cnt], 32);
-	frm_req[0].fb.cap = frm_req_sz;
-	TAILQ_INSERT_TAIL(&impl.frm_list, &frm_req[0].spi2_req, qent);
-	for (i = 1; i < frm_req_cnt; i++) {
-		frm_req[i].fb.data = (char*)frm_req[i - 1].fb.data + frm_req[i - 1].fb.cap;
-		frm_req[i].fb.cap = frm_req_sz;
-		TAILQ_INSERT_TAIL(&impl.frm_list, &frm_req[i].spi2_req, qent);
+	// data pointer fixed for the life of the object
+	for (i = 0; i < impl.frm_cnt; i++) {
+		frm_req = (frm_req_t*)aloe_pool_obj(impl.frm_pool, i);
+		memset(frm_req, 0, sizeof(*frm_req));
+		frm_req->fb.data = (char*)frm_req + frm_hdr_sz;
+		frm_req->fb.cap = impl.cfg.frm_sz;
+	}
+	for (i = 0; i < (int)impl.cfg.seg_cnt; i++) {
+		seg = (seg_t*)aloe_pool_obj(impl.mgmt.seg_pool, i);
+		memset(seg, 0, sizeof(*seg));
+		seg->fb.data = (char*)seg + seg_hdr_sz;
+		seg->fb.cap = impl.cfg.seg_sz;
+	}
+	for (i = 0; i < seg_rx_cnt; i++) {
+		memset(aloe_pool_obj(impl.mgmt.seg_rx_pool, i), 0, sizeof(seg_t));
 	}
 
-	if (aloe_sem_init(&impl.frm_lock, 1, 1, "sinsvc2") != 0) {
-		log_e("Failed init lock\n");
-		aloe_mem_free(impl.xfer_alloc);
+	if (dw_sockev_init(&impl.ev, dw_sockev_ops_def, impl.sock_cnt) != 0) {
+		log_e("Failed init event backend\n");
+		sinsvc2_mem_free();
 		return -1;
 	}
 
 	if (aloe_sem_init(&impl.mgmt.store_lock, 1, 1, "sinsvc2") != 0) {
 		log_e("Failed init lock\n");
-		aloe_sem_destroy(&impl.frm_lock);
-		aloe_mem_free(impl.xfer_alloc);
+		dw_sockev_destroy(&impl.ev);
+		sinsvc2_mem_free();
 		return -1;
 	}
 
+	// latency trace not essential
+	if ((impl.lat = (sinsvc2_lat_t*)aloe_mem_malloc(aloe_mem_id_psram,
+			sizeof(*impl.lat), "sinsvc2_lat"))) {
+		memset(impl.lat, 0, sizeof(*impl.lat));
+		aloe_spsc_init(&impl.lat->free, impl.lat->free_ent,
+				sinsvc2_lat_ring_cnt);
+		aloe_spsc_init(&impl.lat->full, impl.lat->full_ent,
+				sinsvc2_lat_ring_cnt);
+		for (i = 0; i < sinsvc2_lat_ring_cnt; i++) {
+			aloe_spsc_push(&impl.lat->free, &impl.lat->rec[i]);
+		}
+	} else {
+		log_e("Failed alloc latency trace\n");
+	}
+
 	if (aloe_thread_run(&impl.tsk,
 			&sinsvc_task,
 			4096, DECKWIFI_THREAD_PRIO_SINSVC, "sinsvc2") != 0) {
 		log_e("Failed start sinsvc2 thread\n");
+		if (impl.lat) aloe_mem_free(impl.lat);
 		aloe_sem_destroy(&impl.mgmt.store_lock);
-		aloe_sem_destroy(&impl.frm_lock);
-		aloe_mem_free(impl.xfer_alloc);
+		dw_sockev_destroy(&impl.ev);
+		sinsvc2_mem_free();
 		return -1;
 	}
 	impl.ready = 1;
+
+	// reverse direction
+	if (dw_spi2_rx_start(&sinsvc_spi_rx, NULL) != 0) {
+		log_e("Failed start SPI receive\n");
+	}
 	return 0;
 }
 
 int dw_sinsvc2_send(const void *data, size_t size) {
 	int r = -1;
-	aloe_buf_t *fb = &impl.mgmt.store;
+	aloe_buf_t *fb;
+	seg_t *seg;
+	dw_pkt2_t pkt;
 
 	if (impl.mgmt.sock.fd == -1) {
 		log_e("mgmt not open\n");
 		return -1;
 	}
+	// whole frame in one segment
+	if (size + pkt2_hdr_len > impl.cfg.seg_sz) {
+		log_e("payload length too large\n");
+		return -1;
+	}
 	if ((aloe_sem_wait(&impl.mgmt.store_lock, NULL, -1, "sinsvc2")) != 0) {
 		log_e("lock\n");
 		return -1;
 	}
-	if (fb->cap - fb->lmt < size) {
+	if (impl.mgmt.seg_cln <= 0) {
+//		log_d("no cln, drain all\n");
+		r = size;
+		goto finally;
+	}
+	// slowest client hold the head
+	if (!(seg = seg_tail(size + pkt2_hdr_len))) {
 		log_e("buf full\n");
 		r = -1;
 		goto finally;
 	}
+	fb = &seg->fb;
+	pkt.tag = sinsvc2_pkt2_tag_s | sinsvc2_pkt2_tag_e;
+	pkt.len = size;
+	memcpy((char*)fb->data + fb->lmt, &pkt, pkt2_hdr_len);
+	fb->lmt += pkt2_hdr_len;
 	memcpy((char*)fb->data + fb->lmt, data, size);
 	fb->lmt += size;
 
-#if 0
-	mgmt_kick();
-#endif
+	// wake the task once for all data queued before it run
+	if (!impl.mgmt.store_kick && mgmt_kick() == 0) impl.mgmt.store_kick = 1;
 	r = size;
 finally:
 	aloe_sem_post(&impl.mgmt.store_lock, NULL, "sinsvc2");
 	return r;
 }
 
+int dw_sinsvc2_capture(int (*wr)(const void*, size_t, void*), void *cbarg) {
+	if (!impl.ready) {
+		log_e("not initialized\n");
+		return -1;
+	}
+	if (!wr) {
+		aloe_atomic_store(&impl.cap.wr, NULL);
+		return 0;
+	}
+	if (aloe_atomic_load(&impl.cap.wr)) {
+		log_e("capture in progress\n");
+		return -1;
+	}
+	impl.cap.cbarg = cbarg;
+	impl.cap.started = 0;
+	aloe_atomic_store(&impl.cap.wr, wr);
+	return 0;
+}
+
+#if defined(ALOE_SYS_LINUX)
+long dw_sinsvc2_replay(const char *path, unsigned speed) {
+	int fd = -1;
+	struct stat st;
+	const char *trc = MAP_FAILED;
+	dw_sinsvc2_trace_t hdr;
+	aloe_sem_t done;
+	long r = -1;
+
+	if (!impl.ready) {
+		log_e("not initialized\n");
+		return -1;
+	}
+	if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) != 0) {
+		log_e("Failed open %s\n", path);
+		goto finally;
+	}
+	if ((size_t)st.st_size < sizeof(hdr)) {
+		log_e("Invalid trace\n");
+		goto finally;
+	}
+	if ((trc = (const char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+			fd, 0)) == MAP_FAILED) {
+		log_e("Failed mmap %s\n", path);
+		goto finally;
+	}
+	madvise((void*)trc, st.st_size, MADV_SEQUENTIAL);
+	memcpy(&hdr, trc, sizeof(hdr));
+	if (hdr.magic != DW_SINSVC2_TRACE_MAGIC || hdr.ver != DW_SINSVC2_TRACE_VER
+			|| hdr.hdr_len < sizeof(hdr) || hdr.hdr_len > st.st_size) {
+		log_e("Invalid trace\n");
+		goto finally;
+	}
+	if (aloe_sem_init(&done, 1, 0, "sinsvc2rply") != 0) {
+		log_e("Failed create semaphore\n");
+		goto finally;
+	}
+	if (aloe_atomic_load(&impl.rply.pending)) {
+		log_e("replay in progress\n");
+		aloe_sem_destroy(&done);
+		goto finally;
+	}
+
+	// frame buffer and chain only touched by the task
+	impl.rply.trc = trc;
+	impl.rply.trc_sz = st.st_size;
+	impl.rply.speed = speed;
+	impl.rply.r = -1;
+	impl.rply.done = &done;
+	aloe_atomic_store(&impl.rply.pending, 1);
+
+	// mgmt not yet open, or timer pick it up when kick lost
+	while (mgmt_kick() != 0) aloe_thread_sleep(100);
+	aloe_sem_wait(&done, NULL, aloe_dur_infinite, "sinsvc2rply");
+	aloe_sem_destroy(&done);
+	r = impl.rply.r;
+finally:
+	if (trc != MAP_FAILED) munmap((void*)trc, st.st_size);
+	if (fd != -1) close(fd);
+	return r;
+}
+#endif
+
+int dw_sinsvc2_lat_dump(int reset) {
+	aloe_sem_t done;
+
+	if (!impl.lat) {
+		log_e("latency trace not enabled\n");
+		return -1;
+	}
+	if (aloe_sem_init(&done, 1, 0, "sinsvc2lat") != 0) {
+		log_e("Failed create semaphore\n");
+		return -1;
+	}
+	if (aloe_atomic_load(&impl.latd.pending)) {
+		log_e("latency dump in progress\n");
+		aloe_sem_destroy(&done);
+		return -1;
+	}
+
+	// histogram only touched by the task
+	impl.latd.reset = reset;
+	impl.latd.done = &done;
+	aloe_atomic_store(&impl.latd.pending, 1);
+
+	// mgmt not yet open, or timer pick it up when kick lost
+	while (mgmt_kick() != 0) aloe_thread_sleep(100);
+	aloe_sem_wait(&done, NULL, aloe_dur_infinite, "sinsvc2lat");
+	aloe_sem_destroy(&done);
+	return 0;
+}
+
 int dw_sinsvc2_acc(int acc) {
 	int i;
 	cln_t *cln;
 
 
-	for (i = 0; i < (int)aloe_arraysize(impl.cln); i++) {
+	for (i = 0; i < impl.cln_cnt; i++) {
 		cln = &impl.cln[i];
 		if (acc >= 0) cln->st.acc = acc;
 		log_d("cln[%d]: %d\n", i, cln->st.acc);
@@ -0,0 +1,485 @@
+/* $Id$
+ *
+ * Copyright 2023, Joelai
+ * All Rights Reserved.
+ *
+ * @author joelai
+ */
+
+#include <errno.h>
+
+#if defined(ALOE_SYS_LINUX)
+#  include <sys/select.h>
+#  include <poll.h>
+#  include <sys/epoll.h>
+#else
+#  include <lwip/sockets.h>
+#endif
+
+#include "dw_sockev.h"
+
+#define log_e(...) aloe_log_e(__VA_ARGS__)
+#define log_d(...) aloe_log_d(__VA_ARGS__)
+
+typedef struct {
+	int fd;
+	unsigned sel;
+	void *ctx;
+} sel_ent_t;
+
+typedef struct {
+	int cnt, fds_mx;
+
+	/* registered, copy to wait */
+	fd_set fds_rd, fds_wr, fds_ex;
+	sel_ent_t ent[0];
+} sel_priv_t;
+
+static sel_ent_t* sel_find(sel_priv_t *priv, int fd) {
+	int i;
+
+	for (i = 0; i < priv->cnt; i++) {
+		if (priv->ent[i].fd == fd) return &priv->ent[i];
+	}
+	return NULL;
+}
+
+static void sel_fds(sel_priv_t *priv, int fd, unsigned sel) {
+	if (sel & dw_sockev_rd) FD_SET(fd, &priv->fds_rd); else FD_CLR(fd, &priv->fds_rd);
+	if (sel & dw_sockev_wr) FD_SET(fd, &priv->fds_wr); else FD_CLR(fd, &priv->fds_wr);
+	if (sel & dw_sockev_ex) FD_SET(fd, &priv->fds_ex); else FD_CLR(fd, &priv->fds_ex);
+}
+
+static int sel_init(dw_sockev_t *ev, int max) {
+	sel_priv_t *priv;
+
+	if (max > FD_SETSIZE) {
+		log_e("select max %d over FD_SETSIZE %d\n", max, FD_SETSIZE);
+		return -1;
+	}
+	if (!(priv = (sel_priv_t*)aloe_mem_malloc(aloe_mem_id_stdc,
+			sizeof(*priv) + sizeof(priv->ent[0]) * max, "sockev"))) {
+		log_e("alloc select backend\n");
+		return -1;
+	}
+	priv->cnt = 0;
+	priv->fds_mx = -1;
+	FD_ZERO(&priv->fds_rd);
+	FD_ZERO(&priv->fds_wr);
+	FD_ZERO(&priv->fds_ex);
+	ev->priv = priv;
+	return 0;
+}
+
+static void sel_destroy(dw_sockev_t *ev) {
+	if (ev->priv) {
+		aloe_mem_free(ev->priv);
+		ev->priv = NULL;
+	}
+}
+
+static int sel_add(dw_sockev_t *ev, int fd, unsigned sel, void *ctx) {
+	sel_priv_t *priv = (sel_priv_t*)ev->priv;
+	sel_ent_t *ent;
+
+	if (fd < 0 || fd >= FD_SETSIZE || priv->cnt >= ev->max
+			|| sel_find(priv, fd)) {
+		return -1;
+	}
+	ent = &priv->ent[priv->cnt++];
+	ent->fd = fd;
+	ent->sel = sel;
+	ent->ctx = ctx;
+	sel_fds(priv, fd, sel);
+	if (priv->fds_mx < fd) priv->fds_mx = fd;
+	return 0;
+}
+
+static int sel_mod(dw_sockev_t *ev, int fd, unsigned sel, void *ctx) {
+	sel_priv_t *priv = (sel_priv_t*)ev->priv;
+	sel_ent_t *ent;
+
+	if (!(ent = sel_find(priv, fd))) return -1;
+	ent->sel = sel;
+	ent->ctx = ctx;
+	sel_fds(priv, fd, sel);
+	return 0;
+}
+
+static int sel_del(dw_sockev_t *ev, int fd) {
+	sel_priv_t *priv = (sel_priv_t*)ev->priv;
+	sel_ent_t *ent;
+	int i;
+
+	if (!(ent = sel_find(priv, fd))) return -1;
+	sel_fds(priv, fd, 0);
+	*ent = priv->ent[--priv->cnt];
+
+	if (fd == priv->fds_mx) {
+		priv->fds_mx = -1;
+		for (i = 0; i < priv->cnt; i++) {
+			if (priv->fds_mx < priv->ent[i].fd) priv->fds_mx = priv->ent[i].fd;
+		}
+	}
+	return 0;
+}
+
+static int sel_wait(dw_sockev_t *ev, unsigned long dur, dw_sockev_res_t *res,
+		int res_cnt) {
+	sel_priv_t *priv = (sel_priv_t*)ev->priv;
+	fd_set fds_rd, fds_wr, fds_ex;
+	struct timeval _tv, *tv;
+	int r, i, res_idx;
+
+	if (dur == aloe_dur_infinite) {
+		tv = NULL;
+	} else {
+		tv = &_tv;
+		tv->tv_sec = dur / 1000; // ms to sec
+		tv->tv_usec = (dur % 1000) * 1000; // ms to us
+	}
+
+	fds_rd = priv->fds_rd;
+	fds_wr = priv->fds_wr;
+	fds_ex = priv->fds_ex;
+	if ((r = select(priv->fds_mx + 1, &fds_rd, &fds_wr, &fds_ex, tv)) <= 0) {
+		return r;
+	}
+
+	for (i = 0, res_idx = 0; i < priv->cnt && res_idx < res_cnt && r > 0; i++) {
+		sel_ent_t *ent = &priv->ent[i];
+		unsigned sel = 0;
+
+		if (FD_ISSET(ent->fd, &fds_rd)) sel |= dw_sockev_rd;
+		if (FD_ISSET(ent->fd, &fds_wr)) sel |= dw_sockev_wr;
+		if (FD_ISSET(ent->fd, &fds_ex)) sel |= dw_sockev_ex;
+		if (!sel) continue;
+
+		res[res_idx].ctx = ent->ctx;
+		res[res_idx].sel = sel;
+		res_idx++;
+		r--;
+	}
+	return res_idx;
+}
+
+const dw_sockev_ops_t dw_sockev_select_ops = {
+	.name = "select",
+	.init = &sel_init,
+	.destroy = &sel_destroy,
+	.add = &sel_add,
+	.mod = &sel_mod,
+	.del = &sel_del,
+	.wait = &sel_wait,
+};
+
+#if defined(ALOE_SYS_LINUX)
+
+#define dur2ms(_dur) ((_dur) == aloe_dur_infinite ? -1 : \
+		(_dur) > (unsigned long)INT32_MAX ? INT32_MAX : (int)(_dur))
+
+typedef struct {
+	int cnt;
+	struct pollfd *pfd;
+	void **ctx;
+} poll_priv_t;
+
+static short poll_events(unsigned sel) {
+	short events = 0;
+
+	if (sel & dw_sockev_rd) events |= POLLIN;
+	if (sel & dw_sockev_wr) events |= POLLOUT;
+	if (sel & dw_sockev_ex) events |= POLLPRI;
+	return events;
+}
+
+/* hangup not reported when no interest, same as select, poll skip fd < 0 */
+static void poll_set(struct pollfd *pfd, int fd, unsigned sel) {
+	pfd->events = poll_events(sel);
+	pfd->fd = pfd->events ? fd : ~fd;
+}
+
+static int poll_find(poll_priv_t *priv, int fd) {
+	int i;
+
+	for (i = 0; i < priv->cnt; i++) {
+		if (priv->pfd[i].fd == fd || priv->pfd[i].fd == ~fd) return i;
+	}
+	return -1;
+}
+
+static int poll_init(dw_sockev_t *ev, int max) {
+	poll_priv_t *priv;
+
+	if (!(priv = (poll_priv_t*)aloe_mem_malloc(aloe_mem_id_stdc,
+			sizeof(*priv) + (sizeof(priv->pfd[0]) + sizeof(priv->ctx[0])) * max,
+			"sockev"))) {
+		log_e("alloc poll backend\n");
+		return -1;
+	}
+	priv->cnt = 0;
+	priv->pfd = (struct pollfd*)(priv + 1);
+	priv->ctx = (void**)&priv->pfd[max];
+	ev->priv = priv;
+	return 0;
+}
+
+static int poll_add(dw_sockev_t *ev, int fd, unsigned sel, void *ctx) {
+	poll_priv_t *priv = (poll_priv_t*)ev->priv;
+	int i;
+
+	if (fd < 0 || priv->cnt >= ev->max || poll_find(priv, fd) >= 0) return -1;
+	i = priv->cnt++;
+	poll_set(&priv->pfd[i], fd, sel);
+	priv->pfd[i].revents = 0;
+	priv->ctx[i] = ctx;
+	return 0;
+}
+
+static int poll_mod(dw_sockev_t *ev, int fd, unsigned sel, void *ctx) {
+	poll_priv_t *priv = (poll_priv_t*)ev->priv;
+	int i;
+
+	if ((i = poll_find(priv, fd)) < 0) return -1;
+	poll_set(&priv->pfd[i], fd, sel);
+	priv->ctx[i] = ctx;
+	return 0;
+}
+
+static int poll_del(dw_sockev_t *ev, int fd) {
+	poll_priv_t *priv = (poll_priv_t*)ev->priv;
+	int i;
+
+	if ((i = poll_find(priv, fd)) < 0) return -1;
+	priv->cnt--;
+	priv->pfd[i] = priv->pfd[priv->cnt];
+	priv->ctx[i] = priv->ctx[priv->cnt];
+	return 0;
+}
+
+static int poll_wait(dw_sockev_t *ev, unsigned long dur, dw_sockev_res_t *res,
+		int res_cnt) {
+	poll_priv_t *priv = (poll_priv_t*)ev->priv;
+	int r, i, res_idx;
+
+	if ((r = poll(priv->pfd, priv->cnt, dur2ms(dur))) <= 0) return r;
+
+	for (i = 0, res_idx = 0; i < priv->cnt && res_idx < res_cnt && r > 0; i++) {
+		short revents = priv->pfd[i].revents, events = priv->pfd[i].events;
+		unsigned sel = 0;
+
+		if (!revents) continue;
+		r--;
+
+		if (revents & POLLIN) sel |= dw_sockev_rd;
+		if (revents & POLLOUT) sel |= dw_sockev_wr;
+		if (revents & POLLPRI) sel |= dw_sockev_ex;
+
+		// error and hangup reported to the interest, same as select
+		if (revents & (POLLHUP | POLLERR | POLLNVAL)) {
+			sel |= (events & POLLIN) ? dw_sockev_rd :
+					(events & POLLOUT) ? dw_sockev_wr : dw_sockev_ex;
+		}
+
+		res[res_idx].ctx = priv->ctx[i];
+		res[res_idx].sel = sel;
+		res_idx++;
+	}
+	return res_idx;
+}
+
+const dw_sockev_ops_t dw_sockev_poll_ops = {
+	.name = "poll",
+	.init = &poll_init,
+	.destroy = &sel_destroy,
+	.add = &poll_add,
+	.mod = &poll_mod,
+	.del = &poll_del,
+	.wait = &poll_wait,
+};
+
+typedef struct {
+	int epfd;
+
+	/* fd -1 for free slot, epoll hold the slot */
+	sel_ent_t *ent;
+	struct epoll_event evs[0];
+} epoll_priv_t;
+
+static uint32_t epoll_events(unsigned sel) {
+	uint32_t events = 0;
+
+	if (sel & dw_sockev_rd) events |= EPOLLIN;
+	if (sel & dw_sockev_wr) events |= EPOLLOUT;
+	if (sel & dw_sockev_ex) events |= EPOLLPRI;
+	return events;
+}
+
+static sel_ent_t* epoll_find(dw_sockev_t *ev, int fd) {
+	epoll_priv_t *priv = (epoll_priv_t*)ev->priv;
+	int i;
+
+	for (i = 0; i < ev->max; i++) {
+		if (priv->ent[i].fd == fd) return &priv->ent[i];
+	}
+	return NULL;
+}
+
+static int epoll_init(dw_sockev_t *ev, int max) {
+	epoll_priv_t *priv;
+	int i;
+
+	if (!(priv = (epoll_priv_t*)aloe_mem_malloc(aloe_mem_id_stdc,
+			sizeof(*priv) + (sizeof(priv->evs[0]) + sizeof(priv->ent[0])) * max,
+			"sockev"))) {
+		log_e("alloc epoll backend\n");
+		return -1;
+	}
+	priv->ent = (sel_ent_t*)&priv->evs[max];
+	for (i = 0; i < max; i++) priv->ent[i].fd = -1;
+	if ((priv->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		log_e("create epoll: %s\n", strerror(errno));
+		aloe_mem_free(priv);
+		return -1;
+	}
+	ev->priv = priv;
+	return 0;
+}
+
+static void epoll_destroy(dw_sockev_t *ev) {
+	epoll_priv_t *priv = (epoll_priv_t*)ev->priv;
+
+	if (priv) {
+		close(priv->epfd);
+		aloe_mem_free(priv);
+		ev->priv = NULL;
+	}
+}
+
+/**
+ * Sync the slot to epoll, out of epoll when no interest since epoll always
+ * report hangup, same as select.
+ */
+static int epoll_ctl2(dw_sockev_t *ev, sel_ent_t *ent, unsigned sel) {
+	epoll_priv_t *priv = (epoll_priv_t*)ev->priv;
+	struct epoll_event evt;
+	int op;
+
+	if (!ent->sel && !sel) return 0;
+	op = !ent->sel ? EPOLL_CTL_ADD : !sel ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+
+	memset(&evt, 0, sizeof(evt));
+	evt.events = epoll_events(sel);
+	evt.data.ptr = ent;
+	return epoll_ctl(priv->epfd, op, ent->fd, &evt) == 0 ? 0 : -1;
+}
+
+static int epoll_add(dw_sockev_t *ev, int fd, unsigned sel, void *ctx) {
+	sel_ent_t *ent;
+
+	if (fd < 0 || epoll_find(ev, fd) || !(ent = epoll_find(ev, -1))) return -1;
+	ent->fd = fd;
+	ent->sel = 0;
+	if (epoll_ctl2(ev, ent, sel) != 0) {
+		ent->fd = -1;
+		return -1;
+	}
+	ent->sel = sel;
+	ent->ctx = ctx;
+	return 0;
+}
+
+static int epoll_mod(dw_sockev_t *ev, int fd, unsigned sel, void *ctx) {
+	sel_ent_t *ent;
+
+	if (!(ent = epoll_find(ev, fd)) || epoll_ctl2(ev, ent, sel) != 0) return -1;
+	ent->sel = sel;
+	ent->ctx = ctx;
+	return 0;
+}
+
+static int epoll_del(dw_sockev_t *ev, int fd) {
+	sel_ent_t *ent;
+	int r;
+
+	if (fd < 0 || !(ent = epoll_find(ev, fd))) return -1;
+	r = epoll_ctl2(ev, ent, 0);
+	ent->fd = -1;
+	return r;
+}
+
+static int epoll_wait2(dw_sockev_t *ev, unsigned long dur, dw_sockev_res_t *res,
+		int res_cnt) {
+	epoll_priv_t *priv = (epoll_priv_t*)ev->priv;
+	int r, i;
+
+	if (res_cnt > ev->max) res_cnt = ev->max;
+	if ((r = epoll_wait(priv->epfd, priv->evs, res_cnt, dur2ms(dur))) <= 0) {
+		return r;
+	}
+
+	for (i = 0; i < r; i++) {
+		uint32_t events = priv->evs[i].events;
+		sel_ent_t *ent = (sel_ent_t*)priv->evs[i].data.ptr;
+		unsigned sel = 0;
+
+		if (events & EPOLLIN) sel |= dw_sockev_rd;
+		if (events & EPOLLOUT) sel |= dw_sockev_wr;
+		if (events & EPOLLPRI) sel |= dw_sockev_ex;
+
+		// error and hangup reported to the interest, same as select
+		if (events & (EPOLLHUP | EPOLLERR)) {
+			sel |= (ent->sel & dw_sockev_rd) ? dw_sockev_rd :
+					(ent->sel & dw_sockev_wr) ? dw_sockev_wr : dw_sockev_ex;
+		}
+
+		res[i].ctx = ent->ctx;
+		res[i].sel = sel;
+	}
+	return r;
+}
+
+/**
+ * Poll without block then sleep on virtual clock, simulation thread not
+ * block outside aloe.
+ */
+static int sim_wait(dw_sockev_t *ev, unsigned long dur, dw_sockev_res_t *res,
+		int res_cnt) {
+	unsigned long ts = aloe_tick2ms(aloe_ticks()), us;
+	int r;
+
+	while (1) {
+		if ((r = poll_wait(ev, 0, res, res_cnt)) != 0) return r;
+		if (dur != aloe_dur_infinite
+				&& aloe_tick2ms(aloe_ticks()) - ts >= dur) {
+			return 0;
+		}
+		us = dw_sockev_sim_tick_us;
+		if (dur != aloe_dur_infinite) {
+			us = aloe_min(us, (dur - (aloe_tick2ms(aloe_ticks()) - ts)) * 1000ul);
+		}
+		aloe_thread_usleep(us);
+	}
+}
+
+const dw_sockev_ops_t dw_sockev_sim_ops = {
+	.name = "sim",
+	.init = &poll_init,
+	.destroy = &sel_destroy,
+	.add = &poll_add,
+	.mod = &poll_mod,
+	.del = &poll_del,
+	.wait = &sim_wait,
+};
+
+const dw_sockev_ops_t dw_sockev_epoll_ops = {
+	.name = "epoll",
+	.init = &epoll_init,
+	.destroy = &epoll_destroy,
+	.add = &epoll_add,
+	.mod = &epoll_mod,
+	.del = &epoll_del,
+	.wait = &epoll_wait2,
+};
+
+#endif
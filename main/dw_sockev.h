@@ -0,0 +1,91 @@
+/* $Id$
+ *
+ * Copyright 2023, Joelai
+ * All Rights Reserved.
+ *
+ * @author joelai
+ */
+
+#ifndef MAIN_DW_SOCKEV_H_
+#define MAIN_DW_SOCKEV_H_
+
+#include <aloe_sys.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Socket event, same bits as sinsvc2 sel_t. */
+#define dw_sockev_rd (1 << 0)
+#define dw_sockev_wr (1 << 1)
+#define dw_sockev_ex (1 << 2)
+
+/** Ready socket from wait. */
+typedef struct {
+	void *ctx;
+	unsigned sel;
+} dw_sockev_res_t;
+
+typedef struct dw_sockev_rec dw_sockev_t;
+
+/**
+ * Event backend.
+ *
+ * Socket registered with ctx, backend only updated when interest changed,
+ * and wait report only the ready socket.  Error and hangup reported as the
+ * interest like select, not at all when no interest.
+ */
+typedef struct dw_sockev_ops_rec {
+	const char *name;
+	int (*init)(dw_sockev_t*, int max);
+	void (*destroy)(dw_sockev_t*);
+	int (*add)(dw_sockev_t*, int fd, unsigned sel, void *ctx);
+	int (*mod)(dw_sockev_t*, int fd, unsigned sel, void *ctx);
+	int (*del)(dw_sockev_t*, int fd);
+
+	/**
+	 * Wait socket ready.
+	 *
+	 * @param dur Milliseconds, aloe_dur_infinite to wait forever
+	 * @return Count of res filled, 0 for timeout, -1 for error and errno set
+	 */
+	int (*wait)(dw_sockev_t*, unsigned long dur, dw_sockev_res_t *res,
+			int res_cnt);
+} dw_sockev_ops_t;
+
+struct dw_sockev_rec {
+	const dw_sockev_ops_t *ops;
+	int max;
+	void *priv;
+};
+
+/** select(), default for lwip. */
+extern const dw_sockev_ops_t dw_sockev_select_ops;
+
+#if defined(ALOE_SYS_LINUX)
+extern const dw_sockev_ops_t dw_sockev_poll_ops;
+extern const dw_sockev_ops_t dw_sockev_epoll_ops;
+
+/** Poll every tick of virtual clock, for aloe_sim_start(). */
+extern const dw_sockev_ops_t dw_sockev_sim_ops;
+#  define dw_sockev_sim_tick_us 50
+#  define dw_sockev_ops_def (aloe_sim_on() ? &dw_sockev_sim_ops : \
+		&dw_sockev_epoll_ops)
+#else
+#  define dw_sockev_ops_def (&dw_sockev_select_ops)
+#endif
+
+#define dw_sockev_init(_ev, _ops, _max) ( \
+		(_ev)->ops = (_ops), (_ev)->max = (_max), (_ev)->priv = NULL, \
+		(*(_ev)->ops->init)(_ev, _max))
+#define dw_sockev_destroy(_ev) (*(_ev)->ops->destroy)(_ev)
+#define dw_sockev_add(_ev, _fd, _sel, _ctx) (*(_ev)->ops->add)(_ev, _fd, _sel, _ctx)
+#define dw_sockev_mod(_ev, _fd, _sel, _ctx) (*(_ev)->ops->mod)(_ev, _fd, _sel, _ctx)
+#define dw_sockev_del(_ev, _fd) (*(_ev)->ops->del)(_ev, _fd)
+#define dw_sockev_wait(_ev, _dur, _res, _cnt) (*(_ev)->ops->wait)(_ev, _dur, _res, _cnt)
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* MAIN_DW_SOCKEV_H_ */
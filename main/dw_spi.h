@@ -17,9 +17,59 @@
 extern "C" {
 #endif
 
-typedef struct dw_spi2_req_rec {
+/** Scatter-gather segment. */
+typedef struct {
 	const void *data;
 	size_t sz;
+} dw_spi2_seg_t;
+
+/** Priority class count of dw_spi2_req_t. */
+#define DW_SPI2_PRIO_CNT 4
+
+typedef struct dw_spi2_req_rec {
+	/** Contiguous data, ignored when seg set. */
+	const void *data;
+
+	/** Total bytes, sum of segment when seg set. */
+	volatile size_t sz;
+
+	/**
+	 * Bytes of data landed, SPI only transmit data below wmk.
+	 * Set wmk to sz for store-and-forward.
+	 */
+	volatile size_t wmk;
+
+	/**
+	 * Segment walked in order across trunk boundary, ie. protocol header
+	 * prepend to pooled payload without flatten.  NULL to use data.
+	 */
+	const dw_spi2_seg_t *seg;
+	int seg_cnt;
+
+	/**
+	 * Priority class below DW_SPI2_PRIO_CNT, higher class jump ahead at
+	 * request boundary, or chain boundary when chain open.  Trunk of one
+	 * request never interleave with other on the bus, the far end take
+	 * them back-to-back.
+	 */
+	unsigned prio;
+
+	/**
+	 * Chain of request sent back-to-back as one logical transfer, the bus
+	 * stage nothing else, of any class, after the part with more set until
+	 * the next part of the same chain added.  Same chain for every part, ie.
+	 * the owner.  Head-of-line block every class meanwhile, the owner bound
+	 * the time, ie. dw_spi2_req_wmk() with fin to give up.
+	 */
+	const void *chain;
+	unsigned more;
+
+	/** Enqueue time, private to SPI. */
+	unsigned long ts;
+
+	/** Leave the queue and last trunk done, dw_ts_us() set by SPI. */
+	unsigned long ts_deq, ts_fin;
+
 	void (*cb)(void*);
 	void *cbarg;
 	TAILQ_ENTRY(dw_spi2_req_rec) qent;
@@ -28,11 +78,11 @@ typedef struct dw_spi2_req_rec {
 typedef TAILQ_HEAD(, dw_spi2_req_rec) dw_spi2_req_list_t;
 
 dw_spi2_req_t* dw_spi2_req_pop_isr(dw_spi2_req_list_t *req_list,
-		aloe_sem_t *lock, BaseType_t *rt);
+		aloe_sem_t *lock, void *rt);
 int dw_spi2_req_add_isr(dw_spi2_req_list_t *req_list, aloe_sem_t *lock,
-		dw_spi2_req_t *req, BaseType_t *rt);
+		dw_spi2_req_t *req, void *rt);
 int dw_spi2_req_is_empty_isr(dw_spi2_req_list_t *req_list, aloe_sem_t *lock,
-		BaseType_t *rt);
+		void *rt);
 
 #define dw_spi2_req_pop(_list, _lock) \
 	dw_spi2_req_pop_isr(_list, _lock, NULL)
@@ -41,9 +91,103 @@ int dw_spi2_req_is_empty_isr(dw_spi2_req_list_t *req_list, aloe_sem_t *lock,
 #define dw_spi2_req_is_empty(_list, _lock) \
 	dw_spi2_req_is_empty_isr(_list, _lock, NULL)
 
-int dw_spi2_start(unsigned master, unsigned clkDiv);
+/** Buffer geometry of SPI, field 0 take the default. */
+typedef struct {
+	/* transaction size, multiple of 4 */
+	unsigned trunk_sz;
+
+	/* descriptor in flight, trunk N on the bus while N+1 staged */
+	unsigned dma_cnt;
+
+	/* receive frame, one trunk each */
+	unsigned rx_cnt;
+} dw_spi2_cfg_t;
+
+/**
+ * Start SPI.
+ *
+ * @param cfg NULL for default
+ * @return -1 when geometry out of range or not enough memory
+ */
+int dw_spi2_start(unsigned master, unsigned clkDiv, const dw_spi2_cfg_t *cfg);
 int dw_spi2_add(dw_spi2_req_t*);
 
+/** Coalesced transaction begin with the table. */
+#define DW_SPI2_COAL_MAGIC 0xc0a1
+
+/** Max sub-frame in one coalesced transaction. */
+#define DW_SPI2_COAL_MAX 16
+
+/**
+ * Sub-frame length table, followed by sub-frame in order.
+ *
+ * Table always take DW_SPI2_COAL_MAX entries.
+ */
+typedef struct __attribute__((packed)) {
+	uint16_t magic;
+	uint16_t cnt;
+	uint16_t len[DW_SPI2_COAL_MAX];
+} dw_spi2_coal_t;
+
+/**
+ * Opt-in coalescing, pack consecutive queued request fit in one trunk into
+ * single transaction once landed, each original cb fired when the
+ * transaction done.  Packed while the bus busy, closed when bus idle unless
+ * the next one still landing.  Call after dw_spi2_start().
+ *
+ * @param delay_us Max delay waiting sub-frame landing when bus idle, 0 to
+ *   disable
+ */
+int dw_spi2_coalesce(unsigned delay_us);
+
+/** Room before received data for caller protocol header. */
+#define DW_SPI2_RX_HEADROOM 16
+
+/** Received frame from pool, data between fb.pos and fb.lmt. */
+typedef struct dw_spi2_rx_rec {
+	aloe_buf_t fb;
+
+	/*
+	 * Chain of the request echoed by mock bus loopback, NULL for every
+	 * receiver, ie. from the master.
+	 */
+	const void *chain;
+
+	TAILQ_ENTRY(dw_spi2_rx_rec) qent;
+} dw_spi2_rx_t;
+
+typedef TAILQ_HEAD(, dw_spi2_rx_rec) dw_spi2_rx_list_t;
+
+/**
+ * Deliver received frame from SPI task, receiver own the frame until
+ * dw_spi2_rx_free().  Received frame dropped when no receiver.
+ */
+int dw_spi2_rx_start(void (*cb)(dw_spi2_rx_t*, void*), void *cbarg);
+
+/** Return received frame to pool, thread safe. */
+void dw_spi2_rx_free(dw_spi2_rx_t*);
+
+#if defined(ALOE_SYS_LINUX)
+/**
+ * Replace loopback of the mock bus, see every trunk on the bus.
+ *
+ * The sink fill up to rx_sz bytes to rx and return bytes received, rx NULL
+ * when no receiver.  NULL sink restore loopback.  Call after dw_spi2_start().
+ */
+int dw_spi2_mock_sink(size_t (*sink)(const void *tx, size_t sz, void *rx,
+		size_t rx_sz, void *cbarg), void *cbarg);
+#endif
+
+/**
+ * Advance the watermark of the request for cut-through transmit.
+ *
+ * Resume the request waiting for data.
+ *
+ * @param fin Truncate the request to wmk, ie. abort the rest of data, also
+ *   end the chain.
+ */
+int dw_spi2_req_wmk(dw_spi2_req_t*, size_t wmk, unsigned fin);
+
 /**
  * thread unsafe
  *
@@ -13,7 +13,10 @@
 #include <inttypes.h>
 #include <math.h>
 
-#include <sdkconfig.h>
+#if !defined(ALOE_SYS_LINUX)
+#  include <sdkconfig.h>
+#  include <esp_timer.h>
+#endif
 
 #include "dw_spi.h"
 
@@ -29,30 +32,163 @@ typedef struct {
 #define mq_msg_id_spi_recv ((mq_msg_t*)2)
 #define mq_msg_id_spi_req_done ((mq_msg_t*)3)
 
+/* descriptor in flight, trunk N on the bus while N+1 staged */
+#ifndef spi2_dma_cnt
+#  define spi2_dma_cnt 2
+#endif
+#define spi2_dma_max 8
+
+#if defined(ALOE_SYS_LINUX)
+/* mock bus take transfer time from clock, done from bus thread */
+#  define spi2_bus_mock_timing 1
+#else
+/* mock bus done immediately */
+#  define spi2_bus_mock_timing 0
+#endif
+
+/* receive frame, hold one trunk after headroom */
+#ifndef spi2_rx_cnt
+#  define spi2_rx_cnt 8
+#endif
+#define spi2_rx_sz (DW_SPI2_RX_HEADROOM + impl.cfg.trunk_sz)
+
+/* frame data follow dw_spi2_rx_t in the pool object */
+#define spi2_rx_hdr_sz aloe_roundup(sizeof(dw_spi2_rx_t), 32)
+
+/* trunk hold at least the coalescing table */
+#define spi2_trunk_min 64
+#define spi2_trunk_max (32 * 1024)
+
+/* mock bus receive the trunk transmitted, or from dw_spi2_mock_sink() */
+#define spi2_bus_mock_loopback spi2_bus_mock_timing
+
+/* interval to log priority class counter */
+#define spi2_prio_log_us 10000000ul
+
+typedef struct {
+	aloe_buf_t fb;
+	dw_spi2_req_t *req;
+
+	/* last trunk of the request */
+	unsigned fin: 1;
+
+	/* request packed in coalesced transaction */
+	dw_spi2_req_list_t coal_list;
+
+	/* receive in the transaction, NULL to drop */
+	dw_spi2_rx_t *rx;
+} spi2_dma_t;
+
+/* staging cursor of request, one per priority class */
+typedef struct {
+	dw_spi2_req_t *req;
+
+	/* chain open, wait the next part instead of the head of the class */
+	const void *chain;
+
+	/* pos for bytes staged, lmt follow req->sz */
+	aloe_buf_t fb;
+
+	/* segment cursor */
+	const dw_spi2_seg_t *seg;
+	int seg_cnt, seg_idx;
+	size_t seg_pos;
+
+	/* contiguous data as one segment */
+	dw_spi2_seg_t seg1;
+} spi2_stage_t;
+
 static struct {
 	unsigned ready: 2;
 	unsigned quit: 1;
 
 	aloe_thread_t tsk;
 	aloe_sem_t lock;
-	QueueHandle_t mq;
+	aloe_mq_t mq;
 
 	volatile char spis_tx_done, spis_rx_done, spim_tx_done, spim_rx_done;
 
+	/* clkDiv taken as kHz */
+	unsigned clk_khz;
+
+	dw_spi2_cfg_t cfg;
+
 	struct {
-		dw_spi2_req_t *req, *req_recycle;
-		aloe_buf_t fb;
+		/*
+		 * request in staging, higher class take the next free descriptor
+		 * at request or chain boundary, lower class go when higher wait for
+		 * data before the first trunk
+		 */
+		spi2_stage_t stage[DW_SPI2_PRIO_CNT];
+
+		/* done request wait callback from SPI task */
+		dw_spi2_req_list_t recycle_list;
+
+		/* ping-pong bounce buffer in impl.xfer, dma_rd on the bus */
+		spi2_dma_t dma[spi2_dma_max];
+		unsigned dma_wr, dma_rd;
+		unsigned bus_busy: 1;
+
+		/* coalescing, descriptor at dma_wr open when coal_cnt > 0 */
+		unsigned coal_us;
+		int coal_cnt;
+		unsigned long coal_ts;
+#if !defined(ALOE_SYS_LINUX)
+		esp_timer_handle_t coal_tmr;
+#else
+		/* mock bus thread wake at coal_due when coal_armed */
+		unsigned long coal_due;
+		unsigned coal_armed: 1;
+#endif
+
+		/*
+		 * guard req_proc against transmit from dw_spi2_add() and
+		 * dw_spi2_req_wmk()
+		 */
+		aloe_sem_t lock;
 	} req_proc;
 
-	dw_spi2_req_list_t req_list;
+	/* queued request per priority class, guarded by lock */
+	dw_spi2_req_list_t req_list[DW_SPI2_PRIO_CNT];
+
+	/* received frame, done_list guarded by lock */
+	struct {
+		aloe_pool_t *pool;
+		dw_spi2_rx_list_t done_list;
+		void (*cb)(dw_spi2_rx_t*, void*);
+		void *cbarg;
+	} rx;
 
 	// 32 bytes align
 	char *xfer, *xfer_alloc;
 
 	struct {
 		unsigned recycle_corrupt;
+		unsigned long rx_drop;
+
+		/* coalesced transaction and sub-frame packed, req_proc.lock held */
+		unsigned long coal_txn, coal_sub;
+
+		/* per class, guarded by lock */
+		struct {
+			unsigned depth, depth_max;
+			unsigned long cnt, wait_us, wait_max;
+		} prio[DW_SPI2_PRIO_CNT];
+		unsigned long prio_ts;
 	} st;
 
+#if spi2_bus_mock_timing
+	struct {
+		aloe_thread_t tsk;
+		aloe_sem_t start;
+		size_t sz;
+
+		/* NULL for loopback */
+		size_t (*sink)(const void*, size_t, void*, size_t, void*);
+		void *sink_cbarg;
+	} bus;
+#endif
+
 } impl = {};
 
 #define spi2_req_gc(_req) do { \
@@ -62,8 +198,10 @@ static struct {
 	(_req) = NULL; \
 } while(0)
 
+static int spi2_req_pump(void);
+
 dw_spi2_req_t* dw_spi2_req_pop_isr(dw_spi2_req_list_t *req_list,
-		aloe_sem_t *lock, BaseType_t *rt) {
+		aloe_sem_t *lock, void *rt) {
 	dw_spi2_req_t *req = NULL;
 
 	if (aloe_sem_wait(lock, rt, aloe_dur_infinite, "spi2") != 0) {
@@ -79,7 +217,7 @@ dw_spi2_req_t* dw_spi2_req_pop_isr(dw_spi2_req_list_t *req_list,
 }
 
 int dw_spi2_req_add_isr(dw_spi2_req_list_t *req_list, aloe_sem_t *lock,
-		dw_spi2_req_t *req, BaseType_t *rt) {
+		dw_spi2_req_t *req, void *rt) {
 	if (aloe_sem_wait(lock, rt, aloe_dur_infinite, "spi2") != 0) {
 		log_e("lock\n");
 		return -1;
@@ -90,7 +228,7 @@ int dw_spi2_req_add_isr(dw_spi2_req_list_t *req_list, aloe_sem_t *lock,
 }
 
 int dw_spi2_req_is_empty_isr(dw_spi2_req_list_t *req_list, aloe_sem_t *lock,
-		BaseType_t *rt) {
+		void *rt) {
 	int e;
 
 	if (aloe_sem_wait(lock, rt, aloe_dur_infinite, "spi2") != 0) {
@@ -103,29 +241,36 @@ int dw_spi2_req_is_empty_isr(dw_spi2_req_list_t *req_list, aloe_sem_t *lock,
 }
 
 int dw_spi2_add(dw_spi2_req_t *req) {
-	mq_msg_t *msg = mq_msg_id_spi_send;
+	unsigned *depth;
+
+	if (req->prio >= DW_SPI2_PRIO_CNT) req->prio = DW_SPI2_PRIO_CNT - 1;
+	req->ts = dw_ts_us();
 
-	if (dw_spi2_req_add(&impl.req_list, &impl.lock, req) != 0) {
+	if (aloe_sem_wait(&impl.lock, NULL, aloe_dur_infinite, "spi2") != 0) {
+		log_e("lock\n");
 		return -1;
 	}
+	TAILQ_INSERT_TAIL(&impl.req_list[req->prio], req, qent);
+	depth = &impl.st.prio[req->prio].depth;
+	if (++(*depth) > impl.st.prio[req->prio].depth_max) {
+		impl.st.prio[req->prio].depth_max = *depth;
+	}
+	aloe_sem_post(&impl.lock, NULL, "spi2");
 
-	if (xQueueSend(impl.mq, &msg, 100) != pdPASS) {
-		log_e("The queue to notify SPI is full\n");
+	// launch right away when bus idle, otherwise from done of previous
+	if (aloe_sem_wait(&impl.req_proc.lock, NULL, aloe_dur_infinite,
+			"spi2") != 0) {
+		log_e("lock\n");
+		return 0;
 	}
+	spi2_req_pump();
+	aloe_sem_post(&impl.req_proc.lock, NULL, "spi2");
 	return 0;
 }
 
 static int dw_spi2_send_start(const void *data, size_t sz) {
-	if (impl.req_proc.req && impl.req_proc.fb.data == data) {
-		mq_msg_t *msg;
-
-		impl.req_proc.req_recycle = impl.req_proc.req;
-		impl.req_proc.req = NULL;
-		msg = mq_msg_id_spi_req_done;
-		if (xQueueSend(impl.mq, &msg, portMAX_DELAY) != pdPASS) {
-//			log_e("The queue to notify SPI is full\n");
-		}
-	}
+	// mock api, bus done immediately
+	(void)data;
 	return sz;
 }
 
@@ -149,115 +294,872 @@ int dw_spi2_send2(const void *data, size_t sz) {
 	return rs;
 }
 
-void spi2_req_proc2(dw_spi2_req_t *req) {
-	int r;
+/** Hand over done request to SPI task for callback, req_proc.lock held. */
+static void spi2_req_recycle(dw_spi2_req_t *req) {
+	mq_msg_t *msg = mq_msg_id_spi_req_done;
+
+	req->ts_fin = dw_ts_us();
+	TAILQ_INSERT_TAIL(&impl.req_proc.recycle_list, req, qent);
+
+	// queue full means callback pending
+	aloe_mq_send(&impl.mq, &msg, NULL, 0);
+}
+
+/**
+ * Start full-duplex transaction on the bus.
+ *
+ * @param rx Receive buffer, fb.lmt advanced when done
+ * @return 1 when done already, 0 when spi2_dma_done() later, -1 when failed
+ */
+static int spi2_bus_start(const void *data, size_t sz, dw_spi2_rx_t *rx) {
+#if spi2_bus_mock_loopback
+	size_t rx_sz;
+#endif
+
+#if spi2_bus_mock_loopback
+	if (impl.bus.sink) {
+		rx_sz = (*impl.bus.sink)(data, sz,
+				rx ? (char*)rx->fb.data + rx->fb.lmt : NULL,
+				rx ? rx->fb.cap - rx->fb.lmt : 0, impl.bus.sink_cbarg);
+		if (rx) rx->fb.lmt += aloe_min(rx_sz, rx->fb.cap - rx->fb.lmt);
+	} else if (rx) {
+		rx_sz = aloe_min(sz, rx->fb.cap - rx->fb.lmt);
+		memcpy((char*)rx->fb.data + rx->fb.lmt, data, rx_sz);
+		rx->fb.lmt += rx_sz;
+	}
+#else
+	(void)data;
+	(void)rx;
+#endif
+
+#if spi2_bus_mock_timing
+	impl.bus.sz = sz;
+	aloe_sem_post(&impl.bus.start, NULL, "spi2bus");
+	return 0;
+#else
+	(void)sz;
+	return 1;
+#endif
+}
+
+/** Receive frame for the transaction, NULL when no receiver or pool empty. */
+static dw_spi2_rx_t* spi2_rx_pop(void) {
+	dw_spi2_rx_t *rx;
+
+	if (!impl.rx.cb) return NULL;
+	if (!(rx = (dw_spi2_rx_t*)aloe_pool_get(impl.rx.pool))) {
+		aloe_atomic_add(&impl.st.rx_drop, 1);
+		return NULL;
+	}
+	rx->fb.pos = rx->fb.lmt = DW_SPI2_RX_HEADROOM;
+	rx->chain = NULL;
+	return rx;
+}
+
+/** Hand over received frame to SPI task, or back to pool when empty. */
+static void spi2_rx_done(dw_spi2_rx_t *rx) {
+	mq_msg_t *msg = mq_msg_id_spi_recv;
+
+	if (rx->fb.lmt <= rx->fb.pos) {
+		dw_spi2_rx_free(rx);
+		return;
+	}
+	if (aloe_sem_wait(&impl.lock, NULL, aloe_dur_infinite, "spi2") != 0) {
+		log_e("lock\n");
+		dw_spi2_rx_free(rx);
+		return;
+	}
+	TAILQ_INSERT_TAIL(&impl.rx.done_list, rx, qent);
+	aloe_sem_post(&impl.lock, NULL, "spi2");
+
+	// queue full means delivery pending
+	aloe_mq_send(&impl.mq, &msg, NULL, 0);
+}
+
+void dw_spi2_rx_free(dw_spi2_rx_t *rx) {
+	if (aloe_pool_put(impl.rx.pool, rx) != 0) {
+		log_e("Sanity check rx not from pool\n");
+	}
+}
+
+int dw_spi2_rx_start(void (*cb)(dw_spi2_rx_t*, void*), void *cbarg) {
+	if (!impl.ready) {
+		log_e("Not initialized\n");
+		return -1;
+	}
+	if (aloe_sem_wait(&impl.lock, NULL, aloe_dur_infinite, "spi2") != 0) {
+		log_e("lock\n");
+		return -1;
+	}
+	impl.rx.cbarg = cbarg;
+	impl.rx.cb = cb;
+	aloe_sem_post(&impl.lock, NULL, "spi2");
+	return 0;
+}
+
+/** Reset staging cursor to the request, req_proc.lock held. */
+static void spi2_stage_init(spi2_stage_t *stg, dw_spi2_req_t *req) {
+	stg->req = req;
+	stg->fb.pos = 0;
+	stg->fb.lmt = req->sz;
+	if (req->seg) {
+		stg->seg = req->seg;
+		stg->seg_cnt = req->seg_cnt;
+	} else {
+		stg->seg1.data = req->data;
+		stg->seg1.sz = req->sz;
+		stg->seg = &stg->seg1;
+		stg->seg_cnt = 1;
+	}
+	stg->seg_idx = 0;
+	stg->seg_pos = 0;
+}
 
-	do {
-		if (req->sz <= 0) break;
+/** Copy from segment cursor across segment boundary, req_proc.lock held. */
+static void spi2_stage_gather(spi2_stage_t *stg, void *_dst, size_t sz) {
+	char *dst = (char*)_dst;
+	const dw_spi2_seg_t *seg;
+	size_t n;
 
-		while (impl.req_proc.req) {
-			aloe_thread_sleep(1);
+	while (sz > 0 && stg->seg_idx < stg->seg_cnt) {
+		seg = &stg->seg[stg->seg_idx];
+		n = aloe_min(sz, seg->sz - stg->seg_pos);
+		memcpy(dst, (const char*)seg->data + stg->seg_pos, n);
+		dst += n;
+		sz -= n;
+		if ((stg->seg_pos += n) >= seg->sz) {
+			stg->seg_idx++;
+			stg->seg_pos = 0;
 		}
+	}
+	if (sz > 0) log_e("Sanity check request size over segment\n");
+}
 
-		if (impl.req_proc.req) {
-			log_e("Previous SPI not finish\n");
+/** Account queue wait of the request leaving the class queue, lock held. */
+static void spi2_prio_dequeue(dw_spi2_req_t *req) {
+	unsigned long us;
+
+	req->ts_deq = dw_ts_us();
+	us = req->ts_deq - req->ts;
+
+	impl.st.prio[req->prio].depth--;
+	impl.st.prio[req->prio].cnt++;
+	impl.st.prio[req->prio].wait_us += us;
+	if (us > impl.st.prio[req->prio].wait_max) {
+		impl.st.prio[req->prio].wait_max = us;
+	}
+}
+
+/**
+ * Pop queued request of the class, the next part when chain open, NULL when
+ * empty.  Request of other chain behind wait meanwhile, the owner bound how
+ * long the chain stay open.
+ */
+static dw_spi2_req_t* spi2_req_pop(int prio, const void *chain) {
+	dw_spi2_req_t *req;
+
+	if (aloe_sem_wait(&impl.lock, NULL, aloe_dur_infinite, "spi2") != 0) {
+		log_e("lock\n");
+		return NULL;
+	}
+	TAILQ_FOREACH(req, &impl.req_list[prio], qent) {
+		if (!chain || req->chain == chain) break;
+	}
+	if (req) {
+		TAILQ_REMOVE(&impl.req_list[prio], req, qent);
+		spi2_prio_dequeue(req);
+	}
+	aloe_sem_post(&impl.lock, NULL, "spi2");
+	return req;
+}
+
+/** Wake pump after coalescing delay, req_proc.lock held. */
+static void spi2_coal_tmr_arm(unsigned long us) {
+#if defined(ALOE_SYS_LINUX)
+	// mock bus thread take the due time when waked
+	impl.req_proc.coal_due = dw_ts_us() + us;
+	if (!impl.req_proc.coal_armed) {
+		impl.req_proc.coal_armed = 1;
+		aloe_sem_post(&impl.bus.start, NULL, "spi2bus");
+	}
+#else
+	// already armed when failed
+	esp_timer_start_once(impl.req_proc.coal_tmr, us);
+#endif
+}
+
+/**
+ * Pack queued small request into the descriptor at dma_wr once landed.
+ *
+ * Close the descriptor when full, the next request not fit to keep order,
+ * or the bus idle after delay.  Cut-through request queued before the data,
+ * small one at the head held until landed instead of staged alone.
+ *
+ * Caller hold req_proc.lock.
+ *
+ * @param hold Class of the request held, -1 when none
+ * @return 1 when descriptor closed, otherwise 0
+ */
+static int spi2_dma_coal(int *hold) {
+	int dma_idx = impl.req_proc.dma_wr % impl.cfg.dma_cnt;
+	aloe_buf_t *dma_fb = &impl.req_proc.dma[dma_idx].fb;
+	dw_spi2_coal_t *coal = (dw_spi2_coal_t*)dma_fb->data;
+	dw_spi2_req_t *req = NULL;
+	spi2_stage_t stg;
+	unsigned long ts;
+	int prio;
+	char fit, room;
+
+	*hold = -1;
+	while (impl.req_proc.coal_cnt < DW_SPI2_COAL_MAX) {
+		fit = 0;
+		if (aloe_sem_wait(&impl.lock, NULL, aloe_dur_infinite, "spi2") != 0) {
+			log_e("lock\n");
 			break;
 		}
-		if (impl.req_proc.req_recycle) {
-//			log_d("SPI req gc\n");
-			spi2_req_gc(impl.req_proc.req_recycle);
+		// head of the highest class queued
+		for (prio = DW_SPI2_PRIO_CNT - 1; prio >= 0; prio--) {
+			if ((req = TAILQ_FIRST(&impl.req_list[prio]))) break;
+		}
+		if (req) {
+			// only whole frame, not part of chain
+			room = req->sz > 0 && !req->more
+					&& req->sz <= dma_fb->cap - (impl.req_proc.coal_cnt > 0 ?
+							dma_fb->lmt : sizeof(*coal));
+			fit = room && req->wmk >= req->sz;
+			if (fit) {
+				TAILQ_REMOVE(&impl.req_list[prio], req, qent);
+				spi2_prio_dequeue(req);
+			} else if (room) {
+				*hold = prio;
+			}
+		}
+		aloe_sem_post(&impl.lock, NULL, "spi2");
+		if (!fit) break;
+
+		if (impl.req_proc.coal_cnt == 0) {
+			dma_fb->pos = 0;
+			dma_fb->lmt = sizeof(*coal);
+			impl.req_proc.coal_ts = dw_ts_us();
+		}
+		spi2_stage_init(&stg, req);
+		spi2_stage_gather(&stg, (char*)dma_fb->data + dma_fb->lmt, req->sz);
+		dma_fb->lmt += req->sz;
+		coal->len[impl.req_proc.coal_cnt++] = (uint16_t)req->sz;
+		TAILQ_INSERT_TAIL(&impl.req_proc.dma[dma_idx].coal_list, req, qent);
+	}
+
+	if (impl.req_proc.coal_cnt <= 0) return 0;
+
+	// nothing queued or the next still landing
+	if ((!req || *hold >= 0) && impl.req_proc.coal_cnt < DW_SPI2_COAL_MAX
+			&& dma_fb->lmt < dma_fb->cap) {
+		// wait more when bus busy, or the one landing before delay
+		if (impl.req_proc.bus_busy) return 0;
+		if (*hold < 0) goto close;
+		ts = dw_ts_us() - impl.req_proc.coal_ts;
+		if (ts < impl.req_proc.coal_us) {
+			spi2_coal_tmr_arm(impl.req_proc.coal_us - ts);
+			return 0;
+		}
+	}
+
+close:
+	coal->magic = DW_SPI2_COAL_MAGIC;
+	coal->cnt = (uint16_t)impl.req_proc.coal_cnt;
+	impl.st.coal_txn++;
+	impl.st.coal_sub += impl.req_proc.coal_cnt;
+	impl.req_proc.dma[dma_idx].req = NULL;
+	impl.req_proc.dma[dma_idx].fin = 0;
+	impl.req_proc.dma_wr++;
+	impl.req_proc.coal_cnt = 0;
+	return 1;
+}
+
+/** Latest descriptor in flight carry the request, NULL when none. */
+static spi2_dma_t* spi2_dma_last(dw_spi2_req_t *req) {
+	unsigned i;
+
+	for (i = impl.req_proc.dma_wr; i != impl.req_proc.dma_rd; ) {
+		i--;
+		if (impl.req_proc.dma[i % impl.cfg.dma_cnt].req == req) {
+			return &impl.req_proc.dma[i % impl.cfg.dma_cnt];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Copy one trunk landed below watermark to free descriptor, launch the next
+ * queued request of the class as soon as previous staged.
+ *
+ * Caller hold req_proc.lock.
+ *
+ * @return 1 when trunk staged or request retired, 0 when nothing to stage
+ */
+static int spi2_stage_trunk(int prio) {
+	spi2_stage_t *stg = &impl.req_proc.stage[prio];
+	dw_spi2_req_t *req;
+	spi2_dma_t *dma;
+	size_t sz;
+
+	if (!(req = stg->req)) {
+		if (!(req = spi2_req_pop(prio, stg->chain))) return 0;
+		spi2_stage_init(stg, req);
+	}
+
+	stg->fb.lmt = req->sz;
+	if (stg->fb.pos >= stg->fb.lmt) {
+		stg->chain = req->more ? req->chain : NULL;
+
+		// done with last trunk, or immediately when nothing in flight
+		if ((dma = spi2_dma_last(req))) {
+			dma->fin = 1;
+		} else {
+			spi2_req_recycle(req);
+		}
+		stg->req = NULL;
+		return 1;
+	}
+
+	// cut-through, transmit whole trunk or the tail of request
+	sz = aloe_min(impl.cfg.trunk_sz, stg->fb.lmt - stg->fb.pos);
+	if (req->wmk < stg->fb.pos + sz) return 0;
+
+	dma = &impl.req_proc.dma[impl.req_proc.dma_wr % impl.cfg.dma_cnt];
+	spi2_stage_gather(stg, dma->fb.data, sz);
+	dma->fb.pos = 0;
+	dma->fb.lmt = sz;
+	dma->req = req;
+	dma->fin = 0;
+	impl.req_proc.dma_wr++;
+	stg->fb.pos += sz;
+	return 1;
+}
+
+/** Any request or chain in staging, req_proc.lock held. */
+static int spi2_stage_busy(void) {
+	int prio;
+
+	for (prio = 0; prio < DW_SPI2_PRIO_CNT; prio++) {
+		if (impl.req_proc.stage[prio].req
+				|| impl.req_proc.stage[prio].chain) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Class with request or chain partly on the bus, -1 when none, req_proc.lock
+ * held.
+ */
+static int spi2_stage_cont(void) {
+	spi2_stage_t *stg;
+	int prio;
+
+	for (prio = DW_SPI2_PRIO_CNT - 1; prio >= 0; prio--) {
+		stg = &impl.req_proc.stage[prio];
+		if ((stg->req && stg->fb.pos > 0) || stg->chain) return prio;
+	}
+	return -1;
+}
+
+/**
+ * Fill free descriptor, class picked again at every request or chain
+ * boundary so higher class jump ahead of the lower one in staging.  Trunks
+ * of different class not interleave on the bus.
+ *
+ * Caller hold req_proc.lock.
+ */
+static void spi2_dma_stage(void) {
+	int prio, hold;
+
+	while (impl.req_proc.dma_wr - impl.req_proc.dma_rd < impl.cfg.dma_cnt) {
+		hold = -1;
+
+		// finish the one partly on the bus
+		if ((prio = spi2_stage_cont()) >= 0) {
+			if (!spi2_stage_trunk(prio)) break;
+			continue;
+		}
+
+		// also close the one left open when disabled
+		if ((impl.req_proc.coal_us > 0 || impl.req_proc.coal_cnt > 0)
+				&& !spi2_stage_busy()) {
+			if (spi2_dma_coal(&hold)) continue;
+
+			// wait more sub-frame
+			if (impl.req_proc.coal_cnt > 0) break;
 		}
 
-		impl.req_proc.req = req;
-		impl.req_proc.fb.data = (void*)req->data;
-		impl.req_proc.fb.lmt = impl.req_proc.fb.cap = req->sz;
-		impl.req_proc.fb.pos = aloe_min(DW_SPI_TRUNK_SIZE, req->sz);
-		if ((r = dw_spi2_send_start(req->data, impl.req_proc.fb.pos)) <= 0) {
-			log_e("Failed start send, err: %d\n", r);
-			impl.req_proc.req = NULL;
+		// lower class staged when higher wait for data of the first trunk
+		for (prio = DW_SPI2_PRIO_CNT - 1; prio >= 0; prio--) {
+			// packed when landed
+			if (prio == hold) continue;
+			if (spi2_stage_trunk(prio)) break;
+		}
+		if (prio < 0) break;
+	}
+}
+
+/** Retire the descriptor on the bus, req_proc.lock held. */
+static void spi2_dma_done(void) {
+	int dma_idx = impl.req_proc.dma_rd % impl.cfg.dma_cnt;
+	dw_spi2_req_t *req;
+
+	impl.req_proc.bus_busy = 0;
+	if (impl.req_proc.dma_wr == impl.req_proc.dma_rd) {
+		log_e("Sanity check no descriptor in flight\n");
+		return;
+	}
+	if (impl.req_proc.dma[dma_idx].fin) {
+		spi2_req_recycle(impl.req_proc.dma[dma_idx].req);
+	}
+	while ((req = TAILQ_FIRST(&impl.req_proc.dma[dma_idx].coal_list))) {
+		TAILQ_REMOVE(&impl.req_proc.dma[dma_idx].coal_list, req, qent);
+		spi2_req_recycle(req);
+	}
+	impl.req_proc.dma[dma_idx].req = NULL;
+	if (impl.req_proc.dma[dma_idx].rx) {
+		spi2_rx_done(impl.req_proc.dma[dma_idx].rx);
+		impl.req_proc.dma[dma_idx].rx = NULL;
+	}
+	impl.req_proc.dma_rd++;
+}
+
+#if spi2_bus_mock_loopback
+/** Owner of the transaction, NULL when coalesced from many. */
+static const void* spi2_dma_chain(spi2_dma_t *dma) {
+	dw_spi2_req_t *req;
+	const void *chain;
+
+	if (dma->req) return dma->req->chain;
+	if (!(req = TAILQ_FIRST(&dma->coal_list))) return NULL;
+	for (chain = req->chain; (req = TAILQ_NEXT(req, qent)); ) {
+		if (req->chain != chain) return NULL;
+	}
+	return chain;
+}
+#endif
+
+/**
+ * Stage trunks and keep the bus busy.
+ *
+ * Caller hold req_proc.lock.
+ *
+ * @return 0 when wait for more data or bus, -1 when failed
+ */
+static int spi2_req_pump(void) {
+	spi2_dma_t *dma;
+	int r = 0;
+
+	while (1) {
+		spi2_dma_stage();
+
+		if (impl.req_proc.bus_busy
+				|| impl.req_proc.dma_wr == impl.req_proc.dma_rd) {
+			break;
+		}
+		dma = &impl.req_proc.dma[impl.req_proc.dma_rd % impl.cfg.dma_cnt];
+		dma->rx = spi2_rx_pop();
+#if spi2_bus_mock_loopback
+		// echo back to the owner only
+		if (dma->rx && !impl.bus.sink) dma->rx->chain = spi2_dma_chain(dma);
+#endif
+		impl.req_proc.bus_busy = 1;
+		if ((r = spi2_bus_start(dma->fb.data, dma->fb.lmt, dma->rx)) == 0) {
 			break;
 		}
-		// hand over to isr
-		req = NULL;
-	} while(0);
+		if (r < 0) log_e("Failed start send, err: %d\n", r);
+
+		// drop failed trunk as done
+		spi2_dma_done();
+	}
+	return r < 0 ? -1 : 0;
+}
+
+#if !defined(ALOE_SYS_LINUX)
+/** Resume pump out of request flow, ie. coalescing delay. */
+static void spi2_req_kick(void *args) {
+	(void)args;
+
+	if (aloe_sem_wait(&impl.req_proc.lock, NULL, aloe_dur_infinite,
+			"spi2") != 0) {
+		log_e("lock\n");
+		return;
+	}
+	spi2_req_pump();
+	aloe_sem_post(&impl.req_proc.lock, NULL, "spi2");
+}
+#endif
+
+int dw_spi2_coalesce(unsigned delay_us) {
+#if !defined(ALOE_SYS_LINUX)
+	esp_timer_create_args_t tmr_args = {
+		.callback = &spi2_req_kick,
+		.name = "spi2coal",
+	};
+#endif
+
+	if (!impl.ready) {
+		log_e("Not initialized\n");
+		return -1;
+	}
+
+#if !defined(ALOE_SYS_LINUX)
+	if (!impl.req_proc.coal_tmr && esp_timer_create(&tmr_args,
+			&impl.req_proc.coal_tmr) != ESP_OK) {
+		log_e("Failed create timer\n");
+		return -1;
+	}
+#endif
+	if (aloe_sem_wait(&impl.req_proc.lock, NULL, aloe_dur_infinite,
+			"spi2") != 0) {
+		log_e("lock\n");
+		return -1;
+	}
+	impl.req_proc.coal_us = delay_us;
+
+	// flush sub-frame packed
+	spi2_req_pump();
+	aloe_sem_post(&impl.req_proc.lock, NULL, "spi2");
+	return 0;
+}
+
+#if spi2_bus_mock_timing
+/**
+ * Transaction on the bus from the clock, and the coalescing delay.
+ *
+ * Waked by spi2_bus_start() or spi2_coal_tmr_arm(), tell by bus_busy.
+ */
+static void spi2_bus_task(aloe_thread_t *args) {
+	unsigned long us, dur = aloe_dur_infinite;
+	long due = 0;
+
+	(void)args;
+
+	while (!impl.quit) {
+		// less than the millisecond of semaphore timeout
+		if (dur == 0 && due > 0) aloe_thread_usleep(due);
+		aloe_sem_wait(&impl.bus.start, NULL, dur, "spi2bus");
+
+		if (aloe_sem_wait(&impl.req_proc.lock, NULL, aloe_dur_infinite,
+				"spi2") != 0) {
+			log_e("lock\n");
+			continue;
+		}
+		if (impl.req_proc.bus_busy) {
+			aloe_sem_post(&impl.req_proc.lock, NULL, "spi2");
+
+			// 8 bits per byte
+			us = (unsigned long)impl.bus.sz * 8 * 1000 / impl.clk_khz;
+			if (us > 0) aloe_thread_usleep(us);
+
+			if (aloe_sem_wait(&impl.req_proc.lock, NULL, aloe_dur_infinite,
+					"spi2") != 0) {
+				log_e("lock\n");
+				continue;
+			}
+			spi2_dma_done();
+			spi2_req_pump();
+		} else if (impl.req_proc.coal_armed
+				&& (long)(impl.req_proc.coal_due - dw_ts_us()) <= 0) {
+			impl.req_proc.coal_armed = 0;
+			spi2_req_pump();
+		}
+
+		// sleep till the bus started or the coalescing due
+		dur = aloe_dur_infinite;
+		due = 0;
+		if (impl.req_proc.coal_armed) {
+			due = (long)(impl.req_proc.coal_due - dw_ts_us());
+			dur = due <= 0 ? 0 : (unsigned long)due / 1000;
+		}
+		aloe_sem_post(&impl.req_proc.lock, NULL, "spi2");
+	}
+}
+#endif
+
+#if spi2_bus_mock_loopback
+int dw_spi2_mock_sink(size_t (*sink)(const void*, size_t, void*, size_t,
+		void*), void *cbarg) {
+	if (!impl.ready) {
+		log_e("Not initialized\n");
+		return -1;
+	}
+	if (aloe_sem_wait(&impl.req_proc.lock, NULL, aloe_dur_infinite,
+			"spi2") != 0) {
+		log_e("lock\n");
+		return -1;
+	}
+	impl.bus.sink_cbarg = cbarg;
+	impl.bus.sink = sink;
+	aloe_sem_post(&impl.req_proc.lock, NULL, "spi2");
+	return 0;
+}
+#endif
 
-	if (req && req->cb) (*req->cb)(req->cbarg);
+int dw_spi2_req_wmk(dw_spi2_req_t *req, size_t wmk, unsigned fin) {
+	if (aloe_sem_wait(&impl.req_proc.lock, NULL, aloe_dur_infinite,
+			"spi2") != 0) {
+		log_e("lock\n");
+		return -1;
+	}
+	if (wmk > req->sz) wmk = req->sz;
+	req->wmk = wmk;
+	if (fin) {
+		req->sz = wmk;
+		req->more = 0;
+	}
+
+	// resume the request wait for data, or landed for coalescing
+	if (req == impl.req_proc.stage[req->prio].req
+			|| (impl.req_proc.coal_us > 0 && wmk >= req->sz)) {
+		spi2_req_pump();
+	}
+
+	aloe_sem_post(&impl.req_proc.lock, NULL, "spi2");
+	return 0;
+}
+
+/** Deliver received frame outside the lock. */
+static void spi2_rx_deliver(void) {
+	dw_spi2_rx_t *rx;
+	void (*cb)(dw_spi2_rx_t*, void*);
+	void *cbarg;
+
+	while (1) {
+		if (aloe_sem_wait(&impl.lock, NULL, aloe_dur_infinite, "spi2") != 0) {
+			log_e("lock\n");
+			return;
+		}
+		if ((rx = TAILQ_FIRST(&impl.rx.done_list))) {
+			TAILQ_REMOVE(&impl.rx.done_list, rx, qent);
+		}
+		cb = impl.rx.cb;
+		cbarg = impl.rx.cbarg;
+		aloe_sem_post(&impl.lock, NULL, "spi2");
+
+		if (!rx) break;
+		if (cb) {
+			(*cb)(rx, cbarg);
+		} else {
+			dw_spi2_rx_free(rx);
+		}
+	}
+}
+
+/** Log per class queue depth and wait, then reset. */
+static void spi2_prio_log(void) {
+	int prio;
+
+	if (aloe_sem_wait(&impl.lock, NULL, aloe_dur_infinite, "spi2") != 0) {
+		log_e("lock\n");
+		return;
+	}
+	for (prio = DW_SPI2_PRIO_CNT - 1; prio >= 0; prio--) {
+		if (impl.st.prio[prio].cnt == 0) continue;
+		log_d("prio%d depth: %u, max: %u, cnt: %lu, wait avg: %lu, max: %lu us\n",
+				prio, impl.st.prio[prio].depth, impl.st.prio[prio].depth_max,
+				impl.st.prio[prio].cnt,
+				impl.st.prio[prio].wait_us / impl.st.prio[prio].cnt,
+				impl.st.prio[prio].wait_max);
+		impl.st.prio[prio].depth_max = impl.st.prio[prio].depth;
+		impl.st.prio[prio].cnt = 0;
+		impl.st.prio[prio].wait_us = impl.st.prio[prio].wait_max = 0;
+	}
+	aloe_sem_post(&impl.lock, NULL, "spi2");
+	if (impl.st.coal_txn > 0) {
+		log_d("coalesced: %lu, sub-frame: %lu\n", impl.st.coal_txn,
+				impl.st.coal_sub);
+	}
+	if (impl.rx.cb) {
+		log_d("rx used max: %u / %u\n", impl.rx.pool->used_max,
+				impl.rx.pool->cnt);
+	}
 }
 
 static void spi2_slave_task(aloe_thread_t *args) {
 	mq_msg_t *msg;
+	unsigned long rx_drop;
 	dw_spi2_req_t *req;
 
 	(void)args;
 
-	log_d("SPI slave start, trunk size: %d, SPI2%s\n",
-			DW_SPI_TRUNK_SIZE,
+	log_d("SPI slave start, trunk size: %u, descriptor: %u, rx: %u, SPI2%s\n",
+			impl.cfg.trunk_sz, impl.cfg.dma_cnt, impl.cfg.rx_cnt,
+#if spi2_bus_mock_timing
+			", mock bus timing"
+#else
 			", mock api"
+#endif
 			);
 
 	while (!impl.quit) {
-		if (xQueueReceive(impl.mq, &msg, aloe_msDur(1000)) != pdPASS) {
+		if (aloe_mq_recv(&impl.mq, &msg, NULL, 1000) != 0) {
 			msg = NULL;
 			if (impl.st.recycle_corrupt) {
 				log_e("recycle_corrupt: %d\n", impl.st.recycle_corrupt);
 //				impl.st.recycle_corrupt = 0;
 			}
-		}
-		if (impl.req_proc.req_recycle) {
-//			log_d("SPI req gc\n");
-			spi2_req_gc(impl.req_proc.req_recycle);
+			if ((rx_drop = aloe_atomic_xchg(&impl.st.rx_drop, 0))) {
+				log_e("rx_drop: %lu\n", rx_drop);
+			}
 		}
 		if (msg) {
-			while ((req = dw_spi2_req_pop(&impl.req_list, &impl.lock))) {
-				spi2_req_proc2(req);
+			// callback outside the lock
+			while ((req = dw_spi2_req_pop(&impl.req_proc.recycle_list,
+					&impl.req_proc.lock))) {
+//				log_d("SPI req gc\n");
+				spi2_req_gc(req);
 			}
+			spi2_rx_deliver();
+		}
+		if (dw_ts_us() - impl.st.prio_ts >= spi2_prio_log_us) {
+			impl.st.prio_ts = dw_ts_us();
+			spi2_prio_log();
 		}
 	}
+#if !defined(ALOE_SYS_LINUX)
 	vTaskDelete(NULL);
+#endif
+}
+
+/** Release memory taken in dw_spi2_start(). */
+static void spi2_mem_free(void) {
+	aloe_pool_destroy(impl.rx.pool);
+	aloe_mem_free(impl.xfer_alloc);
 }
 
-int dw_spi2_start(unsigned master, unsigned clkDiv) {
+int dw_spi2_start(unsigned master, unsigned clkDiv, const dw_spi2_cfg_t *cfg) {
+	int i;
+	char *buf;
+	dw_spi2_rx_t *rx;
+	dw_spi2_cfg_t geo = {};
 
 	(void)master;
-	(void)clkDiv;
 
 	if (impl.ready) {
 		log_e("Already initialized\n");
 		return -1;
 	}
 
+	if (cfg) geo = *cfg;
+	if (geo.trunk_sz == 0) geo.trunk_sz = DW_SPI_TRUNK_SIZE;
+	if (geo.dma_cnt == 0) geo.dma_cnt = spi2_dma_cnt;
+	if (geo.rx_cnt == 0) geo.rx_cnt = spi2_rx_cnt;
+	if (geo.trunk_sz < spi2_trunk_min || geo.trunk_sz > spi2_trunk_max
+			|| geo.trunk_sz % 4) {
+		log_e("Invalid trunk size %u\n", geo.trunk_sz);
+		return -1;
+	}
+	if (geo.dma_cnt < 1 || geo.dma_cnt > spi2_dma_max) {
+		log_e("Invalid descriptor count %u\n", geo.dma_cnt);
+		return -1;
+	}
+	if (geo.rx_cnt < 1) {
+		log_e("Invalid rx count %u\n", geo.rx_cnt);
+		return -1;
+	}
+
 	memset(&impl, 0, sizeof(impl));
-	TAILQ_INIT(&impl.req_list);
+	impl.cfg = geo;
+	for (i = 0; i < DW_SPI2_PRIO_CNT; i++) TAILQ_INIT(&impl.req_list[i]);
+	TAILQ_INIT(&impl.req_proc.recycle_list);
+	TAILQ_INIT(&impl.rx.done_list);
 	impl.spis_tx_done = impl.spis_rx_done = 1;
 	impl.spim_tx_done = impl.spim_rx_done = 1;
+	impl.clk_khz = clkDiv > 0 ? clkDiv : 1000;
 
+	// receive frame (dw_spi2_rx_t, 32 align, headroom and trunk) in the pool
+	if (!(impl.rx.pool = aloe_pool_create(aloe_mem_id_psram,
+			spi2_rx_hdr_sz + spi2_rx_sz, impl.cfg.rx_cnt, 32, "spi2_rx"))) {
+		log_e("alloc pool\n");
+		return -1;
+	}
+	for (i = 0; i < (int)impl.cfg.rx_cnt; i++) {
+		rx = (dw_spi2_rx_t*)aloe_pool_obj(impl.rx.pool, i);
+		memset(rx, 0, sizeof(*rx));
+		rx->fb.data = (char*)rx + spi2_rx_hdr_sz;
+		rx->fb.cap = spi2_rx_sz;
+	}
+
+	/*
+	 * 32 align, dma buffer[dma_cnt], trunk round up keep every buffer
+	 * aligned
+	 */
 	if (!(impl.xfer_alloc = (void*)aloe_mem_malloc(aloe_mem_id_psram,
-			32 + DW_SPI_TRUNK_SIZE,
+			32 + aloe_roundup(impl.cfg.trunk_sz, 32) * impl.cfg.dma_cnt,
 			"spi2"))) {
 		log_e("alloc buffer\n");
+		aloe_pool_destroy(impl.rx.pool);
 		return -1;
 	}
 	impl.xfer = (void*)aloe_roundup((unsigned long)impl.xfer_alloc, 32);
+	buf = impl.xfer;
+	for (i = 0; i < (int)impl.cfg.dma_cnt; i++) {
+		TAILQ_INIT(&impl.req_proc.dma[i].coal_list);
+		impl.req_proc.dma[i].fb.data = buf;
+		impl.req_proc.dma[i].fb.cap = impl.cfg.trunk_sz;
+		buf += aloe_roundup(impl.cfg.trunk_sz, 32);
+	}
 
-	if (!(impl.mq = xQueueCreate(20, sizeof(mq_msg_t*)))) {
+	if (aloe_mq_init(&impl.mq, 20, sizeof(mq_msg_t*), "spi2") != 0) {
 		log_e("Failed alloc mq\n");
-		aloe_mem_free(impl.xfer_alloc);
+		spi2_mem_free();
 		return -1;
 	}
 
 	if (aloe_sem_init(&impl.lock, 1, 1, "spi2") != 0) {
 		log_e("Failed init lock\n");
-		vQueueDelete(impl.mq);
-		aloe_mem_free(impl.xfer_alloc);
+		aloe_mq_destroy(&impl.mq);
+		spi2_mem_free();
+		return -1;
+	}
+
+	if (aloe_sem_init(&impl.req_proc.lock, 1, 1, "spi2_proc") != 0) {
+		log_e("Failed init lock\n");
+		aloe_mq_destroy(&impl.mq);
+		spi2_mem_free();
+		aloe_sem_destroy(&impl.lock);
+		return -1;
+	}
+
+#if spi2_bus_mock_timing
+	if (aloe_sem_init(&impl.bus.start, impl.cfg.dma_cnt, 0, "spi2bus") != 0) {
+		log_e("Failed init lock\n");
+		aloe_mq_destroy(&impl.mq);
+		spi2_mem_free();
+		aloe_sem_destroy(&impl.req_proc.lock);
+		aloe_sem_destroy(&impl.lock);
+		return -1;
+	}
+
+	if (aloe_thread_run(&impl.bus.tsk,
+			&spi2_bus_task,
+			2048, DECKWIFI_THREAD_PRIO_SPIS, "spi2_bus") != 0) {
+		log_e("Failed start mock bus\n");
+		aloe_mq_destroy(&impl.mq);
+		spi2_mem_free();
+		aloe_sem_destroy(&impl.bus.start);
+		aloe_sem_destroy(&impl.req_proc.lock);
+		aloe_sem_destroy(&impl.lock);
 		return -1;
 	}
+#endif
 
 	if (aloe_thread_run(&impl.tsk,
 			&spi2_slave_task,
 			2048, DECKWIFI_THREAD_PRIO_SPIS, "spi2_slv") != 0) {
 		log_e("Failed start looper\n");
-		vQueueDelete(impl.mq);
-		aloe_mem_free(impl.xfer_alloc);
+#if spi2_bus_mock_timing
+		impl.quit = 1;
+		aloe_sem_post(&impl.bus.start, NULL, "spi2bus");
+#endif
+		aloe_mq_destroy(&impl.mq);
+		spi2_mem_free();
+		aloe_sem_destroy(&impl.req_proc.lock);
 		aloe_sem_destroy(&impl.lock);
 		return -1;
 	}
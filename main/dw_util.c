@@ -12,8 +12,10 @@
 #include <ctype.h>
 #include "dw_util.h"
 
-#define log_d(_fmt...) dw_log_m("[Debug]", _fmt)
-#define log_e(_fmt...) dw_log_m("[ERROR]", _fmt)
+#define log_d(...) aloe_log_d(__VA_ARGS__)
+#define log_e(...) aloe_log_e(__VA_ARGS__)
+
+#define hist_sub_cnt (1 << DW_HIST_SUB_BITS)
 
 ALOE_SYS_BSS1_SECTION
 static const char *xp = NULL;
@@ -56,3 +58,196 @@ void _dw_dump16(const void *data, size_t sz, const char *func, long lno,
 	}
 	printf("%d <%s \"%s\">\n", (int)sz, str1, str2);
 }
+
+ALOE_SYS_TEXT1_SECTION
+void dw_hist_add(dw_hist_t *hist, unsigned long val) {
+	uint32_t v = (uint32_t)aloe_min(val, (1ul << DW_HIST_EXP_MAX) - 1);
+	int e, idx;
+
+	if (v < hist_sub_cnt * 2) {
+		idx = v;
+	} else {
+		e = 31 - __builtin_clz(v);
+		idx = ((e - DW_HIST_SUB_BITS + 1) << DW_HIST_SUB_BITS)
+				+ ((v >> (e - DW_HIST_SUB_BITS)) & (hist_sub_cnt - 1));
+	}
+	hist->bkt[idx]++;
+	hist->cnt++;
+	hist->sum += val;
+	if (val > hist->max) hist->max = val;
+}
+
+ALOE_SYS_TEXT1_SECTION
+unsigned long dw_hist_pct(const dw_hist_t *hist, double pct) {
+	unsigned long acc = 0, want;
+	int idx, e;
+
+	if (hist->cnt == 0) return 0;
+	want = (unsigned long)(pct / 100.0 * hist->cnt + 0.5);
+	if (want < 1) want = 1;
+	for (idx = 0; idx < DW_HIST_CNT - 1; idx++) {
+		if ((acc += hist->bkt[idx]) >= want) break;
+	}
+	if (idx < hist_sub_cnt * 2) return idx;
+	e = (idx >> DW_HIST_SUB_BITS) + DW_HIST_SUB_BITS - 1;
+	return (unsigned long)(hist_sub_cnt + (idx & (hist_sub_cnt - 1)))
+			<< (e - DW_HIST_SUB_BITS);
+}
+
+ALOE_SYS_TEXT1_SECTION
+void dw_hist_log(const dw_hist_t *hist, const char *name) {
+	log_d("%s cnt: %lu, avg: %lu, p50: %lu, p90: %lu, p99: %lu, p999: %lu, "
+			"max: %lu\n", name, hist->cnt,
+			hist->cnt ? (unsigned long)(hist->sum / hist->cnt) : 0ul,
+			dw_hist_pct(hist, 50), dw_hist_pct(hist, 90),
+			dw_hist_pct(hist, 99), dw_hist_pct(hist, 99.9), hist->max);
+}
+
+/* Entry of asynchronous logger, message follow. */
+typedef struct {
+	unsigned long ms;
+	const char *tag;
+	int lvl, lno;
+	char msg[];
+} log_ent_t;
+
+ALOE_SYS_BSS1_SECTION
+static struct {
+	int ready;
+
+	// drain task wait wake when idle
+	int idle;
+	aloe_sem_t wake;
+	aloe_thread_t tsk;
+
+	aloe_mpsc_t ring;
+	unsigned msg_sz;
+	unsigned long drop;
+} log_impl;
+
+#define log_idle_ms 100
+
+static void log_task(aloe_thread_t *args) {
+	log_ent_t *ent;
+	unsigned long drop, drop_rpt = 0;
+	char pfx[100];
+
+	(void)args;
+
+	for (;;) {
+		if ((drop = aloe_atomic_load(&log_impl.drop)) != drop_rpt) {
+			printf("[log] dropped %lu\n", drop - drop_rpt);
+			drop_rpt = drop;
+		}
+		if (!(ent = aloe_mpsc_peek(&log_impl.ring))) {
+			aloe_atomic_xchg(&log_impl.idle, 1);
+
+			// timeout cover the producer missed idle
+			if (!(ent = aloe_mpsc_peek(&log_impl.ring))) {
+				fflush(stdout);
+				aloe_sem_wait(&log_impl.wake, NULL, log_idle_ms, "dw_log");
+				continue;
+			}
+			aloe_atomic_store(&log_impl.idle, 0);
+		}
+		aloe_log_prefix(pfx, sizeof(pfx), ent->ms, ent->lvl, ent->tag,
+				ent->lno);
+		printf("%s%s", pfx, ent->msg);
+		aloe_mpsc_release(&log_impl.ring);
+	}
+}
+
+int dw_log_async_start(unsigned cnt, unsigned msg_sz, int prio) {
+	void *buf = NULL;
+
+	if (log_impl.ready) return 0;
+	if (cnt < 2 || (cnt & (cnt - 1)) || msg_sz < 32) {
+		log_e("Invalid log ring %u x %u\n", cnt, msg_sz);
+		return -1;
+	}
+	if (!(buf = aloe_mem_malloc(aloe_mem_id_stdc,
+			aloe_mpsc_size(sizeof(log_ent_t) + msg_sz, cnt), "dw_log"))) {
+		log_e("Failed alloc log ring\n");
+		return -1;
+	}
+	aloe_mpsc_init(&log_impl.ring, buf, sizeof(log_ent_t) + msg_sz, cnt);
+	log_impl.msg_sz = msg_sz;
+	log_impl.drop = 0;
+	log_impl.idle = 0;
+	if (aloe_sem_init(&log_impl.wake, 1, 0, "dw_log") != 0) {
+		log_e("Failed init log wake\n");
+		aloe_mem_free(buf);
+		return -1;
+	}
+	if (aloe_thread_run(&log_impl.tsk, &log_task, 3072, prio,
+			"dw_log") != 0) {
+		log_e("Failed start log task\n");
+		aloe_sem_destroy(&log_impl.wake);
+		aloe_mem_free(buf);
+		return -1;
+	}
+	aloe_atomic_store(&log_impl.ready, 1);
+	return 0;
+}
+
+ALOE_SYS_TEXT1_SECTION
+int dw_log_async_add_va(int lvl, const char *tag, long lno, const char *fmt,
+		va_list va) {
+	log_ent_t *ent;
+	int r;
+
+	if (!aloe_atomic_load(&log_impl.ready)) return -1;
+	if (!(ent = aloe_mpsc_reserve(&log_impl.ring))) {
+		aloe_atomic_add(&log_impl.drop, 1);
+		return 0;
+	}
+	ent->ms = aloe_tick2ms(aloe_ticks());
+	ent->tag = tag;
+	ent->lvl = lvl;
+	ent->lno = (int)lno;
+	if ((r = vsnprintf(ent->msg, log_impl.msg_sz, fmt, va)) < 0) {
+		ent->msg[0] = '\0';
+	} else if ((unsigned)r >= log_impl.msg_sz) {
+		aloe_strabbr(ent->msg, log_impl.msg_sz, NULL);
+	}
+	aloe_mpsc_commit(&log_impl.ring, ent);
+	if (aloe_atomic_load(&log_impl.idle)
+			&& aloe_atomic_xchg(&log_impl.idle, 0)) {
+		aloe_sem_post(&log_impl.wake, NULL, "dw_log");
+	}
+	return 0;
+}
+
+unsigned long dw_log_async_drop(void) {
+	return aloe_atomic_load(&log_impl.drop);
+}
+
+int dw_log_async_flush(long dur) {
+	unsigned long ts0 = aloe_tick2ms(aloe_ticks());
+
+	if (!aloe_atomic_load(&log_impl.ready)) return 0;
+
+	// poll the head the drain task not yet released
+	while (aloe_mpsc_peek(&log_impl.ring)) {
+		if (aloe_tick2ms(aloe_ticks()) - ts0 >= (unsigned long)dur) return -1;
+		aloe_thread_sleep(10);
+	}
+	return 0;
+}
+
+void dw_log_async_panic(int (*out)(const char *fmt, ...)) {
+	log_ent_t *ent;
+	unsigned i;
+	char pfx[100];
+
+	if (!aloe_atomic_load(&log_impl.ready)) return;
+
+	// at most one round, producer may still run on the other core
+	for (i = 0; i <= log_impl.ring.m
+			&& (ent = aloe_mpsc_peek(&log_impl.ring)); i++) {
+		aloe_log_prefix(pfx, sizeof(pfx), ent->ms, ent->lvl, ent->tag,
+				ent->lno);
+		(*out)("%s%s", pfx, ent->msg);
+		aloe_mpsc_release(&log_impl.ring);
+	}
+}
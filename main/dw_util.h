@@ -14,30 +14,114 @@
 
 #include <aloe_sys.h>
 
+#if !defined(ALOE_SYS_LINUX)
+#  include <esp_timer.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 #define dw_log_m(_l, _f, _args...) do { \
-	unsigned long tms = xTaskGetTickCount() * portTICK_PERIOD_MS; \
+	unsigned long tms = aloe_tick2ms(aloe_ticks()); \
 	printf("[%ld.%03ld]%s[%s][#%d] " _f, tms / 1000, tms % 1000, _l, __func__, __LINE__, ##_args); \
 } while(0)
 
-#define eh_task_prio1 (tskIDLE_PRIORITY + 1)
-#define eh_sinsvc_port 6000
+#if defined(ALOE_SYS_LINUX)
+#  define eh_task_prio1 1
+#else
+#  define eh_task_prio1 (tskIDLE_PRIORITY + 1)
+#endif
+
+#ifndef eh_sinsvc_port
+#  define eh_sinsvc_port 6000
+#endif
 
 #define ESPIPADDR_ENT(_ipinfo, _n) ((uint8_t*)&(_ipinfo)->addr)[_n]
 #define ESPIPADDR_PKARG(_ipinfo) ESPIPADDR_ENT(_ipinfo, 0), \
 	ESPIPADDR_ENT(_ipinfo, 1), ESPIPADDR_ENT(_ipinfo, 2), \
 	ESPIPADDR_ENT(_ipinfo, 3)
 
-#define DECKWIFI_THREAD_PRIO_DEF (eh_task_prio1)
+/** Dotted print of IPv4 in network byte order, ie. aloe_ifaddr_t. */
+#define DW_IPADDR_ENT(_addr, _n) ((uint8_t*)&(_addr))[_n]
+#define DW_IPADDR_PKARG(_addr) DW_IPADDR_ENT(_addr, 0), \
+	DW_IPADDR_ENT(_addr, 1), DW_IPADDR_ENT(_addr, 2), \
+	DW_IPADDR_ENT(_addr, 3)
+
+/* data path one level above the log drain, and the log above idle */
+#define DECKWIFI_THREAD_PRIO_DEF (eh_task_prio1 + 1)
 #define DECKWIFI_THREAD_PRIO_SPIS (DECKWIFI_THREAD_PRIO_DEF)
 #define DECKWIFI_THREAD_PRIO_SINSVC (DECKWIFI_THREAD_PRIO_DEF)
+#define DECKWIFI_THREAD_PRIO_LOG (eh_task_prio1)
 #define DECKWIFI_SOCKET_SVC_PORT eh_sinsvc_port
-#define DW_SPI_TRUNK_SIZE 1024
+#ifndef DW_SPI_TRUNK_SIZE
+#  define DW_SPI_TRUNK_SIZE 1024
+#endif
 #define SPI_BY_DMA 1
 
+/** Microsecond clock, aloe_ticks() on Linux to follow virtual clock. */
+#if defined(ALOE_SYS_LINUX)
+#  define dw_ts_us() ((unsigned long)aloe_ticks())
+#else
+#  define dw_ts_us() ((unsigned long)esp_timer_get_time())
+#endif
+
+/*
+ * Log bucket histogram, exact below 16 then 8 sub-bucket per power of 2,
+ * ie. within 12.5%, clamp to the last bucket from 2^24.
+ */
+#define DW_HIST_SUB_BITS 3
+#define DW_HIST_EXP_MAX 24
+#define DW_HIST_CNT ((DW_HIST_EXP_MAX - DW_HIST_SUB_BITS + 1) << DW_HIST_SUB_BITS)
+
+typedef struct {
+	uint32_t bkt[DW_HIST_CNT];
+	unsigned long cnt, max;
+	unsigned long long sum;
+} dw_hist_t;
+
+void dw_hist_add(dw_hist_t*, unsigned long val);
+
+/** Lower bound of the bucket reach pct percent of count, 0 when empty. */
+unsigned long dw_hist_pct(const dw_hist_t*, double pct);
+
+/** Log count, avg, p50, p90, p99, p999 and max in one line. */
+void dw_hist_log(const dw_hist_t*, const char *name);
+
+/**
+ * Asynchronous logger.  Caller format the message into the lock-free ring and
+ * return, the task print in order.  Ring full drop the message and count,
+ * the task report the count before the next.
+ *
+ * @param cnt Message count, power of 2
+ * @param msg_sz Longer message truncated with abbreviation
+ * @param prio Task priority, ie. DECKWIFI_THREAD_PRIO_LOG
+ */
+int dw_log_async_start(unsigned cnt, unsigned msg_sz, int prio);
+
+/**
+ * Queue the message for aloe_log_add_va().
+ *
+ * @return -1 when not started, va untouched for the caller print itself
+ */
+int dw_log_async_add_va(int lvl, const char *tag, long lno, const char *fmt,
+		va_list va);
+
+/** Message dropped since start. */
+unsigned long dw_log_async_drop(void);
+
+/** Wait the task print queued message, -1 when timeout. */
+int dw_log_async_flush(long dur);
+
+/**
+ * Print queued message from panic handler, the drain task not run anymore.
+ * The one the task was printing may show twice.  Code and tag in flash, call
+ * only with the flash cache on.
+ *
+ * @param out Printer safe in panic, ie. esp_rom_printf
+ */
+void dw_log_async_panic(int (*out)(const char *fmt, ...));
+
 /** Get LP or HP. */
 const char *dw_xp(int var);
 
@@ -20,6 +20,10 @@
 #include <esp_system.h>
 #include <esp_wifi.h>
 #include <esp_event.h>
+#include <esp_rom_sys.h>
+#include <esp_attr.h>
+#include <esp_private/panic_internal.h>
+#include <esp_private/cache_utils.h>
 #include <nvs_flash.h>
 
 #include <lwip/err.h>
@@ -38,6 +42,12 @@
 //#define log_e(...) dw_log_m("[ERROR]", ##__VA_ARGS__)
 #define log_e(...) aloe_log_e(__VA_ARGS__)
 #define log_d(...) aloe_log_d(__VA_ARGS__)
+
+/* log per name memory accounting every minute, off by default, along with
+ * ALOE_MEM_ACCT=1 in COMPILE_DEFINITIONS of main/CMakeLists.txt */
+#ifndef eh_mem_acct_log
+#  define eh_mem_acct_log 0
+#endif
 #define log_i(...) aloe_log_add(aloe_log_level_info, __func__, __LINE__, __VA_ARGS__)
 
 typedef enum {
@@ -52,11 +62,21 @@ typedef enum {
 	wifi_ophase_sta_deinit,
 } wifi_ophase_id_t;
 
+/* looper message posted from event handler in flight */
+#define eh_looper_msg_cnt 8
+
+/* asynchronous log ring, message over the size truncated */
+#define eh_log_ring_cnt 32
+#define eh_log_msg_sz 224
+
 static struct {
 	// main looper
 	dw_looper_t looper;
 	aloe_thread_t tsk;
 
+	// eh_looper_msg1_post_new() take from, handler put back
+	aloe_pool_t *msg_pool;
+
 	// led
 	float led1_duty100, led1_step;
 
@@ -90,6 +110,9 @@ void aloe_log_add_va(int lvl, const char *tag, long lno,
     typeof(eh_impl.logger) *logger = &eh_impl.logger;
 	size_t sz;
 
+	// the drain task print, synchronous before start
+	if (dw_log_async_add_va(lvl, tag, lno, fmt, va) == 0) return;
+
 	if (aloe_sem_wait(&logger->lock, NULL, aloe_dur_infinite,
 			"logger_add") != 0) {
 		return;
@@ -99,33 +122,51 @@ void aloe_log_add_va(int lvl, const char *tag, long lno,
 	aloe_sem_post(&logger->lock, NULL, "logger_add");
 }
 
+void __real_esp_panic_handler(panic_info_t *info);
+
+/**
+ * Print the log ring before panic output, linked by --wrap.  The ring print
+ * from flash, skipped when the fault left the flash cache off.
+ */
+IRAM_ATTR void __wrap_esp_panic_handler(panic_info_t *info) {
+	if (spi_flash_cache_enabled()) dw_log_async_panic(&esp_rom_printf);
+	__real_esp_panic_handler(info);
+}
+
 static void aloe_logger_init(void) {
     typeof(eh_impl.logger) *logger = &eh_impl.logger;
 
     if (aloe_sem_init(&logger->lock, 1, 1, "logger_lock") != 0) {
     	log_e("Failed init logger lock\n");
     }
+    if (dw_log_async_start(eh_log_ring_cnt, eh_log_msg_sz,
+    		DECKWIFI_THREAD_PRIO_LOG) != 0) {
+    	log_e("Failed start async logger\n");
+    }
 }
 
 static int _eh_looper_msg1_post_new(void (*handler)(dw_looper_msg_t*),
 		const char *nm, void *rt) {
 	dw_looper_msg_t *looper_msg;
 
-	if (!(looper_msg = aloe_mem_malloc(aloe_mem_id_stdc,
-			sizeof(*looper_msg), nm))) {
+	(void)nm;
+
+	if (!(looper_msg = aloe_pool_get(eh_impl.msg_pool))) {
 		log_e("Failed create looper msg\n");
 		return -1;
 	}
 	looper_msg->handler = handler;
 	if (dw_looper_add(dw_looper_main, looper_msg, aloe_dur_infinite,
 			rt) != 0) {
-		aloe_mem_free(looper_msg);
+		aloe_pool_put(eh_impl.msg_pool, looper_msg);
 		log_e("Failed send looper msg\n");
 		return -1;
 	}
 	return 0;
 }
 
+#define eh_looper_msg1_free(_msg) aloe_pool_put(eh_impl.msg_pool, _msg)
+
 #define eh_looper_msg1_post_new(_hdl, _nm) \
 	_eh_looper_msg1_post_new(_hdl, _nm, _NULL)
 
@@ -231,13 +272,13 @@ static void eh_wifi_feedback(dw_looper_msg_t *looper_msg) {
 				ESPIPADDR_PKARG(&ipinfo.ip), ESPIPADDR_PKARG(&ipinfo.netmask),
 				ESPIPADDR_PKARG(&ipinfo.gw));
 
-		dw_sinsvc2_init();
+		dw_sinsvc2_init(NULL);
 		goto finally;
 	}
 
 	log_d("Sanity check unexpected wifi_ophase: %d\n", eh_impl.wifi.ophase);
 finally:
-	aloe_mem_free(looper_msg);
+	eh_looper_msg1_free(looper_msg);
 }
 
 static void eh_wifi_event_handler(void *arg, esp_event_base_t event_base,
@@ -367,18 +408,22 @@ static void eh_looper_task(aloe_thread_t *args) {
 #define looperRound(_dur) (((_dur) + looperDur - 1) / looperDur)
 
 #define outputHeapSizeDur 10000
+#define outputMemAcctDur 60000
 
 	static int outputHeapSizeCountDown = 0;
+#if eh_mem_acct_log
+	static int outputMemAcctCountDown = 0;
+#endif
 	dw_looper_msg_t *msg;
 	static size_t mz[2];
 
     log_d("eh_impl start\n");
 
-    if (dw_spi2_start(0, 25000) != 0) {
+    if (dw_spi2_start(0, 25000, NULL) != 0) {
 		log_e("Sanity check start spi2\n");
 		return;
     }
-    if (dw_sinsvc2_init() != 0) {
+    if (dw_sinsvc2_init(NULL) != 0) {
 		log_e("Sanity check start sinsvc2\n");
 		return;
     }
@@ -396,6 +441,14 @@ static void eh_looper_task(aloe_thread_t *args) {
 			log_d("xPortGetFreeHeapSize: %d\n", mz[0]);
 			outputHeapSizeCountDown = looperRound(outputHeapSizeDur);
 		}
+#if eh_mem_acct_log
+		if (outputMemAcctCountDown > 0) {
+			outputMemAcctCountDown--;
+		} else {
+			aloe_mem_acct_dump(0);
+			outputMemAcctCountDown = looperRound(outputMemAcctDur);
+		}
+#endif
 
 		eh_led_pulse(0.5);
 
@@ -435,6 +488,7 @@ void eh_reset(int dly) {
 		vTaskDelay(1000 / portTICK_PERIOD_MS);
 	}
 	log_d("Restarting now.\n");
+	dw_log_async_flush(500);
 	fflush(stdout);
 	esp_restart();
 }
@@ -456,6 +510,14 @@ void app_main(void) {
 
 	aloe_logger_init();
 
+	// internal RAM, taken from wifi event handler
+	if (!(eh_impl.msg_pool = aloe_pool_create(aloe_mem_id_stdc,
+			sizeof(dw_looper_msg_t), eh_looper_msg_cnt, sizeof(void*),
+			"eh_msg"))) {
+		log_e("Failed create looper msg pool\n");
+		return;
+	}
+
 	log_d("eh version: %s\n", eh_ver_str());
     
 	/* Print chip information */
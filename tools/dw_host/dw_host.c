@@ -0,0 +1,272 @@
+/* $Id$
+ *
+ * Copyright 2023, Joelai
+ * All Rights Reserved.
+ *
+ * @author joelai
+ */
+
+/*
+ * sinsvc2, SPI and looper as Linux process for benchmark and profiling.
+ *
+ * SPI run on the mock bus timed from the clock, trunk loopback to the
+ * clients unless discard.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <getopt.h>
+
+#include "dw_util.h"
+#include "dw_looper.h"
+#include "dw_sinsvc.h"
+#include "dw_spi.h"
+
+#define log_d(...) aloe_log_d(__VA_ARGS__)
+#define log_e(...) aloe_log_e(__VA_ARGS__)
+
+static struct {
+	dw_looper_t looper;
+	volatile int quit, lat_dump;
+
+	/* mock SPI sink */
+	unsigned long sink_trunk, sink_byte;
+
+	FILE *cap;
+} impl = {};
+
+/** Mock SPI sink drop every trunk. */
+static size_t host_spi_discard(const void *tx, size_t sz, void *rx,
+		size_t rx_sz, void *cbarg) {
+	(void)tx;
+	(void)rx;
+	(void)rx_sz;
+	(void)cbarg;
+
+	impl.sink_trunk++;
+	impl.sink_byte += sz;
+	return 0;
+}
+
+/** Capture writer, stdio buffered. */
+static int host_cap_wr(const void *data, size_t sz, void *cbarg) {
+	return fwrite(data, 1, sz, (FILE*)cbarg) == sz ? 0 : -1;
+}
+
+static void host_sig(int sig) {
+	if (sig == SIGUSR1) {
+		impl.lat_dump = 1;
+		return;
+	}
+	impl.quit = 1;
+}
+
+/** Print the log ring then die as before, the drain task still run. */
+static void host_fatal(int sig) {
+	dw_log_async_flush(200);
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+/** Log from the drain task as the device. */
+void aloe_log_add_va(int lvl, const char *tag, long lno, const char *fmt,
+		va_list va) {
+	if (dw_log_async_add_va(lvl, tag, lno, fmt, va) == 0) return;
+	aloe_log_add_va_def(lvl, tag, lno, fmt, va);
+}
+
+static const char opt_short[] = "c:k:z:t:dw:r:x:lf:n:q:T:A:h";
+static const struct option opt_long[] = {
+	{"client", required_argument, NULL, 'c'},
+	{"clock", required_argument, NULL, 'k'},
+	{"coalesce", required_argument, NULL, 'z'},
+	{"time", required_argument, NULL, 't'},
+	{"discard", no_argument, NULL, 'd'},
+	{"capture", required_argument, NULL, 'w'},
+	{"replay", required_argument, NULL, 'r'},
+	{"speed", required_argument, NULL, 'x'},
+	{"latency", no_argument, NULL, 'l'},
+	{"frame", required_argument, NULL, 'f'},
+	{"frames", required_argument, NULL, 'n'},
+	{"quota", required_argument, NULL, 'q'},
+	{"trunk", required_argument, NULL, 'T'},
+	{"autosz", required_argument, NULL, 'A'},
+	{"help", no_argument, NULL, 'h'},
+	{0},
+};
+
+static void help(const char *prog) {
+	fprintf(stdout,
+"Usage: %s [OPTIONS]\n"
+"sinsvc2 on port %d forward to mock SPI bus.\n"
+"\n"
+"  -c, --client=N      Max client, 0 for default\n"
+"  -k, --clock=KHZ     Mock SPI clock [25000]\n"
+"  -z, --coalesce=US   Coalescing delay, 0 to disable\n"
+"  -t, --time=SEC      Quit after, 0 run until signal\n"
+"  -d, --discard       SPI sink drop trunk instead of loopback\n"
+"  -w, --capture=FILE  Record received frame to trace file\n"
+"  -r, --replay=FILE   Feed trace file to SPI instead of client, then quit\n"
+"  -x, --speed=PCT     Replay speed percent, 0 as fast as possible [100]\n"
+"  -l, --latency       Dump stage latency and memory by name when quit,\n"
+"                      SIGUSR1 any time\n"
+"  -f, --frame=BYTES   Frame buffer size, 0 for default\n"
+"  -n, --frames=N      Frame buffer count split to quota and shared\n"
+"  -q, --quota=N       Frame buffer per client, 0 for default\n"
+"  -T, --trunk=BYTES   SPI trunk size, 0 for default\n"
+"  -A, --autosz=DIV    Frame buffer count from 1 / DIV of free memory\n"
+"  -h, --help          Show this help\n"
+"\n", prog, DECKWIFI_SOCKET_SVC_PORT);
+}
+
+int main(int argc, char **argv) {
+	int opt_op, opt_idx, coal_us = 0, discard = 0, lat = 0;
+	unsigned clk_khz = 25000, dur = 0, speed = 100;
+	const char *cap_path = NULL, *replay_path = NULL;
+	long r;
+	unsigned long ts0;
+	dw_looper_msg_t *msg;
+	dw_sinsvc2_cfg_t svc_cfg = {};
+	dw_spi2_cfg_t spi_cfg = {};
+
+	while ((opt_op = getopt_long(argc, argv, opt_short, opt_long,
+			&opt_idx)) != -1) {
+		switch (opt_op) {
+		case 'c':
+			svc_cfg.cln_cnt = atoi(optarg);
+			break;
+		case 'k':
+			clk_khz = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'z':
+			coal_us = atoi(optarg);
+			break;
+		case 't':
+			dur = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			discard = 1;
+			break;
+		case 'w':
+			cap_path = optarg;
+			break;
+		case 'r':
+			replay_path = optarg;
+			break;
+		case 'x':
+			speed = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			lat = 1;
+			break;
+		case 'f':
+			svc_cfg.frm_sz = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			svc_cfg.frm_cnt = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'q':
+			svc_cfg.frm_quota = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'T':
+			spi_cfg.trunk_sz = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'A':
+			svc_cfg.autosz = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			help(argv[0]);
+			return 0;
+		default:
+			help(argv[0]);
+			return 1;
+		}
+	}
+
+	if (dw_log_async_start(64, 224, DECKWIFI_THREAD_PRIO_LOG) != 0) {
+		log_e("Failed start async logger\n");
+	}
+
+	signal(SIGINT, &host_sig);
+	signal(SIGTERM, &host_sig);
+	signal(SIGUSR1, &host_sig);
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGABRT, &host_fatal);
+	signal(SIGSEGV, &host_fatal);
+
+	if (!dw_looper_init(&impl.looper, 20)) {
+		log_e("Failed create looper\n");
+		return 1;
+	}
+	impl.looper.ready = 1;
+
+	if (dw_spi2_start(0, clk_khz, &spi_cfg) != 0) {
+		log_e("Failed start SPI\n");
+		return 1;
+	}
+	if (discard && dw_spi2_mock_sink(&host_spi_discard, NULL) != 0) {
+		log_e("Failed set SPI sink\n");
+		return 1;
+	}
+	if (coal_us > 0 && dw_spi2_coalesce(coal_us) != 0) {
+		log_e("Failed enable coalescing\n");
+		return 1;
+	}
+	if (dw_sinsvc2_init(&svc_cfg) != 0) {
+		log_e("Failed start sinsvc2\n");
+		return 1;
+	}
+
+	if (cap_path) {
+		if (!(impl.cap = fopen(cap_path, "wb"))) {
+			log_e("Failed open %s\n", cap_path);
+			return 1;
+		}
+		if (dw_sinsvc2_capture(&host_cap_wr, impl.cap) != 0) {
+			log_e("Failed start capture\n");
+			return 1;
+		}
+	}
+
+	if (replay_path) {
+		if ((r = dw_sinsvc2_replay(replay_path, speed)) < 0) {
+			log_e("Failed replay %s\n", replay_path);
+			return 1;
+		}
+		// SPI drain the rest
+		aloe_thread_sleep(500);
+		impl.quit = 1;
+	}
+
+	ts0 = aloe_tick2ms(aloe_ticks());
+	while (!impl.quit) {
+		if (dur > 0 && aloe_tick2ms(aloe_ticks()) - ts0 >= dur * 1000ul) break;
+		if (impl.lat_dump) {
+			impl.lat_dump = 0;
+			dw_sinsvc2_lat_dump(0);
+			aloe_mem_acct_dump(0);
+		}
+		if ((msg = dw_looper_once(&impl.looper, 500)) && msg->handler) {
+			(*msg->handler)(msg);
+		}
+	}
+	if (lat) {
+		dw_sinsvc2_lat_dump(0);
+		aloe_mem_acct_dump(0);
+	}
+	if (impl.cap) {
+		// the task may be in the writer
+		dw_sinsvc2_capture(NULL, NULL);
+		aloe_thread_sleep(100);
+		fclose(impl.cap);
+	}
+	if (discard) {
+		log_d("SPI sink trunk: %lu, bytes: %lu\n", impl.sink_trunk,
+				impl.sink_byte);
+	}
+	if (dw_log_async_drop()) log_d("Log dropped: %lu\n", dw_log_async_drop());
+	dw_log_async_flush(500);
+	return 0;
+}
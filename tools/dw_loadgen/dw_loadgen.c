@@ -0,0 +1,626 @@
+/* $Id$
+ *
+ * Copyright 2023, Joelai
+ * All Rights Reserved.
+ *
+ * @author joelai
+ */
+
+/*
+ * dw_pkt2 load generator.
+ *
+ * Each frame payload begin with ldgn_hdr_t carrying connection, sequence
+ * and send time.  The device echo frame back when SPI bus loopback (Linux
+ * mock bus) so round trip taken from the echo of the first trunk, echo
+ * broadcast to every client and matched by connection id.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define log_d(_fmt, ...) fprintf(stdout, "[Debug][%s][#%d]" _fmt, __func__, __LINE__, ##__VA_ARGS__)
+#define log_e(_fmt, ...) fprintf(stderr, "[ERROR][%s][#%d]" _fmt, __func__, __LINE__, ##__VA_ARGS__)
+
+#define ldgn_min(_a, _b) ((_a) <= (_b) ? (_a) : (_b))
+#define ldgn_max(_a, _b) ((_a) >= (_b) ? (_a) : (_b))
+
+/* same as dw_sinsvc2.c */
+typedef struct __attribute__((packed)) {
+	uint32_t tag;
+	uint32_t len;
+} pkt2_hdr_t;
+
+#define pkt2_tag_s (1 << 0)
+#define pkt2_tag_e (1 << 1)
+#define pkt2_tag_credit (1 << 2)
+#define pkt2_tag_prio_bit 3
+#define pkt2_tag_prio_mask (0x3 << 3)
+
+/* same as dw_spi.h */
+#define spi2_coal_magic 0xc0a1
+#define spi2_coal_max 16
+#define spi2_coal_hdr_len (4 + 2 * spi2_coal_max)
+
+/* payload head of generated frame */
+#define ldgn_magic 0x6e67646c
+typedef struct __attribute__((packed)) {
+	uint32_t magic;
+	uint32_t conn;
+	uint32_t seq;
+	uint32_t rsv;
+	uint64_t ts;
+} ldgn_hdr_t;
+
+/* sinsvc2 split frame longer than frm_req_sz */
+#define ldgn_frm_max (64 * 1024)
+
+/* smallest fragment, bound header in conn->out */
+#define ldgn_frag_min 256
+
+/* max echo wait before count outstanding lost */
+#define ldgn_echo_timeout_us 1000000ull
+
+/* size distribution */
+typedef enum {
+	ldgn_dist_fixed,
+	ldgn_dist_uniform,
+	ldgn_dist_bimodal,
+} ldgn_dist_t;
+
+typedef struct {
+	int fd;
+	int id;
+
+	/* pending output, partial frame left from short send */
+	char out[sizeof(pkt2_hdr_t) * (ldgn_frm_max / ldgn_frag_min + 1)
+			+ ldgn_frm_max];
+	size_t out_pos, out_lmt;
+
+	/* input parser */
+	char in[64 * 1024];
+	size_t in_lmt;
+
+	uint32_t seq;
+	unsigned outstanding;
+
+	/* last advertised, informative, TCP window throttle the sender */
+	int credit;
+	unsigned long long last_echo;
+
+	unsigned long long tx_frm, tx_byte, echo, lost, rx_byte;
+} ldgn_conn_t;
+
+static struct {
+	const char *addr, *port;
+	int conn_cnt;
+	unsigned depth;
+	double rate;
+	unsigned dur, prio, frag;
+	unsigned long long frm_cnt;
+	unsigned seed;
+	unsigned open_loop: 1;
+	unsigned quiet: 1;
+
+	ldgn_dist_t dist;
+	unsigned sz_min, sz_max, bimodal_pct;
+
+	ldgn_conn_t *conn;
+
+	/* round trip sample in us */
+	uint32_t *lat;
+	size_t lat_cnt, lat_cap;
+
+	unsigned long long ts_start, ts_next;
+	unsigned long long tx_frm;
+	uint64_t rnd;
+	volatile int quit;
+} impl = {
+	.addr = "127.0.0.1",
+	.port = "6000",
+	.conn_cnt = 1,
+	.depth = 1,
+	.dur = 10,
+	.dist = ldgn_dist_fixed,
+	.sz_min = 256,
+	.sz_max = 256,
+	.bimodal_pct = 90,
+	.seed = 1,
+};
+
+static unsigned long long ldgn_ts_us(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+/** xorshift64, reproducible across libc. */
+static uint32_t ldgn_rand(void) {
+	impl.rnd ^= impl.rnd << 13;
+	impl.rnd ^= impl.rnd >> 7;
+	impl.rnd ^= impl.rnd << 17;
+	return (uint32_t)(impl.rnd >> 16);
+}
+
+static unsigned ldgn_frm_sz(void) {
+	switch (impl.dist) {
+	case ldgn_dist_uniform:
+		return impl.sz_min + ldgn_rand() % (impl.sz_max - impl.sz_min + 1);
+	case ldgn_dist_bimodal:
+		return ldgn_rand() % 100 < impl.bimodal_pct ? impl.sz_min : impl.sz_max;
+	default:
+		break;
+	}
+	return impl.sz_min;
+}
+
+/**
+ * Parse size distribution.
+ *
+ *   N          fixed
+ *   MIN-MAX    uniform
+ *   S,L[,PCT]  bimodal, PCT percent of S
+ */
+static int ldgn_dist_parse(const char *s) {
+	unsigned a, b, c;
+
+	if (sscanf(s, "%u,%u,%u", &a, &b, &c) == 3) {
+		impl.dist = ldgn_dist_bimodal;
+		impl.bimodal_pct = c;
+	} else if (sscanf(s, "%u,%u", &a, &b) == 2) {
+		impl.dist = ldgn_dist_bimodal;
+	} else if (sscanf(s, "%u-%u", &a, &b) == 2) {
+		impl.dist = ldgn_dist_uniform;
+	} else if (sscanf(s, "%u", &a) == 1) {
+		impl.dist = ldgn_dist_fixed;
+		b = a;
+	} else {
+		return -1;
+	}
+	if (a < sizeof(ldgn_hdr_t) || b < sizeof(ldgn_hdr_t)
+			|| a > ldgn_frm_max || b > ldgn_frm_max
+			|| impl.bimodal_pct > 100) {
+		return -1;
+	}
+	if (impl.dist == ldgn_dist_uniform && a > b) return -1;
+	impl.sz_min = a;
+	impl.sz_max = b;
+	return 0;
+}
+
+static void ldgn_lat_add(unsigned long long us) {
+	uint32_t *lat;
+
+	if (impl.lat_cnt >= impl.lat_cap) {
+		impl.lat_cap = impl.lat_cap ? impl.lat_cap * 2 : 4096;
+		if (!(lat = realloc(impl.lat, impl.lat_cap * sizeof(*lat)))) {
+			impl.lat_cap = impl.lat_cnt;
+			return;
+		}
+		impl.lat = lat;
+	}
+	impl.lat[impl.lat_cnt++] = (uint32_t)ldgn_min(us, UINT32_MAX);
+}
+
+static int ldgn_lat_cmp(const void *a, const void *b) {
+	uint32_t va = *(const uint32_t*)a, vb = *(const uint32_t*)b;
+
+	return va < vb ? -1 : va > vb ? 1 : 0;
+}
+
+/** Percentile from sorted sample, nearest rank. */
+static uint32_t ldgn_lat_pct(double pct) {
+	size_t idx;
+
+	if (impl.lat_cnt == 0) return 0;
+	idx = (size_t)(pct / 100.0 * impl.lat_cnt + 0.5);
+	if (idx > 0) idx--;
+	return impl.lat[ldgn_min(idx, impl.lat_cnt - 1)];
+}
+
+static int ldgn_conn_open(ldgn_conn_t *conn) {
+	struct addrinfo hints = {}, *res = NULL;
+	pkt2_hdr_t pkt;
+	int r, one = 1;
+
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if ((r = getaddrinfo(impl.addr, impl.port, &hints, &res)) != 0) {
+		log_e("resolve %s:%s, %s\n", impl.addr, impl.port, gai_strerror(r));
+		return -1;
+	}
+	if ((conn->fd = socket(res->ai_family, res->ai_socktype, 0)) == -1) {
+		r = errno;
+		log_e("socket, %s\n", strerror(r));
+		goto finally;
+	}
+	if (connect(conn->fd, res->ai_addr, res->ai_addrlen) != 0) {
+		r = errno;
+		log_e("connect %s:%s, %s\n", impl.addr, impl.port, strerror(r));
+		close(conn->fd);
+		conn->fd = -1;
+		goto finally;
+	}
+	setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK);
+	conn->credit = -1;
+
+	// ask framed echo and credit advertise, sent ahead of the first frame
+	pkt.tag = pkt2_tag_credit;
+	pkt.len = 0;
+	memcpy(conn->out, &pkt, sizeof(pkt));
+	conn->out_pos = 0;
+	conn->out_lmt = sizeof(pkt);
+	r = 0;
+finally:
+	freeaddrinfo(res);
+	return r == 0 ? 0 : -1;
+}
+
+/** Build the next frame into conn->out, split to fragment when -F. */
+static void ldgn_conn_frm(ldgn_conn_t *conn) {
+	static uint8_t frm[ldgn_frm_max];
+	ldgn_hdr_t *hdr = (ldgn_hdr_t*)frm;
+	pkt2_hdr_t pkt;
+	unsigned sz = ldgn_frm_sz(), frag = impl.frag ? impl.frag : sz, pos, n, i;
+
+	hdr->magic = ldgn_magic;
+	hdr->conn = conn->id;
+	hdr->seq = conn->seq++;
+	hdr->rsv = 0;
+	hdr->ts = ldgn_ts_us();
+	for (i = sizeof(*hdr); i < sz; i++) frm[i] = (uint8_t)(hdr->seq + i);
+
+	conn->out_pos = conn->out_lmt = 0;
+	for (pos = 0; pos < sz; pos += n) {
+		n = ldgn_min(frag, sz - pos);
+		pkt.tag = (pos == 0 ? pkt2_tag_s : 0) | (pos + n >= sz ? pkt2_tag_e : 0)
+				| ((impl.prio << pkt2_tag_prio_bit) & pkt2_tag_prio_mask);
+		pkt.len = n;
+		memcpy(conn->out + conn->out_lmt, &pkt, sizeof(pkt));
+		conn->out_lmt += sizeof(pkt);
+		memcpy(conn->out + conn->out_lmt, frm + pos, n);
+		conn->out_lmt += n;
+	}
+}
+
+/** Ready for another frame, from depth and rate. */
+static int ldgn_conn_can_send(ldgn_conn_t *conn, unsigned long long now) {
+	if (conn->out_lmt > conn->out_pos) return 1;
+	if (impl.frm_cnt && impl.tx_frm >= impl.frm_cnt) return 0;
+	if (!impl.open_loop && conn->outstanding >= impl.depth) return 0;
+	if (impl.rate > 0 && now < impl.ts_next) return 0;
+	return 1;
+}
+
+static int ldgn_conn_send(ldgn_conn_t *conn, unsigned long long now) {
+	ssize_t r;
+
+	while (ldgn_conn_can_send(conn, now)) {
+		if (conn->out_lmt <= conn->out_pos) {
+			ldgn_conn_frm(conn);
+			conn->outstanding++;
+			conn->tx_frm++;
+			impl.tx_frm++;
+			if (impl.rate > 0) {
+				impl.ts_next = ldgn_max(impl.ts_next, now - 1000000ull)
+						+ (unsigned long long)(1000000.0 / impl.rate);
+			}
+		}
+		r = send(conn->fd, conn->out + conn->out_pos,
+				conn->out_lmt - conn->out_pos, MSG_NOSIGNAL);
+		if (r < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+			if (errno == EINTR) continue;
+			log_e("send conn %d, %s\n", conn->id, strerror(errno));
+			return -1;
+		}
+		conn->tx_byte += r;
+		conn->out_pos += r;
+		if (conn->out_pos < conn->out_lmt) return 0;
+	}
+	return 0;
+}
+
+/** Echo of generated frame, possibly inside coalesced transaction. */
+static void ldgn_conn_echo(ldgn_conn_t *conn, const uint8_t *pld, size_t len,
+		unsigned long long now) {
+	ldgn_hdr_t hdr;
+	uint16_t coal[2 + spi2_coal_max];
+	size_t i, pos;
+
+	if (len >= spi2_coal_hdr_len) {
+		memcpy(coal, pld, spi2_coal_hdr_len);
+		if (coal[0] == spi2_coal_magic && coal[1] <= spi2_coal_max) {
+			pos = spi2_coal_hdr_len;
+			for (i = 0; i < coal[1] && pos + coal[2 + i] <= len; i++) {
+				ldgn_conn_echo(conn, pld + pos, coal[2 + i], now);
+				pos += coal[2 + i];
+			}
+			return;
+		}
+	}
+	if (len < sizeof(hdr)) return;
+	memcpy(&hdr, pld, sizeof(hdr));
+	if (hdr.magic != ldgn_magic || hdr.conn != (uint32_t)conn->id) return;
+
+	conn->echo++;
+	conn->last_echo = now;
+	if (conn->outstanding > 0) conn->outstanding--;
+	ldgn_lat_add(now - hdr.ts);
+}
+
+static int ldgn_conn_recv(ldgn_conn_t *conn, unsigned long long now) {
+	pkt2_hdr_t pkt;
+	size_t pos;
+	ssize_t r;
+
+	while (1) {
+		r = recv(conn->fd, conn->in + conn->in_lmt,
+				sizeof(conn->in) - conn->in_lmt, 0);
+		if (r == 0) {
+			log_e("conn %d closed by peer\n", conn->id);
+			return -1;
+		}
+		if (r < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+			if (errno == EINTR) continue;
+			log_e("recv conn %d, %s\n", conn->id, strerror(errno));
+			return -1;
+		}
+		conn->rx_byte += r;
+		conn->in_lmt += r;
+
+		for (pos = 0; conn->in_lmt - pos >= sizeof(pkt); ) {
+			memcpy(&pkt, conn->in + pos, sizeof(pkt));
+			if (pkt.len > sizeof(conn->in) - sizeof(pkt)) {
+				log_e("conn %d frame length %u too large\n", conn->id,
+						(unsigned)pkt.len);
+				return -1;
+			}
+			if (conn->in_lmt - pos < sizeof(pkt) + pkt.len) break;
+			if ((pkt.tag & pkt2_tag_credit) && pkt.len >= sizeof(uint32_t)) {
+				uint32_t credit;
+
+				memcpy(&credit, conn->in + pos + sizeof(pkt), sizeof(credit));
+				conn->credit = (int)credit;
+			} else {
+				ldgn_conn_echo(conn, (uint8_t*)conn->in + pos + sizeof(pkt),
+						pkt.len, now);
+			}
+			pos += sizeof(pkt) + pkt.len;
+		}
+		memmove(conn->in, conn->in + pos, conn->in_lmt - pos);
+		conn->in_lmt -= pos;
+	}
+}
+
+static void ldgn_report(unsigned long long dur_us, int fin) {
+	unsigned long long tx_frm = 0, tx_byte = 0, echo = 0, lost = 0, rx_byte = 0;
+	int i;
+
+	for (i = 0; i < impl.conn_cnt; i++) {
+		tx_frm += impl.conn[i].tx_frm;
+		tx_byte += impl.conn[i].tx_byte;
+		echo += impl.conn[i].echo;
+		lost += impl.conn[i].lost;
+		rx_byte += impl.conn[i].rx_byte;
+	}
+	if (dur_us == 0) dur_us = 1;
+	printf("%s %.1fs credit %d tx %llu frm %.2f KBps %.0f fps, rx %.2f KBps, echo %llu,"
+			" lost %llu\n", fin ? "total" : "elapsed", dur_us / 1e6, impl.conn[0].credit,
+			tx_frm, tx_byte * 1e6 / 1024.0 / dur_us, tx_frm * 1e6 / dur_us,
+			rx_byte * 1e6 / 1024.0 / dur_us, echo, lost);
+	if (!fin || impl.lat_cnt == 0) return;
+
+	qsort(impl.lat, impl.lat_cnt, sizeof(*impl.lat), &ldgn_lat_cmp);
+	printf("latency us min %u p50 %u p99 %u p999 %u max %u\n",
+			impl.lat[0], ldgn_lat_pct(50), ldgn_lat_pct(99),
+			ldgn_lat_pct(99.9), impl.lat[impl.lat_cnt - 1]);
+}
+
+static void ldgn_sig(int sig) {
+	(void)sig;
+	impl.quit = 1;
+}
+
+static const char opt_short[] = "a:p:c:d:s:F:r:t:n:P:S:Eqh";
+static const struct option opt_long[] = {
+	{"addr", required_argument, NULL, 'a'},
+	{"port", required_argument, NULL, 'p'},
+	{"conn", required_argument, NULL, 'c'},
+	{"depth", required_argument, NULL, 'd'},
+	{"size", required_argument, NULL, 's'},
+	{"fragment", required_argument, NULL, 'F'},
+	{"rate", required_argument, NULL, 'r'},
+	{"time", required_argument, NULL, 't'},
+	{"count", required_argument, NULL, 'n'},
+	{"prio", required_argument, NULL, 'P'},
+	{"seed", required_argument, NULL, 'S'},
+	{"open-loop", no_argument, NULL, 'E'},
+	{"quiet", no_argument, NULL, 'q'},
+	{"help", no_argument, NULL, 'h'},
+	{0},
+};
+
+static void help(const char *prog) {
+	fprintf(stdout,
+"Usage: %s [OPTIONS]\n"
+"dw_pkt2 load generator for sinsvc2, round trip from SPI loopback echo.\n"
+"\n"
+"  -a, --addr=ADDR     Server address [%s]\n"
+"  -p, --port=PORT     Server port [%s]\n"
+"  -c, --conn=N        Connections [%d]\n"
+"  -d, --depth=N       Frames in flight per connection before echo [%u]\n"
+"  -s, --size=DIST     Frame size, N fixed, MIN-MAX uniform, S,L[,PCT]\n"
+"                      bimodal with PCT percent of S [%u]\n"
+"  -F, --fragment=N    Split frame to s/e fragment of N bytes, 0 not split\n"
+"  -r, --rate=FPS      Frames per second over all connection, 0 unlimited\n"
+"  -t, --time=SEC      Duration [%u]\n"
+"  -n, --count=N       Stop after N frames, 0 unlimited\n"
+"  -P, --prio=N        Priority class in tag bits 3-4 [%u]\n"
+"  -S, --seed=N        Size distribution seed [%u]\n"
+"  -E, --open-loop     Not wait echo, depth ignored\n"
+"  -q, --quiet         Only final report\n"
+"  -h, --help          Show this help\n"
+"\n", prog, impl.addr, impl.port, impl.conn_cnt, impl.depth, impl.sz_min,
+		impl.dur, impl.prio, impl.seed);
+}
+
+int main(int argc, char **argv) {
+	struct pollfd *pfd = NULL;
+	unsigned long long now, ts_rpt;
+	int opt_op, opt_idx, i, r = 1;
+
+	while ((opt_op = getopt_long(argc, argv, opt_short, opt_long,
+			&opt_idx)) != -1) {
+		switch (opt_op) {
+		case 'a':
+			impl.addr = optarg;
+			break;
+		case 'p':
+			impl.port = optarg;
+			break;
+		case 'c':
+			impl.conn_cnt = atoi(optarg);
+			break;
+		case 'd':
+			impl.depth = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			if (ldgn_dist_parse(optarg) != 0) {
+				log_e("Invalid size distribution: %s, frame %d..%d\n", optarg,
+						(int)sizeof(ldgn_hdr_t), ldgn_frm_max);
+				return 1;
+			}
+			break;
+		case 'F':
+			impl.frag = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			impl.rate = strtod(optarg, NULL);
+			break;
+		case 't':
+			impl.dur = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			impl.frm_cnt = strtoull(optarg, NULL, 0);
+			break;
+		case 'P':
+			impl.prio = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			impl.seed = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'E':
+			impl.open_loop = 1;
+			break;
+		case 'q':
+			impl.quiet = 1;
+			break;
+		case 'h':
+			help(argv[0]);
+			return 0;
+		default:
+			help(argv[0]);
+			return 1;
+		}
+	}
+	if (impl.conn_cnt <= 0 || impl.depth <= 0 || impl.prio > 3
+			|| (impl.frag > 0 && impl.frag < ldgn_frag_min)) {
+		log_e("Invalid argument\n");
+		return 1;
+	}
+	impl.rnd = 0x9e3779b97f4a7c15ull ^ impl.seed;
+
+	if (!(impl.conn = calloc(impl.conn_cnt, sizeof(*impl.conn)))
+			|| !(pfd = calloc(impl.conn_cnt, sizeof(*pfd)))) {
+		log_e("Out of memory\n");
+		goto finally;
+	}
+	for (i = 0; i < impl.conn_cnt; i++) impl.conn[i].fd = -1;
+	for (i = 0; i < impl.conn_cnt; i++) {
+		impl.conn[i].id = i;
+		if (ldgn_conn_open(&impl.conn[i]) != 0) goto finally;
+	}
+	signal(SIGINT, &ldgn_sig);
+	signal(SIGTERM, &ldgn_sig);
+
+	impl.ts_start = impl.ts_next = ts_rpt = ldgn_ts_us();
+	for (i = 0; i < impl.conn_cnt; i++) impl.conn[i].last_echo = impl.ts_start;
+
+	while (!impl.quit) {
+		now = ldgn_ts_us();
+		if (impl.dur && now - impl.ts_start >= impl.dur * 1000000ull) break;
+		if (impl.frm_cnt && impl.tx_frm >= impl.frm_cnt) {
+			// drain echo
+			for (i = 0; i < impl.conn_cnt; i++) {
+				if (!impl.open_loop && impl.conn[i].outstanding > 0) break;
+			}
+			if (i >= impl.conn_cnt) break;
+		}
+
+		for (i = 0; i < impl.conn_cnt; i++) {
+			ldgn_conn_t *conn = &impl.conn[i];
+
+			// echo dropped on the way, ie. receive pool empty
+			if (!impl.open_loop && conn->outstanding > 0
+					&& now - conn->last_echo >= ldgn_echo_timeout_us) {
+				conn->lost += conn->outstanding;
+				conn->outstanding = 0;
+				conn->last_echo = now;
+			}
+			if (ldgn_conn_send(conn, now) != 0) goto finally;
+
+			pfd[i].fd = conn->fd;
+			pfd[i].events = POLLIN;
+			if (conn->out_lmt > conn->out_pos) pfd[i].events |= POLLOUT;
+			pfd[i].revents = 0;
+		}
+
+		// wake for rate limit
+		if (poll(pfd, impl.conn_cnt, impl.rate > 0 ? 1 : 100) < 0) {
+			if (errno == EINTR) continue;
+			log_e("poll, %s\n", strerror(errno));
+			goto finally;
+		}
+
+		now = ldgn_ts_us();
+		for (i = 0; i < impl.conn_cnt; i++) {
+			if ((pfd[i].revents & (POLLIN | POLLERR | POLLHUP))
+					&& ldgn_conn_recv(&impl.conn[i], now) != 0) {
+				goto finally;
+			}
+		}
+
+		if (!impl.quiet && now - ts_rpt >= 1000000ull) {
+			ts_rpt = now;
+			ldgn_report(now - impl.ts_start, 0);
+		}
+	}
+	r = 0;
+finally:
+	if (impl.conn) {
+		if (impl.ts_start) ldgn_report(ldgn_ts_us() - impl.ts_start, 1);
+		for (i = 0; i < impl.conn_cnt; i++) {
+			if (impl.conn[i].fd != -1) close(impl.conn[i].fd);
+		}
+		free(impl.conn);
+	}
+	if (pfd) free(pfd);
+	if (impl.lat) free(impl.lat);
+	return r;
+}
@@ -0,0 +1,472 @@
+/* $Id$
+ *
+ * Copyright 2023, Joelai
+ * All Rights Reserved.
+ *
+ * @author joelai
+ */
+
+/*
+ * sinsvc2 to SPI pipeline on virtual clock.
+ *
+ * TCP source write dw_pkt2 frame paced by link bandwidth, mock SPI bus take
+ * trunk time from the clock, the sink take latency from frame arrival to
+ * the trunk start on the bus.  Same argument give the same result.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "dw_util.h"
+#include "dw_sinsvc.h"
+#include "dw_spi.h"
+
+#define log_d(...) aloe_log_d(__VA_ARGS__)
+#define log_e(...) aloe_log_e(__VA_ARGS__)
+
+/* same as dw_sinsvc2.c */
+typedef struct __attribute__((packed)) {
+	uint32_t tag;
+	uint32_t len;
+} pkt2_hdr_t;
+
+#define pkt2_tag_s (1 << 0)
+#define pkt2_tag_e (1 << 1)
+#define pkt2_tag_prio_bit 3
+
+/* payload head of generated frame */
+#define sim_magic 0x6d69736c
+typedef struct __attribute__((packed)) {
+	uint32_t magic;
+	uint32_t src;
+	uint32_t seq;
+	uint32_t rsv;
+	uint64_t ts;
+} sim_hdr_t;
+
+#define sim_frm_max (16 * 1024)
+
+/* compile time override */
+#ifndef SIM_CFG
+#  define SIM_CFG ""
+#endif
+
+/* poll interval of the source on virtual clock */
+#define sim_src_tick_us 50
+
+/* bound kernel queue like the lwip window on device */
+#define sim_src_sndbuf (8 * 1024)
+
+typedef enum {
+	sim_dist_fixed,
+	sim_dist_uniform,
+	sim_dist_bimodal,
+} sim_dist_t;
+
+typedef struct {
+	aloe_thread_t tsk;
+	int id, fd;
+	uint32_t seq;
+	uint64_t rnd;
+	char buf[sizeof(pkt2_hdr_t) + sim_frm_max];
+	unsigned long tx_frm, tx_byte;
+} sim_src_t;
+
+static struct {
+	unsigned dur, link_kbps, clk_khz, coal_us, prio, seed;
+	int src_cnt;
+
+	sim_dist_t dist;
+	unsigned sz_min, sz_max, bimodal_pct;
+
+	/* buffer geometry, 0 take the default */
+	dw_sinsvc2_cfg_t svc_cfg;
+	dw_spi2_cfg_t spi_cfg;
+
+	sim_src_t *src;
+	volatile int quit;
+
+	/* sink, called from bus under SPI lock */
+	unsigned long sink_trunk, sink_byte, sink_frm;
+	uint32_t *lat;
+	size_t lat_cnt, lat_cap;
+} impl = {
+	.dur = 10,
+	.link_kbps = 20000,
+	.clk_khz = 25000,
+	.src_cnt = 1,
+	.dist = sim_dist_fixed,
+	.sz_min = 1024,
+	.sz_max = 1024,
+	.bimodal_pct = 90,
+	.seed = 1,
+};
+
+/** xorshift64 per source, reproducible across libc. */
+static uint32_t sim_rand(sim_src_t *src) {
+	src->rnd ^= src->rnd << 13;
+	src->rnd ^= src->rnd >> 7;
+	src->rnd ^= src->rnd << 17;
+	return (uint32_t)(src->rnd >> 16);
+}
+
+static unsigned sim_frm_sz(sim_src_t *src) {
+	switch (impl.dist) {
+	case sim_dist_uniform:
+		return impl.sz_min + sim_rand(src) % (impl.sz_max - impl.sz_min + 1);
+	case sim_dist_bimodal:
+		return sim_rand(src) % 100 < impl.bimodal_pct ? impl.sz_min :
+				impl.sz_max;
+	default:
+		break;
+	}
+	return impl.sz_min;
+}
+
+/** N fixed, MIN-MAX uniform, S,L[,PCT] bimodal. */
+static int sim_dist_parse(const char *s) {
+	unsigned a, b, c;
+
+	if (sscanf(s, "%u,%u,%u", &a, &b, &c) == 3) {
+		impl.dist = sim_dist_bimodal;
+		impl.bimodal_pct = c;
+	} else if (sscanf(s, "%u,%u", &a, &b) == 2) {
+		impl.dist = sim_dist_bimodal;
+	} else if (sscanf(s, "%u-%u", &a, &b) == 2) {
+		impl.dist = sim_dist_uniform;
+	} else if (sscanf(s, "%u", &a) == 1) {
+		impl.dist = sim_dist_fixed;
+		b = a;
+	} else {
+		return -1;
+	}
+	if (a < sizeof(sim_hdr_t) || b < sizeof(sim_hdr_t)
+			|| a > sim_frm_max || b > sim_frm_max || impl.bimodal_pct > 100
+			|| (impl.dist == sim_dist_uniform && a > b)) {
+		return -1;
+	}
+	impl.sz_min = a;
+	impl.sz_max = b;
+	return 0;
+}
+
+static void sim_lat_add(unsigned long us) {
+	uint32_t *lat;
+
+	if (impl.lat_cnt >= impl.lat_cap) {
+		impl.lat_cap = impl.lat_cap ? impl.lat_cap * 2 : 4096;
+		if (!(lat = realloc(impl.lat, impl.lat_cap * sizeof(*lat)))) {
+			impl.lat_cap = impl.lat_cnt;
+			return;
+		}
+		impl.lat = lat;
+	}
+	impl.lat[impl.lat_cnt++] = (uint32_t)us;
+}
+
+static int sim_lat_cmp(const void *a, const void *b) {
+	uint32_t va = *(const uint32_t*)a, vb = *(const uint32_t*)b;
+
+	return va < vb ? -1 : va > vb ? 1 : 0;
+}
+
+static uint32_t sim_lat_pct(double pct) {
+	size_t idx;
+
+	if (impl.lat_cnt == 0) return 0;
+	idx = (size_t)(pct / 100.0 * impl.lat_cnt + 0.5);
+	if (idx > 0) idx--;
+	return impl.lat[aloe_min(idx, impl.lat_cnt - 1)];
+}
+
+/** Frame start in the trunk, also every sub-frame when coalesced. */
+static void sim_sink_frm(const uint8_t *data, size_t sz) {
+	const dw_spi2_coal_t *coal = (const dw_spi2_coal_t*)data;
+	sim_hdr_t hdr;
+	size_t pos;
+	int i;
+
+	if (sz >= sizeof(*coal) && coal->magic == DW_SPI2_COAL_MAGIC
+			&& coal->cnt <= DW_SPI2_COAL_MAX) {
+		for (i = 0, pos = sizeof(*coal); i < coal->cnt
+				&& pos + coal->len[i] <= sz; pos += coal->len[i++]) {
+			sim_sink_frm(data + pos, coal->len[i]);
+		}
+		return;
+	}
+	if (sz < sizeof(hdr)) return;
+	memcpy(&hdr, data, sizeof(hdr));
+	if (hdr.magic != sim_magic) return;
+	impl.sink_frm++;
+	sim_lat_add(aloe_ticks() - (unsigned long)hdr.ts);
+}
+
+static size_t sim_sink(const void *tx, size_t sz, void *rx, size_t rx_sz,
+		void *cbarg) {
+	(void)rx;
+	(void)rx_sz;
+	(void)cbarg;
+
+	impl.sink_trunk++;
+	impl.sink_byte += sz;
+	sim_sink_frm((const uint8_t*)tx, sz);
+	return 0;
+}
+
+static int sim_src_open(sim_src_t *src) {
+	struct sockaddr_in sin;
+	int one = 1, sndbuf = sim_src_sndbuf;
+
+	if ((src->fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+		log_e("socket, %s\n", strerror(errno));
+		return -1;
+	}
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(DECKWIFI_SOCKET_SVC_PORT);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	setsockopt(src->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+	// loopback connect done without block
+	if (connect(src->fd, (struct sockaddr*)&sin, sizeof(sin)) != 0) {
+		close(src->fd);
+		src->fd = -1;
+		return -1;
+	}
+	setsockopt(src->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	fcntl(src->fd, F_SETFL, fcntl(src->fd, F_GETFL) | O_NONBLOCK);
+	return 0;
+}
+
+/** Discard credit and loopback. */
+static void sim_src_drain(sim_src_t *src) {
+	char buf[4096];
+
+	while (read(src->fd, buf, sizeof(buf)) > 0);
+}
+
+static void sim_src_task(aloe_thread_t *args) {
+	sim_src_t *src = aloe_container_of(args, sim_src_t, tsk);
+	pkt2_hdr_t *pkt = (pkt2_hdr_t*)src->buf;
+	sim_hdr_t *hdr = (sim_hdr_t*)(pkt + 1);
+	unsigned long link_kbps = impl.link_kbps / impl.src_cnt;
+	size_t sz, pos;
+	unsigned i;
+	ssize_t r;
+
+	// server listen after the first round of sinsvc2 task
+	while (!impl.quit && sim_src_open(src) != 0) aloe_thread_sleep(10);
+
+	while (!impl.quit) {
+		sz = sim_frm_sz(src);
+
+		// serialize on the link then land at once
+		aloe_thread_usleep((sizeof(*pkt) + sz) * 8 * 1000ul / link_kbps);
+
+		pkt->tag = pkt2_tag_s | pkt2_tag_e | (impl.prio << pkt2_tag_prio_bit);
+		pkt->len = sz;
+		hdr->magic = sim_magic;
+		hdr->src = src->id;
+		hdr->seq = src->seq++;
+		hdr->rsv = 0;
+		hdr->ts = aloe_ticks();
+		for (i = sizeof(*hdr); i < sz; i++) {
+			((uint8_t*)hdr)[i] = (uint8_t)(hdr->seq + i);
+		}
+
+		for (pos = 0; !impl.quit && pos < sizeof(*pkt) + sz; ) {
+			sim_src_drain(src);
+			if ((r = write(src->fd, src->buf + pos,
+					sizeof(*pkt) + sz - pos)) > 0) {
+				pos += r;
+				continue;
+			}
+			if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+				log_e("source %d write, %s\n", src->id, strerror(errno));
+				return;
+			}
+			// receiver window closed, ie. out of credit
+			aloe_thread_usleep(sim_src_tick_us);
+		}
+		src->tx_frm++;
+		src->tx_byte += pos;
+	}
+}
+
+static const char opt_short[] = "t:b:k:s:c:z:P:S:f:q:Q:T:D:h";
+static const struct option opt_long[] = {
+	{"time", required_argument, NULL, 't'},
+	{"link", required_argument, NULL, 'b'},
+	{"clock", required_argument, NULL, 'k'},
+	{"size", required_argument, NULL, 's'},
+	{"conn", required_argument, NULL, 'c'},
+	{"coalesce", required_argument, NULL, 'z'},
+	{"prio", required_argument, NULL, 'P'},
+	{"seed", required_argument, NULL, 'S'},
+	{"frame", required_argument, NULL, 'f'},
+	{"quota", required_argument, NULL, 'q'},
+	{"shared", required_argument, NULL, 'Q'},
+	{"trunk", required_argument, NULL, 'T'},
+	{"dma", required_argument, NULL, 'D'},
+	{"help", no_argument, NULL, 'h'},
+	{0},
+};
+
+static void help(const char *prog) {
+	fprintf(stdout,
+"Usage: %s [OPTIONS]\n"
+"sinsvc2 to SPI pipeline on virtual clock.\n"
+"\n"
+"  -t, --time=SEC      Virtual duration [%u]\n"
+"  -b, --link=KBPS     TCP link bandwidth shared by connection [%u]\n"
+"  -k, --clock=KHZ     SPI clock [%u]\n"
+"  -s, --size=DIST     Frame size, N fixed, MIN-MAX uniform, S,L[,PCT]\n"
+"                      bimodal with PCT percent of S [%u]\n"
+"  -c, --conn=N        Connections [%d]\n"
+"  -z, --coalesce=US   SPI coalescing delay, 0 to disable\n"
+"  -P, --prio=N        Priority class [%u]\n"
+"  -S, --seed=N        Size distribution seed [%u]\n"
+"  -f, --frame=BYTES   sinsvc2 frame buffer size, 0 for default\n"
+"  -q, --quota=N       Frame buffer per connection, 0 for default\n"
+"  -Q, --shared=N      Shared frame buffer, 0 for default\n"
+"  -T, --trunk=BYTES   SPI trunk size, 0 for default\n"
+"  -D, --dma=N         SPI descriptor, 0 for default\n"
+"  -h, --help          Show this help\n"
+"\n", prog, impl.dur, impl.link_kbps, impl.clk_khz, impl.sz_min,
+		impl.src_cnt, impl.prio, impl.seed);
+}
+
+int main(int argc, char **argv) {
+	int opt_op, opt_idx, i;
+	unsigned long tx_frm = 0, tx_byte = 0;
+	struct timespec wall0, wall1;
+
+	while ((opt_op = getopt_long(argc, argv, opt_short, opt_long,
+			&opt_idx)) != -1) {
+		switch (opt_op) {
+		case 't':
+			impl.dur = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			impl.link_kbps = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			impl.clk_khz = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			if (sim_dist_parse(optarg) != 0) {
+				log_e("Invalid size distribution: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'c':
+			impl.src_cnt = atoi(optarg);
+			break;
+		case 'z':
+			impl.coal_us = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'P':
+			impl.prio = (unsigned)strtoul(optarg, NULL, 0) & 0x3;
+			break;
+		case 'S':
+			impl.seed = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			impl.svc_cfg.frm_sz = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'q':
+			impl.svc_cfg.frm_quota = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'Q':
+			impl.svc_cfg.frm_shared = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'T':
+			impl.spi_cfg.trunk_sz = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'D':
+			impl.spi_cfg.dma_cnt = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			help(argv[0]);
+			return 0;
+		default:
+			help(argv[0]);
+			return 1;
+		}
+	}
+	if (impl.src_cnt <= 0 || impl.link_kbps == 0 || impl.clk_khz == 0) {
+		log_e("Invalid argument\n");
+		return 1;
+	}
+	if (!(impl.src = calloc(impl.src_cnt, sizeof(*impl.src)))) {
+		log_e("Out of memory\n");
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &wall0);
+
+	if (aloe_sim_start() != 0) {
+		log_e("Failed start simulation\n");
+		return 1;
+	}
+	if (dw_spi2_start(0, impl.clk_khz, &impl.spi_cfg) != 0
+			|| dw_spi2_mock_sink(&sim_sink, NULL) != 0
+			|| (impl.coal_us > 0 && dw_spi2_coalesce(impl.coal_us) != 0)) {
+		log_e("Failed start SPI\n");
+		return 1;
+	}
+	impl.svc_cfg.cln_cnt = impl.src_cnt;
+	if (dw_sinsvc2_init(&impl.svc_cfg) != 0) {
+		log_e("Failed start sinsvc2\n");
+		return 1;
+	}
+	for (i = 0; i < impl.src_cnt; i++) {
+		impl.src[i].id = i;
+		impl.src[i].fd = -1;
+		impl.src[i].rnd = 0x9e3779b97f4a7c15ull ^ (impl.seed + i);
+		if (aloe_thread_run(&impl.src[i].tsk, &sim_src_task, 4096, 1,
+				"sim_src") != 0) {
+			log_e("Failed start source\n");
+			return 1;
+		}
+	}
+
+	aloe_thread_sleep(impl.dur * 1000ul);
+	impl.quit = 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &wall1);
+	for (i = 0; i < impl.src_cnt; i++) {
+		tx_frm += impl.src[i].tx_frm;
+		tx_byte += impl.src[i].tx_byte;
+	}
+	qsort(impl.lat, impl.lat_cnt, sizeof(*impl.lat), &sim_lat_cmp);
+
+	// one line for sweep
+	printf("sim: cfg \"%s\" frm %u quota %u shared %u trunk %u dma %u"
+			" link_kbps %u spi_khz %u conn %d size %u-%u"
+			" tx_frm %lu tx_KBps %.2f spi_frm %lu spi_KBps %.2f"
+			" lat_us p50 %u p99 %u p999 %u max %u wall_ms %ld\n",
+			SIM_CFG, impl.svc_cfg.frm_sz, impl.svc_cfg.frm_quota,
+			impl.svc_cfg.frm_shared, impl.spi_cfg.trunk_sz,
+			impl.spi_cfg.dma_cnt, impl.link_kbps, impl.clk_khz, impl.src_cnt, impl.sz_min,
+			impl.sz_max, tx_frm, tx_byte / 1024.0 / impl.dur, impl.sink_frm,
+			impl.sink_byte / 1024.0 / impl.dur, sim_lat_pct(50),
+			sim_lat_pct(99), sim_lat_pct(99.9),
+			impl.lat_cnt ? impl.lat[impl.lat_cnt - 1] : 0,
+			(wall1.tv_sec - wall0.tv_sec) * 1000l
+			+ (wall1.tv_nsec - wall0.tv_nsec) / 1000000l);
+	fflush(stdout);
+
+	// other thread parked on virtual clock
+	_exit(0);
+}
@@ -0,0 +1,827 @@
+/* $Id$
+ *
+ * Copyright 2023, Joelai
+ * All Rights Reserved.
+ *
+ * @author joelai
+ */
+
+/*
+ * Unit test on Linux host, aloe_unitest suite of the aloe utility, and
+ * sinsvc2 over mock SPI bus.  Thread case yield when spin, the host may run
+ * them on one CPU.
+ *
+ * Exit status 0 when every case pass.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <sched.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <aloe_sys.h>
+#include <aloe_util.h>
+#include <aloe_unitest.h>
+#include "dw_util.h"
+#include "dw_sinsvc.h"
+#include "dw_spi.h"
+#include "dw_sockev.h"
+
+#define log_d(...) aloe_log_d(__VA_ARGS__)
+#define log_e(...) aloe_log_e(__VA_ARGS__)
+
+#define test_tmw_slot_cnt 8
+#define test_tmw_res 10
+
+/* revolution of the test wheel */
+#define test_tmw_rev (test_tmw_slot_cnt * test_tmw_res)
+
+typedef struct {
+	aloe_tmwheel_t tmw;
+	aloe_tmr_list_t slot[test_tmw_slot_cnt];
+	aloe_tmr_t tmr[4];
+} test_tmw_t;
+
+static test_tmw_t test_tmw;
+
+/** Wheel start near the counter wrap, return the start slot time. */
+static unsigned long test_tmw_init(unsigned long ts) {
+	memset(&test_tmw, 0, sizeof(test_tmw));
+	if (aloe_tmwheel_init(&test_tmw.tmw, test_tmw.slot, test_tmw_slot_cnt,
+			test_tmw_res, ts) != 0) {
+		return 0;
+	}
+	return test_tmw.tmw.ts;
+}
+
+/** Due time past the counter wrap expire on time, not at once. */
+static aloe_test_flag_t test_tmw_wrap(aloe_test_case_t *test_case) {
+	unsigned long ts = test_tmw_init((unsigned long)-25);
+	aloe_tmwheel_t *tmw = &test_tmw.tmw;
+
+	ALOE_TEST_ASSERT_RETURN(ts != 0 && (long)ts < 0 && (long)ts > -40,
+			test_case, failed);
+
+	// before the wrap, due after
+	aloe_tmwheel_arm(tmw, &test_tmw.tmr[0], ts + 50);
+	ALOE_TEST_ASSERT_RETURN(aloe_tmwheel_next(tmw) == ts + 50,
+			test_case, failed);
+	ALOE_TEST_ASSERT_RETURN(aloe_tmwheel_expire(tmw, ts) == NULL,
+			test_case, failed);
+	ALOE_TEST_ASSERT_RETURN(aloe_tmwheel_expire(tmw, ts + 41) == NULL,
+			test_case, failed);
+	ALOE_TEST_ASSERT_RETURN(aloe_tmwheel_expire(tmw, ts + 49) == NULL,
+			test_case, failed);
+	ALOE_TEST_ASSERT_RETURN(aloe_tmwheel_expire(tmw, ts + 50)
+			== &test_tmw.tmr[0], test_case, failed);
+	ALOE_TEST_ASSERT_RETURN(!test_tmw.tmr[0].armed && tmw->cnt == 0,
+			test_case, failed);
+	ALOE_TEST_ASSERT_RETURN(aloe_tmwheel_next(tmw) == aloe_dur_infinite,
+			test_case, failed);
+
+	// armed past due after the wrap, expire at once
+	aloe_tmwheel_arm(tmw, &test_tmw.tmr[1], ts + 40);
+	ALOE_TEST_ASSERT_RETURN(aloe_tmwheel_expire(tmw, ts + 51)
+			== &test_tmw.tmr[1], test_case, failed);
+	return aloe_test_flag_result_pass;
+}
+
+/** Idle wheel catch up across the wrap then hash relative to the cursor. */
+static aloe_test_flag_t test_tmw_idle(aloe_test_case_t *test_case) {
+	unsigned long ts = test_tmw_init((unsigned long)-1000);
+	aloe_tmwheel_t *tmw = &test_tmw.tmw;
+
+	ALOE_TEST_ASSERT_RETURN(ts != 0, test_case, failed);
+
+	ALOE_TEST_ASSERT_RETURN(aloe_tmwheel_expire(tmw, ts + 5005) == NULL,
+			test_case, failed);
+	ALOE_TEST_ASSERT_RETURN(tmw->ts == ts + 5000, test_case, failed);
+
+	aloe_tmwheel_arm(tmw, &test_tmw.tmr[0], ts + 5030);
+	ALOE_TEST_ASSERT_RETURN(aloe_tmwheel_expire(tmw, ts + 5029) == NULL,
+			test_case, failed);
+	ALOE_TEST_ASSERT_RETURN(aloe_tmwheel_expire(tmw, ts + 5030)
+			== &test_tmw.tmr[0], test_case, failed);
+	return aloe_test_flag_result_pass;
+}
+
+/** Earliest due from the nearest slot, timer of later round skipped. */
+static aloe_test_flag_t test_tmw_next(aloe_test_case_t *test_case) {
+	unsigned long ts = test_tmw_init((unsigned long)-30);
+	aloe_tmwheel_t *tmw = &test_tmw.tmw;
+
+	ALOE_TEST_ASSERT_RETURN(ts != 0, test_case, failed);
+
+	// same slot as tmr[2] one revolution later
+	aloe_tmwheel_arm(tmw, &test_tmw.tmr[0], ts + test_tmw_rev + 45);
+	ALOE_TEST_ASSERT_RETURN(aloe_tmwheel_next(tmw) == ts + test_tmw_rev,
+			test_case, failed);
+
+	aloe_tmwheel_arm(tmw, &test_tmw.tmr[1], ts + 67);
+	aloe_tmwheel_arm(tmw, &test_tmw.tmr[2], ts + 48);
+	aloe_tmwheel_arm(tmw, &test_tmw.tmr[3], ts + 42);
+	ALOE_TEST_ASSERT_RETURN(aloe_tmwheel_next(tmw) == ts + 42,
+			test_case, failed);
+
+	aloe_tmwheel_cancel(tmw, &test_tmw.tmr[3]);
+	ALOE_TEST_ASSERT_RETURN(aloe_tmwheel_next(tmw) == ts + 48,
+			test_case, failed);
+	aloe_tmwheel_cancel(tmw, &test_tmw.tmr[2]);
+	ALOE_TEST_ASSERT_RETURN(aloe_tmwheel_next(tmw) == ts + 67,
+			test_case, failed);
+
+	// re-arm move the timer
+	aloe_tmwheel_arm(tmw, &test_tmw.tmr[1], ts + 5);
+	ALOE_TEST_ASSERT_RETURN(aloe_tmwheel_next(tmw) == ts + 5,
+			test_case, failed);
+	ALOE_TEST_ASSERT_RETURN(aloe_tmwheel_expire(tmw, ts + 5)
+			== &test_tmw.tmr[1], test_case, failed);
+
+	// the later round not expire with the slot
+	ALOE_TEST_ASSERT_RETURN(aloe_tmwheel_expire(tmw, ts + 60) == NULL,
+			test_case, failed);
+	ALOE_TEST_ASSERT_RETURN(aloe_tmwheel_next(tmw) == ts + test_tmw_rev + 45,
+			test_case, failed);
+	ALOE_TEST_ASSERT_RETURN(aloe_tmwheel_expire(tmw, ts + test_tmw_rev + 45)
+			== &test_tmw.tmr[0], test_case, failed);
+	ALOE_TEST_ASSERT_RETURN(tmw->cnt == 0, test_case, failed);
+	return aloe_test_flag_result_pass;
+}
+
+#define test_tmw2_slot_cnt 128
+#define test_tmw2_tmr_cnt 32
+
+/** Wheel of many bitmap word against linear scan, random arm and expire. */
+static aloe_test_flag_t test_tmw_random(aloe_test_case_t *test_case) {
+	static aloe_tmwheel_t tmw;
+	static aloe_tmr_list_t slot[test_tmw2_slot_cnt];
+	static aloe_tmr_t tmr[test_tmw2_tmr_cnt];
+	unsigned long now = (unsigned long)-5000, tdue;
+	unsigned rnd = 1, i, j;
+
+	memset(tmr, 0, sizeof(tmr));
+	ALOE_TEST_ASSERT_RETURN(aloe_tmwheel_init(&tmw, slot, test_tmw2_slot_cnt,
+			test_tmw_res, now) == 0, test_case, failed);
+	now = tmw.ts;
+
+	for (i = 0; i < 20000; i++) {
+		rnd = rnd * 1103515245 + 12345;
+		j = (rnd >> 8) % test_tmw2_tmr_cnt;
+
+		// within the round of the cursor slot
+		aloe_tmwheel_arm(&tmw, &tmr[j], tmw.ts
+				+ (rnd >> 16) % ((test_tmw2_slot_cnt - 1) * test_tmw_res));
+
+		for (tdue = aloe_dur_infinite, j = 0; j < test_tmw2_tmr_cnt; j++) {
+			if (!tmr[j].armed) continue;
+			if (tdue == aloe_dur_infinite || (long)(tmr[j].tdue - tdue) < 0) {
+				tdue = tmr[j].tdue;
+			}
+		}
+		ALOE_TEST_ASSERT_RETURN(aloe_tmwheel_next(&tmw) == tdue,
+				test_case, failed);
+
+		now += (rnd >> 20) % 40;
+		while (aloe_tmwheel_expire(&tmw, now));
+		for (j = 0; j < test_tmw2_tmr_cnt; j++) {
+			ALOE_TEST_ASSERT_RETURN(!tmr[j].armed
+					|| (long)(tmr[j].tdue - now) > 0, test_case, failed);
+		}
+	}
+	// crossed the wrap
+	ALOE_TEST_ASSERT_RETURN((long)now > 0, test_case, failed);
+	return aloe_test_flag_result_pass;
+}
+
+#define test_spsc_cnt 8
+#define test_spsc_xfer 200000
+
+static struct {
+	aloe_spsc_t spsc;
+	void *ent[test_spsc_cnt];
+	aloe_thread_t tsk;
+} test_spsc;
+
+/** Empty and full edge, index across the unsigned wrap. */
+static aloe_test_flag_t test_spsc_edge(aloe_test_case_t *test_case) {
+	aloe_spsc_t *spsc = &test_spsc.spsc;
+	uintptr_t i;
+
+	aloe_spsc_init(spsc, test_spsc.ent, test_spsc_cnt);
+	spsc->wr = spsc->rd = (unsigned)-3;
+	ALOE_TEST_ASSERT_RETURN(aloe_spsc_pop(spsc) == NULL, test_case, failed);
+
+	for (i = 1; i <= test_spsc_cnt; i++) {
+		ALOE_TEST_ASSERT_RETURN(aloe_spsc_push(spsc, (void*)i) == 0,
+				test_case, failed);
+	}
+	ALOE_TEST_ASSERT_RETURN(aloe_spsc_push(spsc, (void*)i) != 0,
+			test_case, failed);
+
+	for (i = 1; i <= test_spsc_cnt; i++) {
+		ALOE_TEST_ASSERT_RETURN(aloe_spsc_pop(spsc) == (void*)i,
+				test_case, failed);
+		ALOE_TEST_ASSERT_RETURN(aloe_spsc_push(spsc, (void*)(i + 100)) == 0,
+				test_case, failed);
+	}
+	for (i = 1; i <= test_spsc_cnt; i++) {
+		ALOE_TEST_ASSERT_RETURN(aloe_spsc_pop(spsc) == (void*)(i + 100),
+				test_case, failed);
+	}
+	ALOE_TEST_ASSERT_RETURN(aloe_spsc_pop(spsc) == NULL, test_case, failed);
+	return aloe_test_flag_result_pass;
+}
+
+static void test_spsc_producer(aloe_thread_t *args) {
+	uintptr_t i;
+
+	(void)args;
+	for (i = 1; i <= test_spsc_xfer; i++) {
+		while (aloe_spsc_push(&test_spsc.spsc, (void*)i) != 0) sched_yield();
+	}
+}
+
+/** Producer thread, every entry pop in order. */
+static aloe_test_flag_t test_spsc_order(aloe_test_case_t *test_case) {
+	aloe_spsc_t *spsc = &test_spsc.spsc;
+	uintptr_t i;
+	void *v;
+
+	aloe_spsc_init(spsc, test_spsc.ent, test_spsc_cnt);
+	ALOE_TEST_ASSERT_RETURN(aloe_thread_run(&test_spsc.tsk,
+			&test_spsc_producer, 4096, 0, "spsc") == 0, test_case, failed);
+
+	for (i = 1; i <= test_spsc_xfer; i++) {
+		while (!(v = aloe_spsc_pop(spsc))) sched_yield();
+		if (v != (void*)i) break;
+	}
+	pthread_join(test_spsc.tsk.thread, NULL);
+	ALOE_TEST_ASSERT_RETURN(i > test_spsc_xfer, test_case, failed);
+	ALOE_TEST_ASSERT_RETURN(aloe_spsc_pop(spsc) == NULL, test_case, failed);
+	return aloe_test_flag_result_pass;
+}
+
+#define test_mpsc_cnt 8
+#define test_mpsc_tsk_cnt 3
+#define test_mpsc_xfer 50000
+
+/* producer id and sequence */
+typedef struct {
+	unsigned id, seq;
+} test_mpsc_ent_t;
+
+static struct {
+	aloe_mpsc_t mpsc;
+	char buf[aloe_mpsc_size(sizeof(test_mpsc_ent_t), test_mpsc_cnt)];
+	aloe_thread_t tsk[test_mpsc_tsk_cnt];
+} test_mpsc;
+
+/**
+ * Empty and full edge after a few round, the slot reserved but not committed
+ * hold back the one after.
+ */
+static aloe_test_flag_t test_mpsc_edge(aloe_test_case_t *test_case) {
+	aloe_mpsc_t *mpsc = &test_mpsc.mpsc;
+	test_mpsc_ent_t *ent[test_mpsc_cnt], *e;
+	unsigned i;
+
+	aloe_mpsc_init(mpsc, test_mpsc.buf, sizeof(test_mpsc_ent_t),
+			test_mpsc_cnt);
+	ALOE_TEST_ASSERT_RETURN(aloe_mpsc_peek(mpsc) == NULL, test_case, failed);
+
+	// a few round so the sequence walk on
+	for (i = 0; i < test_mpsc_cnt * 3 + 1; i++) {
+		ALOE_TEST_ASSERT_RETURN((e = aloe_mpsc_reserve(mpsc)) != NULL,
+				test_case, failed);
+		aloe_mpsc_commit(mpsc, e);
+		ALOE_TEST_ASSERT_RETURN(aloe_mpsc_peek(mpsc) == e, test_case, failed);
+		aloe_mpsc_release(mpsc);
+	}
+
+	for (i = 0; i < test_mpsc_cnt; i++) {
+		ALOE_TEST_ASSERT_RETURN((ent[i] = aloe_mpsc_reserve(mpsc)) != NULL,
+				test_case, failed);
+		ent[i]->seq = i;
+	}
+	ALOE_TEST_ASSERT_RETURN(aloe_mpsc_reserve(mpsc) == NULL,
+			test_case, failed);
+
+	// commit out of order, the head not yet
+	for (i = test_mpsc_cnt - 1; i > 0; i--) aloe_mpsc_commit(mpsc, ent[i]);
+	ALOE_TEST_ASSERT_RETURN(aloe_mpsc_peek(mpsc) == NULL, test_case, failed);
+	aloe_mpsc_commit(mpsc, ent[0]);
+
+	for (i = 0; i < test_mpsc_cnt; i++) {
+		ALOE_TEST_ASSERT_RETURN((e = aloe_mpsc_peek(mpsc)) != NULL
+				&& e->seq == i, test_case, failed);
+		aloe_mpsc_release(mpsc);
+	}
+	ALOE_TEST_ASSERT_RETURN(aloe_mpsc_peek(mpsc) == NULL, test_case, failed);
+	return aloe_test_flag_result_pass;
+}
+
+static void test_mpsc_producer(aloe_thread_t *args) {
+	unsigned id = (unsigned)(args - test_mpsc.tsk), i;
+	test_mpsc_ent_t *ent;
+
+	for (i = 0; i < test_mpsc_xfer; i++) {
+		while (!(ent = aloe_mpsc_reserve(&test_mpsc.mpsc))) sched_yield();
+		ent->id = id;
+		ent->seq = i;
+		aloe_mpsc_commit(&test_mpsc.mpsc, ent);
+	}
+}
+
+/** Producer threads, each one in order and nothing lost. */
+static aloe_test_flag_t test_mpsc_order(aloe_test_case_t *test_case) {
+	aloe_mpsc_t *mpsc = &test_mpsc.mpsc;
+	unsigned seq[test_mpsc_tsk_cnt] = {}, cnt, bad = 0;
+	test_mpsc_ent_t *ent;
+	int i, r = 0;
+
+	aloe_mpsc_init(mpsc, test_mpsc.buf, sizeof(test_mpsc_ent_t),
+			test_mpsc_cnt);
+	for (i = 0; i < test_mpsc_tsk_cnt; i++) {
+		if (aloe_thread_run(&test_mpsc.tsk[i], &test_mpsc_producer, 4096, 0,
+				"mpsc") != 0) {
+			r = -1;
+			break;
+		}
+	}
+
+	for (cnt = 0; r == 0 && cnt < test_mpsc_tsk_cnt * test_mpsc_xfer; cnt++) {
+		while (!(ent = aloe_mpsc_peek(mpsc))) sched_yield();
+		if (ent->id >= test_mpsc_tsk_cnt || ent->seq != seq[ent->id]++) bad++;
+		aloe_mpsc_release(mpsc);
+	}
+	while (--i >= 0) pthread_join(test_mpsc.tsk[i].thread, NULL);
+	ALOE_TEST_ASSERT_RETURN(r == 0, test_case, prerequisite);
+
+	ALOE_TEST_ASSERT_RETURN(bad == 0, test_case, failed);
+	ALOE_TEST_ASSERT_RETURN(aloe_mpsc_peek(mpsc) == NULL, test_case, failed);
+	return aloe_test_flag_result_pass;
+}
+
+#define test_pool_cnt 4
+#define test_pool_obj_sz 24
+#define test_pool_tsk_cnt 6
+#define test_pool_xfer 50000
+
+static struct {
+	aloe_pool_t pool;
+	char buf[aloe_pool_size(test_pool_obj_sz, test_pool_cnt, 8)];
+	aloe_thread_t tsk[test_pool_tsk_cnt];
+
+	/* object taken by other thread at once */
+	int corrupt;
+} test_pool;
+
+/** Pool of test_pool_cnt object, index in the low bits of head. */
+static int test_pool_init(void) {
+	memset(&test_pool, 0, sizeof(test_pool));
+	return aloe_pool_init(&test_pool.pool, test_pool.buf, test_pool_obj_sz,
+			test_pool_cnt, 8);
+}
+
+/** Empty and full edge, foreign object rejected, high-water mark. */
+static aloe_test_flag_t test_pool_edge(aloe_test_case_t *test_case) {
+	aloe_pool_t *pool = &test_pool.pool;
+	void *obj[test_pool_cnt];
+	int i, j;
+
+	ALOE_TEST_ASSERT_RETURN(test_pool_init() == 0, test_case, prerequisite);
+
+	for (i = 0; i < test_pool_cnt; i++) {
+		ALOE_TEST_ASSERT_RETURN((obj[i] = aloe_pool_get(pool)) != NULL,
+				test_case, failed);
+		for (j = 0; j < i; j++) {
+			ALOE_TEST_ASSERT_RETURN(obj[j] != obj[i], test_case, failed);
+		}
+	}
+	ALOE_TEST_ASSERT_RETURN(aloe_pool_get(pool) == NULL, test_case, failed);
+	ALOE_TEST_ASSERT_RETURN(pool->used == test_pool_cnt
+			&& pool->used_max == test_pool_cnt, test_case, failed);
+
+	// inside but not at object boundary, before and past the pool
+	ALOE_TEST_ASSERT_RETURN(aloe_pool_put(pool, (char*)obj[0] + 1) != 0
+			&& aloe_pool_put(pool, pool->base - test_pool_obj_sz) != 0
+			&& aloe_pool_put(pool, aloe_pool_obj(pool, test_pool_cnt)) != 0,
+			test_case, failed);
+
+	// last put the first get
+	for (i = 0; i < test_pool_cnt; i++) {
+		ALOE_TEST_ASSERT_RETURN(aloe_pool_put(pool, obj[i]) == 0,
+				test_case, failed);
+	}
+	ALOE_TEST_ASSERT_RETURN(pool->used == 0
+			&& pool->used_max == test_pool_cnt, test_case, failed);
+	for (i = test_pool_cnt - 1; i >= 0; i--) {
+		ALOE_TEST_ASSERT_RETURN(aloe_pool_get(pool) == obj[i],
+				test_case, failed);
+	}
+	ALOE_TEST_ASSERT_RETURN(aloe_pool_get(pool) == NULL, test_case, failed);
+	return aloe_test_flag_result_pass;
+}
+
+/**
+ * Same head index back by get get put change the tag, stale CAS fail.  The
+ * tag wrap past 32 bits keep the free list.
+ */
+static aloe_test_flag_t test_pool_tag(aloe_test_case_t *test_case) {
+	aloe_pool_t *pool = &test_pool.pool;
+	uint64_t head;
+	void *a, *b;
+	int i;
+
+	ALOE_TEST_ASSERT_RETURN(test_pool_init() == 0, test_case, prerequisite);
+
+	head = pool->head;
+	ALOE_TEST_ASSERT_RETURN((a = aloe_pool_get(pool)) != NULL
+			&& (b = aloe_pool_get(pool)) != NULL
+			&& aloe_pool_put(pool, a) == 0, test_case, failed);
+	ALOE_TEST_ASSERT_RETURN((uint32_t)pool->head == (uint32_t)head
+			&& pool->head != head, test_case, failed);
+	ALOE_TEST_ASSERT_RETURN(aloe_pool_put(pool, b) == 0, test_case, failed);
+
+	pool->head = (pool->head & 0xffffffffull) | 0xfffffffd00000000ull;
+	for (i = 0; i < 8; i++) {
+		ALOE_TEST_ASSERT_RETURN((a = aloe_pool_get(pool)) != NULL
+				&& aloe_pool_put(pool, a) == 0, test_case, failed);
+	}
+	ALOE_TEST_ASSERT_RETURN((pool->head >> 32) < 0x100, test_case, failed);
+
+	for (i = 0; i < test_pool_cnt; i++) {
+		ALOE_TEST_ASSERT_RETURN(aloe_pool_get(pool) != NULL,
+				test_case, failed);
+	}
+	ALOE_TEST_ASSERT_RETURN(aloe_pool_get(pool) == NULL, test_case, failed);
+	return aloe_test_flag_result_pass;
+}
+
+static void test_pool_worker(aloe_thread_t *args) {
+	int id = (int)(args - test_pool.tsk) + 1, i;
+	int *obj;
+
+	for (i = 0; i < test_pool_xfer; i++) {
+		while (!(obj = (int*)aloe_pool_get(&test_pool.pool))) sched_yield();
+
+		// nobody else hold it meanwhile
+		*obj = id;
+		if (i % 7 == 0) sched_yield();
+		if (*obj != id) aloe_atomic_add(&test_pool.corrupt, 1);
+		if (aloe_pool_put(&test_pool.pool, obj) != 0) {
+			aloe_atomic_add(&test_pool.corrupt, 1);
+		}
+	}
+}
+
+/** More thread than object get and put, each object held by one at once. */
+static aloe_test_flag_t test_pool_contention(aloe_test_case_t *test_case) {
+	aloe_pool_t *pool = &test_pool.pool;
+	int i, r = 0;
+
+	ALOE_TEST_ASSERT_RETURN(test_pool_init() == 0, test_case, prerequisite);
+
+	for (i = 0; i < test_pool_tsk_cnt; i++) {
+		if (aloe_thread_run(&test_pool.tsk[i], &test_pool_worker, 4096, 0,
+				"pool") != 0) {
+			r = -1;
+			break;
+		}
+	}
+	while (--i >= 0) pthread_join(test_pool.tsk[i].thread, NULL);
+	ALOE_TEST_ASSERT_RETURN(r == 0, test_case, prerequisite);
+
+	ALOE_TEST_ASSERT_RETURN(test_pool.corrupt == 0 && pool->used == 0,
+			test_case, failed);
+	for (i = 0; i < test_pool_cnt; i++) {
+		ALOE_TEST_ASSERT_RETURN(aloe_pool_get(pool) != NULL,
+				test_case, failed);
+	}
+	ALOE_TEST_ASSERT_RETURN(aloe_pool_get(pool) == NULL, test_case, failed);
+	return aloe_test_flag_result_pass;
+}
+
+/** Wait without block, sel of the only socket or 0 when none ready. */
+static unsigned test_sockev_sel(dw_sockev_t *ev) {
+	dw_sockev_res_t res[2];
+
+	return (*ev->ops->wait)(ev, 0, res, 2) == 1 ? res[0].sel : 0;
+}
+
+/** Peer hangup reported as the interest only. */
+static int test_sockev_hup_run(const dw_sockev_ops_t *ops) {
+	dw_sockev_t ev;
+	int fd[2] = {-1, -1}, r = -1;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) != 0) return -1;
+	if (dw_sockev_init(&ev, ops, 4) != 0) goto finally;
+	if (dw_sockev_add(&ev, fd[0], dw_sockev_rd, &ev) != 0) goto finally;
+	close(fd[1]);
+	fd[1] = -1;
+
+	// throttled reader not woken by the hangup
+	if (dw_sockev_mod(&ev, fd[0], 0, &ev) != 0
+			|| test_sockev_sel(&ev) != 0) {
+		goto destroy;
+	}
+	if (dw_sockev_mod(&ev, fd[0], dw_sockev_wr, &ev) != 0
+			|| test_sockev_sel(&ev) != dw_sockev_wr) {
+		goto destroy;
+	}
+	if (dw_sockev_mod(&ev, fd[0], dw_sockev_rd, &ev) != 0
+			|| test_sockev_sel(&ev) != dw_sockev_rd) {
+		goto destroy;
+	}
+	if (dw_sockev_del(&ev, fd[0]) != 0 || test_sockev_sel(&ev) != 0) {
+		goto destroy;
+	}
+	r = 0;
+destroy:
+	dw_sockev_destroy(&ev);
+finally:
+	if (fd[0] != -1) close(fd[0]);
+	if (fd[1] != -1) close(fd[1]);
+	return r;
+}
+
+/** Every backend agree with select on hangup. */
+static aloe_test_flag_t test_sockev_hup(aloe_test_case_t *test_case) {
+	ALOE_TEST_ASSERT_RETURN(test_sockev_hup_run(&dw_sockev_select_ops) == 0,
+			test_case, failed);
+	ALOE_TEST_ASSERT_RETURN(test_sockev_hup_run(&dw_sockev_poll_ops) == 0,
+			test_case, failed);
+	ALOE_TEST_ASSERT_RETURN(test_sockev_hup_run(&dw_sockev_epoll_ops) == 0,
+			test_case, failed);
+	return aloe_test_flag_result_pass;
+}
+
+/* same as dw_sinsvc2.c */
+typedef struct __attribute__((packed)) {
+	uint32_t tag;
+	uint32_t len;
+} pkt2_hdr_t;
+
+#define pkt2_tag_s (1 << 0)
+#define pkt2_tag_e (1 << 1)
+
+/* mock bus sink record what go on the wire */
+static struct {
+	int ready;
+	aloe_sem_t lock;
+	char sink[4096];
+	size_t sink_lmt;
+} test_svc;
+
+static size_t test_svc_sink(const void *tx, size_t sz, void *rx,
+		size_t rx_sz, void *cbarg) {
+	(void)rx;
+	(void)rx_sz;
+	(void)cbarg;
+
+	if (aloe_sem_wait(&test_svc.lock, NULL, aloe_dur_infinite,
+			"test_svc") != 0) {
+		return 0;
+	}
+	sz = aloe_min(sz, sizeof(test_svc.sink) - test_svc.sink_lmt);
+	memcpy(test_svc.sink + test_svc.sink_lmt, tx, sz);
+	test_svc.sink_lmt += sz;
+	aloe_sem_post(&test_svc.lock, NULL, "test_svc");
+	return 0;
+}
+
+/** Start SPI and sinsvc2 once, clear the sink. */
+static int test_svc_start(void) {
+	if (!test_svc.ready) {
+		if (aloe_sem_init(&test_svc.lock, 1, 1, "test_svc") != 0
+				|| dw_spi2_start(0, 25000, NULL) != 0
+				|| dw_spi2_mock_sink(&test_svc_sink, NULL) != 0
+				|| dw_sinsvc2_init(NULL) != 0) {
+			return -1;
+		}
+		test_svc.ready = 1;
+	}
+	aloe_sem_wait(&test_svc.lock, NULL, aloe_dur_infinite, "test_svc");
+	test_svc.sink_lmt = 0;
+	aloe_sem_post(&test_svc.lock, NULL, "test_svc");
+	return 0;
+}
+
+/** Client connected to sinsvc2, retry while the task open the port. */
+static int test_svc_conn(void) {
+	struct sockaddr_in sin;
+	int fd, i;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(DECKWIFI_SOCKET_SVC_PORT);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	for (i = 0; i < 30; i++) {
+		if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) return -1;
+		if (connect(fd, (struct sockaddr*)&sin, sizeof(sin)) == 0) return fd;
+		close(fd);
+		aloe_thread_sleep(100);
+	}
+	return -1;
+}
+
+/** Write one dw_pkt2 frame, payload filled with the byte. */
+static int test_svc_frm(int fd, uint32_t tag, uint32_t len, char c) {
+	char buf[sizeof(pkt2_hdr_t) + 256];
+	pkt2_hdr_t *pkt = (pkt2_hdr_t*)buf;
+	size_t sz = sizeof(*pkt) + len;
+
+	if (sz > sizeof(buf)) return -1;
+	pkt->tag = tag;
+	pkt->len = len;
+	memset(pkt + 1, c, len);
+	return send(fd, buf, sz, 0) == (ssize_t)sz ? 0 : -1;
+}
+
+/** Wait the sink take len bytes, return bytes taken. */
+static size_t test_svc_sink_wait(size_t len, unsigned long ms) {
+	unsigned long ts = aloe_tick2ms(aloe_ticks());
+	size_t lmt;
+
+	while (1) {
+		aloe_sem_wait(&test_svc.lock, NULL, aloe_dur_infinite, "test_svc");
+		lmt = test_svc.sink_lmt;
+		aloe_sem_post(&test_svc.lock, NULL, "test_svc");
+		if (lmt >= len || aloe_tick2ms(aloe_ticks()) - ts >= ms) return lmt;
+		aloe_thread_sleep(10);
+	}
+}
+
+/** Sink hold len bytes of c from pos. */
+static int test_svc_sink_run(size_t pos, size_t len, char c) {
+	for ( ; len > 0; pos++, len--) {
+		if (pos >= test_svc.sink_lmt || test_svc.sink[pos] != c) return 0;
+	}
+	return 1;
+}
+
+/** Peer closed within ms. */
+static int test_svc_closed(int fd, unsigned long ms) {
+	struct pollfd pfd = {.fd = fd, .events = POLLIN};
+	char c;
+
+	if (poll(&pfd, 1, (int)ms) <= 0) return 0;
+	return recv(fd, &c, sizeof(c), MSG_DONTWAIT) <= 0;
+}
+
+/**
+ * Neither s nor e taken as whole message, fragment s, none, e in order, and
+ * s|e, the client stay connected.
+ */
+static aloe_test_flag_t test_svc_tag(aloe_test_case_t *test_case) {
+	int fd = -1;
+
+	ALOE_TEST_ASSERT_THEN(test_svc_start() == 0
+			&& (fd = test_svc_conn()) != -1,
+			test_case, prerequisite, goto finally);
+
+	ALOE_TEST_ASSERT_THEN(test_svc_frm(fd, 0, 100, 'a') == 0
+			&& test_svc_frm(fd, pkt2_tag_s, 60, 'b') == 0
+			&& test_svc_frm(fd, 0, 20, 'c') == 0
+			&& test_svc_frm(fd, pkt2_tag_e, 40, 'd') == 0
+			&& test_svc_frm(fd, pkt2_tag_s | pkt2_tag_e, 80, 'f') == 0,
+			test_case, failed, goto finally);
+	ALOE_TEST_ASSERT_THEN(test_svc_sink_wait(300, 2000) == 300,
+			test_case, failed, goto finally);
+	ALOE_TEST_ASSERT_THEN(test_svc_sink_run(0, 100, 'a')
+			&& test_svc_sink_run(100, 60, 'b')
+			&& test_svc_sink_run(160, 20, 'c')
+			&& test_svc_sink_run(180, 40, 'd')
+			&& test_svc_sink_run(220, 80, 'f'),
+			test_case, failed, goto finally);
+	ALOE_TEST_ASSERT_THEN(!test_svc_closed(fd, 200),
+			test_case, failed, goto finally);
+	test_case->flag_result = aloe_test_flag_result_pass;
+finally:
+	if (fd != -1) close(fd);
+	return test_case->flag_result;
+}
+
+/**
+ * Frame buffer popped again between the put and the count in cln_frm_done,
+ * see dw_test_race.h, credit still come back for far more frames than the
+ * pool.
+ */
+static aloe_test_flag_t test_svc_credit(aloe_test_case_t *test_case) {
+	int fd = -1, i;
+
+	ALOE_TEST_ASSERT_THEN(test_svc_start() == 0
+			&& (fd = test_svc_conn()) != -1,
+			test_case, prerequisite, goto finally);
+
+	for (i = 0; i < 48; i++) {
+		ALOE_TEST_ASSERT_THEN(test_svc_frm(fd, pkt2_tag_s | pkt2_tag_e, 64,
+				'g') == 0, test_case, failed, goto finally);
+	}
+	ALOE_TEST_ASSERT_THEN(test_svc_sink_wait(48 * 64, 2000) == 48 * 64
+			&& test_svc_sink_run(0, 48 * 64, 'g'),
+			test_case, failed, goto finally);
+	ALOE_TEST_ASSERT_THEN(!test_svc_closed(fd, 200),
+			test_case, failed, goto finally);
+	test_case->flag_result = aloe_test_flag_result_pass;
+finally:
+	if (fd != -1) close(fd);
+	return test_case->flag_result;
+}
+
+/**
+ * Open chain hold the bus, other client wait until the owner dropped at
+ * sinsvc2_hold_max_ms.
+ */
+static aloe_test_flag_t test_svc_hold(aloe_test_case_t *test_case) {
+	int fd = -1, fd2 = -1;
+
+	ALOE_TEST_ASSERT_THEN(test_svc_start() == 0
+			&& (fd = test_svc_conn()) != -1
+			&& (fd2 = test_svc_conn()) != -1,
+			test_case, prerequisite, goto finally);
+
+	ALOE_TEST_ASSERT_THEN(test_svc_frm(fd, pkt2_tag_s, 50, 'a') == 0
+			&& test_svc_sink_wait(50, 1000) == 50,
+			test_case, failed, goto finally);
+	ALOE_TEST_ASSERT_THEN(test_svc_frm(fd2, pkt2_tag_s | pkt2_tag_e, 30,
+			'b') == 0, test_case, failed, goto finally);
+	ALOE_TEST_ASSERT_THEN(test_svc_sink_wait(80, 50) == 50,
+			test_case, failed, goto finally);
+
+	ALOE_TEST_ASSERT_THEN(test_svc_closed(fd, 2000),
+			test_case, failed, goto finally);
+	ALOE_TEST_ASSERT_THEN(test_svc_sink_wait(80, 1000) == 80
+			&& test_svc_sink_run(50, 30, 'b'),
+			test_case, failed, goto finally);
+	ALOE_TEST_ASSERT_THEN(!test_svc_closed(fd2, 200),
+			test_case, failed, goto finally);
+	test_case->flag_result = aloe_test_flag_result_pass;
+finally:
+	if (fd != -1) close(fd);
+	if (fd2 != -1) close(fd2);
+	return test_case->flag_result;
+}
+
+static int test_reporter(unsigned lvl, const char *tag, long lno,
+		const char *fmt, ...) {
+	va_list va;
+
+	(void)lvl;
+	printf("%s #%d ", tag, (int)lno);
+	va_start(va, fmt);
+	vprintf(fmt, va);
+	va_end(va);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	aloe_test_t test_base;
+	aloe_test_report_t test_report;
+
+	(void)argc;
+	(void)argv;
+
+	ALOE_TEST_INIT(&test_base, "dw_test");
+
+	ALOE_TEST_CASE_INIT4(&test_base, "dw_test/tmwheel/wrap", &test_tmw_wrap);
+	ALOE_TEST_CASE_INIT4(&test_base, "dw_test/tmwheel/idle", &test_tmw_idle);
+	ALOE_TEST_CASE_INIT4(&test_base, "dw_test/tmwheel/next", &test_tmw_next);
+	ALOE_TEST_CASE_INIT4(&test_base, "dw_test/tmwheel/random",
+			&test_tmw_random);
+	ALOE_TEST_CASE_INIT4(&test_base, "dw_test/spsc/edge", &test_spsc_edge);
+	ALOE_TEST_CASE_INIT4(&test_base, "dw_test/spsc/order", &test_spsc_order);
+	ALOE_TEST_CASE_INIT4(&test_base, "dw_test/mpsc/edge", &test_mpsc_edge);
+	ALOE_TEST_CASE_INIT4(&test_base, "dw_test/mpsc/order", &test_mpsc_order);
+	ALOE_TEST_CASE_INIT4(&test_base, "dw_test/pool/edge", &test_pool_edge);
+	ALOE_TEST_CASE_INIT4(&test_base, "dw_test/pool/tag", &test_pool_tag);
+	ALOE_TEST_CASE_INIT4(&test_base, "dw_test/pool/contention",
+			&test_pool_contention);
+	ALOE_TEST_CASE_INIT4(&test_base, "dw_test/sockev/hup", &test_sockev_hup);
+	ALOE_TEST_CASE_INIT4(&test_base, "dw_test/sinsvc2/tag", &test_svc_tag);
+	ALOE_TEST_CASE_INIT4(&test_base, "dw_test/sinsvc2/credit",
+			&test_svc_credit);
+	ALOE_TEST_CASE_INIT4(&test_base, "dw_test/sinsvc2/hold", &test_svc_hold);
+
+	ALOE_TEST_RUN(&test_base);
+
+	memset(&test_report, 0, sizeof(test_report));
+	test_report.log = &test_reporter;
+	aloe_test_report(&test_base, &test_report);
+
+	printf("Report result %s, test suite[%s]"
+			"%s  Summary total cases PASS: %d, FAILED: %d(PREREQUISITE: %d), TOTAL: %d" aloe_endl,
+			ALOE_TEST_RESULT_STR(test_base.runner.flag_result, "UNKNOWN"),
+			test_base.runner.name,
+			aloe_endl, test_report.pass, test_report.failed,
+			test_report.failed_prereq, test_report.total);
+	return test_report.failed == 0 && test_report.pass == test_report.total ?
+			0 : 1;
+}
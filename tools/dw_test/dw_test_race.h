@@ -0,0 +1,30 @@
+/* $Id$
+ *
+ * Copyright 2023, Joelai
+ * All Rights Reserved.
+ *
+ * @author joelai
+ */
+
+/*
+ * Forced in front of every source of dw_test.  Race seam of dw_sinsvc2.c
+ * played at once instead of waiting the scheduler.
+ */
+
+#ifndef _H_DW_TEST_RACE
+#define _H_DW_TEST_RACE
+
+/*
+ * cln_frm_done, the task pop the frame as another client right after the
+ * put, the callback count by what it read before.
+ */
+#define sinsvc2_frm_done_race(_frm_req) do { \
+	frm_req_t *_frm = (frm_req_t*)aloe_pool_get(impl.frm_pool); \
+	if (_frm) { \
+		_frm->cln = NULL; \
+		_frm->flag ^= frm_flag_shared; \
+		aloe_pool_put(impl.frm_pool, _frm); \
+	} \
+} while(0)
+
+#endif /* _H_DW_TEST_RACE */